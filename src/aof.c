@@ -7,77 +7,538 @@
 * save_aof
 * Dump data in buffer to aof file.
 *
-* add_aof
-* Add data to buffer. If buffer is full, call save_aof.
+* add_aof, add_aof_len
+* Add data to buffer. If buffer is full, write it out together with the data.
+*
+* close_aof, close_aofs
+* Optionally save the buffer, then release one / all the Aof objects.
 *
 * set_aofs
 * Init all the Aof objects with global variables aof_number and aof_filename.
+* Their full buffers are queued to a pool of writer threads instead of being
+* written on the caller's thread, see AofWriter below.
+*
+* aofs_stats
+* Queue depth and backpressure stats of an Aof set.
+*
+* aofs_shards
+* Keys and bytes added to each Aof of a set.
 *
 * author: sunlei
 * 2014.08.26
 ****************************/
 
 #include "aof.h"
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+// iovecs per writev of a writer thread.
+#define AOF_IOV 64
+
+/*
+ * Writer pool of an Aof set. The caller fills aof->buffer as usual; when it
+ * is full the block behind it goes to the tail of the file's queue and the
+ * file to the ready list, and the caller carries on with a free block. A
+ * writer takes a ready file, writes every queued block of it with writev
+ * and gives the blocks back. A file is written by one writer at a time, so
+ * its blocks reach the disk in order.
+ *
+ * Backpressure: a file never has more than AOF_QUEUE_DEPTH blocks queued
+ * or being written, the caller waits on 'done' before queueing another one.
+ * So a file has at most AOF_QUEUE_DEPTH + 1 buffers. Errors: the writer keeps the errno of the first failed
+ * write in aof->err and drops the blocks queued after it, the caller gets
+ * AOF_ERR from the next hand over, save_aof or close_aof.
+ *
+ * Without writers or with them, the first failed write of a file is reported
+ * once and sets aof->failed: later adds to the file are dropped and return
+ * AOF_ERR without a word, so a full disk doesn't print a line per key, and
+ * close_aof returns AOF_ERR.
+ */
+struct AofWriter{
+   pthread_mutex_t lock; // protects the queue fields of every Aof of the set.
+   pthread_cond_t work; // a file was made ready, or stop was set.
+   pthread_cond_t done; // a writer gave blocks back.
+   Aof *ready_head, *ready_tail;
+   int stop;
+   int nthreads;
+   pthread_t *threads;
+};
+
+// writev until every byte of iov is out, retrying short writes and EINTR.
+static int aof_writev(int fd, struct iovec *iov, int iovcnt){
+   ssize_t nwritten;
+
+   while(iovcnt > 0){
+       if(iov->iov_len == 0){
+           iov++;
+           iovcnt--;
+           continue;
+       }
+       nwritten = writev(fd, iov, iovcnt);
+       if(nwritten == -1 && errno == EINTR)
+           continue;
+       if(nwritten <= 0)
+           return AOF_ERR;
+       while(iovcnt > 0 && (size_t)nwritten >= iov->iov_len){
+           nwritten -= iov->iov_len;
+           iov++;
+           iovcnt--;
+       }
+       if(iovcnt > 0){
+           iov->iov_base = (char *)iov->iov_base + nwritten;
+           iov->iov_len -= nwritten;
+       }
+   }
+   return AOF_OK;
+}
 
-int init_aof(Aof * aof_obj, int index, char *filename){
+int init_aof(Aof * aof_obj, int index, char *filename, size_t buffer_size){
+   memset(aof_obj, 0, sizeof(*aof_obj));
    aof_obj->index = index;
-   aof_obj->filename = (char *)strdup(filename);
-   if(!filename)
-       goto err;
-   if((aof_obj->fp = fopen(aof_obj->filename, "ab+")) == NULL)
+   aof_obj->fd = -1;
+   aof_obj->db = -1;
+   aof_obj->size = buffer_size ? buffer_size : AOF_BUFFER_SIZE;
+   if(!filename || (aof_obj->filename = strdup(filename)) == NULL)
        goto err;
-   if((aof_obj->buffer = sdsnewlen(NULL, AOF_BUFFER_SIZE)) == NULL)
+   if((aof_obj->fd = open(aof_obj->filename, O_WRONLY|O_CREAT|O_APPEND, 0644)) == -1)
        goto err;
+   aof_obj->buffer = zmalloc(aof_obj->size);
    return AOF_OK;
 err:
-   free(aof_obj->filename);
-   fclose(aof_obj->fp);
-   sdsfree(aof_obj->buffer);
    fprintf(stderr, "init_aof filename: %s error: %s\n",
-           filename, strerror(errno));
+           filename ? filename : "(null)", strerror(errno));
+   free(aof_obj->filename);
+   aof_obj->filename = NULL;
+   return AOF_ERR;
+}
+
+static aofBlock *aof_block_new(size_t size){
+   aofBlock *block = zmalloc(sizeof(*block));
+   block->buf = zmalloc(size);
+   block->len = 0;
+   block->size = size;
+   block->next = NULL;
+   return block;
+}
+
+static void aof_block_free(aofBlock *block){
+   zfree(block->buf);
+   zfree(block);
+}
+
+// writer's error, reported once. Call with the writer lock held.
+static int aof_check_err(Aof * aof_obj){
+   if(!aof_obj->err)
+       return AOF_OK;
+   if(!aof_obj->err_reported){
+       aof_obj->err_reported = 1;
+       fprintf(stderr, "aof writer filename: %s error: %s\n",
+               aof_obj->filename, strerror(aof_obj->err));
+   }
    return AOF_ERR;
 }
 
+// call with the writer lock held.
+static void aof_enqueue(Aof * aof_obj, aofBlock *block){
+   AofWriter *w = aof_obj->writer;
+
+   if(aof_obj->inflight >= AOF_QUEUE_DEPTH){
+       aof_obj->stats.waits++;
+       do{
+           pthread_cond_wait(&w->done, &w->lock);
+       }while(aof_obj->inflight >= AOF_QUEUE_DEPTH);
+   }
+   aof_obj->inflight++;
+   if(aof_obj->tail)
+       aof_obj->tail->next = block;
+   else
+       aof_obj->head = block;
+   aof_obj->tail = block;
+   aof_obj->queued++;
+   aof_obj->stats.blocks++;
+   aof_obj->stats.depth_sum += aof_obj->queued;
+   if(aof_obj->queued > aof_obj->stats.max_depth)
+       aof_obj->stats.max_depth = aof_obj->queued;
+   if(!aof_obj->busy && !aof_obj->ready){
+       aof_obj->ready = 1;
+       aof_obj->next_ready = NULL;
+       if(w->ready_tail)
+           w->ready_tail->next_ready = aof_obj;
+       else
+           w->ready_head = aof_obj;
+       w->ready_tail = aof_obj;
+       pthread_cond_signal(&w->work);
+   }
+}
+
+/*
+ * Queue the filled buffer, and 'big' after it if not NULL, then make
+ * aof->buffer a free block.
+ */
+static int aof_hand_over(Aof * aof_obj, aofBlock *big){
+   AofWriter *w = aof_obj->writer;
+   aofBlock *block = aof_obj->block;
+   int ret;
+
+   pthread_mutex_lock(&w->lock);
+   if(aof_obj->len > 0){
+       block->len = aof_obj->len;
+       aof_enqueue(aof_obj, block);
+       block = NULL;
+   }
+   if(big)
+       aof_enqueue(aof_obj, big);
+   if(!block){
+       if((block = aof_obj->free) != NULL)
+           aof_obj->free = block->next;
+       else
+           block = aof_block_new(aof_obj->size);
+       block->len = 0;
+       block->next = NULL;
+   }
+   ret = aof_check_err(aof_obj);
+   pthread_mutex_unlock(&w->lock);
+
+   aof_obj->block = block;
+   aof_obj->buffer = block->buf;
+   aof_obj->len = 0;
+   return ret;
+}
+
+// wait until the writers are done with the file. Call with the lock held.
+static void aof_drain(Aof * aof_obj){
+   while(aof_obj->inflight > 0)
+       pthread_cond_wait(&aof_obj->writer->done, &aof_obj->writer->lock);
+}
+
+static void *aof_writer_main(void *arg){
+   AofWriter *w = arg;
+   struct iovec iov[AOF_IOV];
+   aofBlock *head, *block, *next;
+   Aof *aof_obj;
+   long long bytes;
+   int n, err;
+
+   pthread_mutex_lock(&w->lock);
+   while(1){
+       while(!w->ready_head && !w->stop)
+           pthread_cond_wait(&w->work, &w->lock);
+       if(!w->ready_head)
+           break;
+       aof_obj = w->ready_head;
+       if((w->ready_head = aof_obj->next_ready) == NULL)
+           w->ready_tail = NULL;
+       aof_obj->ready = 0;
+       aof_obj->busy = 1;
+       head = aof_obj->head;
+       aof_obj->head = aof_obj->tail = NULL;
+       aof_obj->queued = 0;
+       err = aof_obj->err;
+       pthread_mutex_unlock(&w->lock);
+
+       // write the blocks AOF_IOV at a time, unless a write already failed.
+       bytes = 0;
+       for(block = head; block && !err; ){
+           for(n = 0; block && n < AOF_IOV; block = block->next, n++){
+               iov[n].iov_base = block->buf;
+               iov[n].iov_len = block->len;
+               bytes += block->len;
+           }
+           if(aof_writev(aof_obj->fd, iov, n) == AOF_ERR)
+               err = errno ? errno : EIO;
+       }
+
+       pthread_mutex_lock(&w->lock);
+       if(!aof_obj->err)
+           aof_obj->err = err;
+       if(!err)
+           aof_obj->stats.bytes += bytes;
+       for(block = head; block; block = next){
+           next = block->next;
+           aof_obj->inflight--;
+           if(block->size != aof_obj->size){
+               aof_block_free(block);
+           }
+           else{
+               block->next = aof_obj->free;
+               aof_obj->free = block;
+           }
+       }
+       aof_obj->busy = 0;
+       // blocks queued while this one wrote, make the file ready again.
+       if(aof_obj->head){
+           aof_obj->ready = 1;
+           aof_obj->next_ready = NULL;
+           if(w->ready_tail)
+               w->ready_tail->next_ready = aof_obj;
+           else
+               w->ready_head = aof_obj;
+           w->ready_tail = aof_obj;
+       }
+       pthread_cond_broadcast(&w->done);
+   }
+   pthread_mutex_unlock(&w->lock);
+   return NULL;
+}
+
+static AofWriter *aof_writer_start(int nthreads){
+   AofWriter *w = zcalloc(sizeof(*w));
+   int i, err = 0;
+
+   pthread_mutex_init(&w->lock, NULL);
+   pthread_cond_init(&w->work, NULL);
+   pthread_cond_init(&w->done, NULL);
+   w->threads = zmalloc(sizeof(pthread_t) * nthreads);
+   for(i = 0; i < nthreads; i++){
+       if((err = pthread_create(w->threads + i, NULL, aof_writer_main, w)) != 0)
+           break;
+       w->nthreads++;
+   }
+   if(w->nthreads == 0){
+       fprintf(stderr, "aof writer pthread_create error: %s\n", strerror(err));
+       zfree(w->threads);
+       zfree(w);
+       return NULL;
+   }
+   return w;
+}
+
+static void aof_writer_stop(AofWriter *w){
+   int i;
+
+   pthread_mutex_lock(&w->lock);
+   w->stop = 1;
+   pthread_cond_broadcast(&w->work);
+   pthread_mutex_unlock(&w->lock);
+   for(i = 0; i < w->nthreads; i++)
+       pthread_join(w->threads[i], NULL);
+   pthread_mutex_destroy(&w->lock);
+   pthread_cond_destroy(&w->work);
+   pthread_cond_destroy(&w->done);
+   zfree(w->threads);
+   zfree(w);
+}
+
 int save_aof(Aof * aof_obj){
-   if(strlen(aof_obj->buffer) <= 0)
+   struct iovec iov;
+   int ret;
+
+   if(aof_obj->failed)
+       return AOF_ERR;
+   if(aof_obj->writer){
+       ret = aof_hand_over(aof_obj, NULL);
+       pthread_mutex_lock(&aof_obj->writer->lock);
+       aof_drain(aof_obj);
+       if(aof_check_err(aof_obj) == AOF_ERR)
+           ret = AOF_ERR;
+       pthread_mutex_unlock(&aof_obj->writer->lock);
+       if(ret == AOF_ERR)
+           aof_obj->failed = 1;
+       return ret;
+   }
+   if(aof_obj->len == 0)
        return AOF_OK;
-   if(fwrite(aof_obj->buffer, strlen(aof_obj->buffer), 1, aof_obj->fp) != 1)
+   iov.iov_base = aof_obj->buffer;
+   iov.iov_len = aof_obj->len;
+   // clear the buffer, whatever was not written can't be retried.
+   aof_obj->len = 0;
+   if(aof_writev(aof_obj->fd, &iov, 1) == AOF_ERR)
        goto err;
-   // clear the buffer
-   aof_obj->buffer[0] = '\0';
    return AOF_OK;
 err:
-   fprintf(stderr, "save_aof error: %s\n",strerror(errno));
+   fprintf(stderr, "save_aof filename: %s error: %s\n",
+           aof_obj->filename, strerror(errno));
+   aof_obj->failed = 1;
    return AOF_ERR;
 }
 
-int add_aof(Aof * aof_obj, char * item){
+int add_aof_len(Aof * aof_obj, const char * item, size_t len){
+   struct iovec iov[2];
+
    if(aof_obj->buffer == NULL || item == NULL){
        fprintf(stderr, "add_aof error\n");
        return AOF_ERR;
    }
-   // dump buffer to file if it's too large
-   if(strlen(aof_obj->buffer) + strlen(item) >= AOF_BUFFER_SIZE)
-       save_aof(aof_obj);
+   if(aof_obj->failed)
+       return AOF_ERR;
+   aof_obj->shard.bytes += len;
+   if(len <= aof_obj->size - aof_obj->len){
+       memcpy(aof_obj->buffer + aof_obj->len, item, len);
+       aof_obj->len += len;
+       return AOF_OK;
+   }
+
+   if(aof_obj->writer){
+       aofBlock *big = NULL;
+       if(len > aof_obj->size){
+           big = aof_block_new(len);
+           memcpy(big->buf, item, len);
+           big->len = len;
+           if(aof_hand_over(aof_obj, big) == AOF_ERR){
+               aof_obj->failed = 1;
+               return AOF_ERR;
+           }
+           return AOF_OK;
+       }
+       if(aof_hand_over(aof_obj, NULL) == AOF_ERR){
+           aof_obj->failed = 1;
+           return AOF_ERR;
+       }
+       memcpy(aof_obj->buffer, item, len);
+       aof_obj->len = len;
+       return AOF_OK;
+   }
 
-   strcat(aof_obj->buffer, item);
+   // buffer is full: write it and the item in one call.
+   iov[0].iov_base = aof_obj->buffer;
+   iov[0].iov_len = aof_obj->len;
+   iov[1].iov_base = (void *)item;
+   iov[1].iov_len = len;
+   aof_obj->len = 0;
+   if(aof_writev(aof_obj->fd, iov, 2) == AOF_ERR){
+       fprintf(stderr, "add_aof filename: %s error: %s\n",
+               aof_obj->filename, strerror(errno));
+       aof_obj->failed = 1;
+       return AOF_ERR;
+   }
    return AOF_OK;
 }
 
-Aof *set_aofs(int aof_number, char *aof_filename){
-   Aof * aof_set = (Aof *)malloc(sizeof(Aof) * aof_number);
-   if(aof_number <= 0 || !aof_filename || !aof_set){
+int add_aof(Aof * aof_obj, char * item){
+   if(item == NULL){
+       fprintf(stderr, "add_aof error\n");
+       return AOF_ERR;
+   }
+   return add_aof_len(aof_obj, item, strlen(item));
+}
+
+int close_aof(Aof * aof_obj, int save){
+   aofBlock *block;
+   int ret = AOF_OK;
+
+   if(save && save_aof(aof_obj) == AOF_ERR)
+       ret = AOF_ERR;
+   if(aof_obj->failed)
+       ret = AOF_ERR;
+   if(aof_obj->writer){
+       pthread_mutex_lock(&aof_obj->writer->lock);
+       aof_drain(aof_obj);
+       pthread_mutex_unlock(&aof_obj->writer->lock);
+       while((block = aof_obj->free) != NULL){
+           aof_obj->free = block->next;
+           aof_block_free(block);
+       }
+       if(aof_obj->block)
+           zfree(aof_obj->block);
+       aof_obj->block = NULL;
+   }
+   if(aof_obj->fd != -1 && close(aof_obj->fd) == -1){
+       fprintf(stderr, "close_aof filename: %s error: %s\n",
+               aof_obj->filename, strerror(errno));
+       ret = AOF_ERR;
+   }
+   zfree(aof_obj->buffer);
+   free(aof_obj->filename);
+   aof_obj->buffer = NULL;
+   aof_obj->filename = NULL;
+   aof_obj->fd = -1;
+   aof_obj->len = 0;
+   return ret;
+}
+
+// close the first aof_number objects of aof_set and free the set.
+int close_aofs(Aof * aof_set, int aof_number, int save, AofStats *stats){
+   AofWriter *w;
+   int i, ret = AOF_OK;
+
+   if(!aof_set)
+       return AOF_OK;
+   w = aof_set->writer;
+   for(i = 0; i < aof_number; i++){
+       if(close_aof(aof_set + i, save) == AOF_ERR)
+           ret = AOF_ERR;
+   }
+   if(stats)
+       aofs_stats(aof_set, aof_number, stats);
+   if(w)
+       aof_writer_stop(w);
+   free(aof_set);
+   return ret;
+}
+
+void aofs_stats(Aof * aof_set, int aof_number, AofStats *stats){
+   AofStats *s;
+   int i;
+
+   memset(stats, 0, sizeof(*stats));
+   if(aof_set && aof_set->writer)
+       pthread_mutex_lock(&aof_set->writer->lock);
+   for(i = 0; aof_set && i < aof_number; i++){
+       s = &(aof_set + i)->stats;
+       stats->blocks += s->blocks;
+       stats->bytes += s->bytes;
+       stats->depth_sum += s->depth_sum;
+       stats->waits += s->waits;
+       if(s->max_depth > stats->max_depth)
+           stats->max_depth = s->max_depth;
+   }
+   if(aof_set && aof_set->writer)
+       pthread_mutex_unlock(&aof_set->writer->lock);
+}
+
+AofShard *aofs_shards(Aof * aof_set, int aof_number){
+   AofShard *shards;
+   int i;
+
+   if(!aof_set || aof_number <= 0)
+       return NULL;
+   if((shards = (AofShard *)malloc(sizeof(AofShard) * aof_number)) == NULL)
+       return NULL;
+   for(i = 0; i < aof_number; i++)
+       shards[i] = (aof_set + i)->shard;
+   return shards;
+}
+
+Aof *set_aofs(int aof_number, char *aof_filename, size_t buffer_size, int writers){
+   if(aof_number <= 0 || !aof_filename){
        fprintf(stderr, "wrong aof_number or aof_filename\n");
        return NULL;
    }
+   Aof * aof_set = (Aof *)malloc(sizeof(Aof) * aof_number);
+   if(!aof_set){
+       fprintf(stderr, "set_aofs out of memory\n");
+       return NULL;
+   }
 
    char buf[1024];
    int i;
    for(i = 0; i < aof_number; i++){
-       sprintf(buf, "%s.%09d", aof_filename, i);
-       if(init_aof(aof_set + i, i, buf) == AOF_ERR){
+       snprintf(buf, sizeof(buf), "%s.%09d", aof_filename, i);
+       if(init_aof(aof_set + i, i, buf, buffer_size) == AOF_ERR){
+           close_aofs(aof_set, i, 0, NULL);
            return NULL;
        }
    }
+
+   if(writers <= 0)
+       writers = AOF_WRITERS;
+   if(writers > aof_number)
+       writers = aof_number;
+   AofWriter *w = aof_writer_start(writers);
+   if(!w){
+       close_aofs(aof_set, aof_number, 0, NULL);
+       return NULL;
+   }
+   for(i = 0; i < aof_number; i++){
+       Aof *aof_obj = aof_set + i;
+       aof_obj->writer = w;
+       // the buffer from init_aof becomes the first block.
+       aof_obj->block = zmalloc(sizeof(aofBlock));
+       aof_obj->block->buf = aof_obj->buffer;
+       aof_obj->block->len = 0;
+       aof_obj->block->size = aof_obj->size;
+       aof_obj->block->next = NULL;
+   }
    return aof_set;
 }
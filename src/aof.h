@@ -9,11 +9,22 @@
 * save_aof
 * Dump data in buffer to aof file.
 *
-* add_aof
-* Add data to buffer. If buffer is full, call save_aof.
+* add_aof, add_aof_len
+* Add data to buffer. If buffer is full, write it out together with the data.
+*
+* close_aof, close_aofs
+* Optionally save the buffer, then release one / all the Aof objects.
 *
 * set_aofs
 * Init all the Aof objects with global variables aof_number and aof_filename.
+* Their full buffers are queued to a pool of writer threads instead of being
+* written on the caller's thread, see AofWriter in aof.c.
+*
+* aofs_stats
+* Queue depth and backpressure stats of an Aof set.
+*
+* aofs_shards
+* Keys and bytes added to each Aof of a set, to check how even the split is.
 *
 * author: sunlei
 * 2014.08.26
@@ -28,14 +39,64 @@
 // return state
 #define AOF_ERR -1
 #define AOF_OK 1
+// default buffer size, used when 0 is passed to init_aof / set_aofs.
 #define AOF_BUFFER_SIZE 10240
+// default writer threads of a set, used when 0 is passed to set_aofs.
+#define AOF_WRITERS 4
+// buffers of an aof file of a set that may be queued or being written at
+// once. Past that the caller waits for a writer.
+#define AOF_QUEUE_DEPTH 4
+
+// a buffer of a writer queue.
+typedef struct aofBlock{
+   char *buf;
+   size_t len;
+   size_t size; // bigger than the Aof size for one item that didn't fit.
+   struct aofBlock *next;
+}aofBlock;
+
+// queue stats, per Aof and summed over a set by aofs_stats.
+typedef struct AofStats{
+   long long blocks; // buffers handed to the writers.
+   long long bytes; // bytes written.
+   long long depth_sum; // queue depth seen by each handed over buffer.
+   long long waits; // times the caller waited for a free buffer.
+   int max_depth; // deepest queue.
+}AofStats;
+
+// what went to one aof file. bytes is kept by add_aof_len, keys by the
+// callers, which know where a key ends.
+typedef struct AofShard{
+   long long keys;
+   long long bytes;
+}AofShard;
+
+typedef struct AofWriter AofWriter;
 
 // struct for each aof file.
 typedef struct Aof{
    int index; // aof file index.
    char *filename; // aof file name.
-   FILE *fp; // aof file pointer.
-   sds buffer; // buffer dumped every AOF_BUFFER_SIZE bytes.
+   int fd; // aof file descriptor, opened for append.
+   char *buffer; // pending bytes, not NUL terminated.
+   size_t len; // bytes used in buffer.
+   size_t size; // buffer capacity, written out before it would overflow.
+   long db; // db selected by the RESP commands written so far, -1 if none.
+   AofShard shard;
+   // writer queue, only used when writer is set (by set_aofs).
+   AofWriter *writer;
+   aofBlock *block; // block behind buffer.
+   aofBlock *head, *tail; // full blocks waiting for a writer.
+   aofBlock *free; // written blocks to reuse.
+   int queued; // blocks between head and tail.
+   int inflight; // blocks queued or being written.
+   int busy; // a writer is writing this file.
+   int ready; // on the writer's ready list.
+   int err; // errno of the first failed write, later blocks are dropped.
+   int err_reported;
+   int failed; // a write of this file failed, set and read by the adding thread.
+   struct Aof *next_ready;
+   AofStats stats;
 }Aof;
 
 /**
@@ -66,14 +127,57 @@ typedef sds format_kv_handler(int service_type, int value_type, void * key, int
  * aof file index.
  * @param filename
  * aof file name.
+ * @param buffer_size
+ * bytes buffered before a write, 0 for AOF_BUFFER_SIZE.
  * @return
  */
-int init_aof(Aof * aof_obj, int index, char *filename);
+int init_aof(Aof * aof_obj, int index, char *filename, size_t buffer_size);
 
+/**
+ * @brief save_aof
+ * Write the buffer out. For an Aof of a set this waits until the writers
+ * are done with the file, and reports their errors.
+ */
 int save_aof(Aof * aof_obj);
 
+/**
+ * @brief add_aof_len
+ * Append len bytes of item, which may contain NUL bytes. An item that does
+ * not fit is written with the buffer in a single writev, without copying.
+ * For an Aof of a set the buffer is queued instead, and the item copied to a
+ * buffer of its own if it's larger than the Aof size.
+ */
+int add_aof_len(Aof * aof_obj, const char * item, size_t len);
+
+// add_aof_len for a NUL terminated item.
 int add_aof(Aof * aof_obj, char * item);
 
-Aof *set_aofs(int aof_number, char *aof_filename);
+int close_aof(Aof * aof_obj, int save);
+
+/**
+ * @brief close_aofs
+ * close_aof every Aof of a set, stop its writers and free it.
+ * @param stats
+ * if not NULL, gets the stats of the set once everything is written.
+ */
+int close_aofs(Aof * aof_set, int aof_number, int save, AofStats *stats);
+
+/**
+ * @brief set_aofs
+ * @param buffer_size
+ * bytes buffered per aof file before a write, 0 for AOF_BUFFER_SIZE.
+ * @param writers
+ * writer threads shared by the set, 0 for AOF_WRITERS.
+ */
+Aof *set_aofs(int aof_number, char *aof_filename, size_t buffer_size, int writers);
+
+void aofs_stats(Aof * aof_set, int aof_number, AofStats *stats);
+
+/**
+ * @brief aofs_shards
+ * @return a malloc()ed copy of the AofShard of every Aof of the set, NULL if
+ * there is no set.
+ */
+AofShard *aofs_shards(Aof * aof_set, int aof_number);
 
 #endif
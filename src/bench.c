@@ -0,0 +1,206 @@
+/*
+ * bench, rdb-tool throughput on one rdb file, mode by mode (make bench).
+ *
+ * Every run of every mode is a forked child, so the peak RSS wait4()
+ * reports is that of the mode alone. A mode is one of:
+ *
+ *   null    rdbParserParse with a handler doing nothing, no aof output
+ *   view    rdbParserParseView, zero-copy
+ *   scan    rdbParserParseScan of key names and types
+ *   memory  rdbParserParseMemory
+ *   text    rdbParserParse writing a text aof file
+ *   resp    rdbParserParse writing a RESP aof file
+ *
+ * and reports keys, bytes of rdb, the best time of -r runs, MB/s and keys/s
+ * at that time, the peak RSS of the biggest run, and the zmalloc calls of
+ * a run. Results go to -o as tab separated lines after a header, the same
+ * columns in the same order from one build to the next so two result files
+ * can be diffed or pasted side by side.
+ */
+#include "main.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "rdb_parser.h"
+#include "format.h"
+
+#define BENCH_MODES 6
+#define BENCH_HEADER "mode\tkeys\tbytes\tseconds\tmb_per_s\tkeys_per_s\tpeak_rss_kb\tallocations\n"
+
+typedef struct {
+    int ok;
+    long long keys;
+    long long bytes;
+    double seconds;
+    size_t allocations;
+} benchResult;
+
+static const char *bench_modes[BENCH_MODES] = {"null", "view", "scan", "memory", "text", "resp"};
+
+void _parsePanic(char *msg, char *file, int line) {
+    fprintf(stderr, "rdb-bench: %s #%s:%d\n", msg, file, line);
+}
+
+static void *benchHandler(int type, void *key, void *val, unsigned int vlen, time_t expiretime) {
+    (void)type; (void)key; (void)val; (void)vlen; (void)expiretime;
+    return NULL;
+}
+
+static void *benchViewHandler(int type, rdbStr *key, rdbStr *val, unsigned int vlen, time_t expiretime) {
+    (void)type; (void)key; (void)val; (void)vlen; (void)expiretime;
+    return NULL;
+}
+
+static void *benchScanHandler(int type, rdbStr *key, time_t expiretime) {
+    (void)type; (void)key; (void)expiretime;
+    return NULL;
+}
+
+static void *benchMemoryHandler(rdbStr *key, rdbKeyMemory *mem) {
+    (void)key; (void)mem;
+    return NULL;
+}
+
+/* main.c's _format_kv for rdbparser, with the default layout and shard. */
+static sds benchFormat(int service_type, int value_type, void *key, int key_len, void *value,
+        int value_len, void *hashed_key, int aof_number) {
+    (void)service_type;
+    *(int *)hashed_key = shardByHash((char *)key, key_len, aof_number);
+    return fmtAppendPair(sdsempty(), &fmtText, value_type, (char *)key, key_len, value, value_len);
+}
+
+static double benchNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* One run of mode, in the child. */
+static benchResult benchRun(const char *filename, int mode, char *aof) {
+    rdbParser *p = rdbParserCreate((char *)filename);
+    const parserStats *stats;
+    benchResult r;
+    size_t allocations = zmalloc_allocations();
+    double start = benchNow();
+    int ret, t;
+
+    memset(&r, 0, sizeof(r));
+    switch (mode) {
+        case 0: ret = rdbParserParse(p, benchHandler, 1, aof, 0, benchFormat); break;
+        case 1: ret = rdbParserParseView(p, benchViewHandler); break;
+        case 2: ret = rdbParserParseScan(p, benchScanHandler, RDB_SCAN_KEYS); break;
+        case 3: ret = rdbParserParseMemory(p, benchMemoryHandler); break;
+        case 4: ret = rdbParserParse(p, benchHandler, 1, aof, 1, benchFormat); break;
+        default:
+            rdbParserSetAofFormat(p, RDB_AOF_RESP, 0);
+            ret = rdbParserParse(p, benchHandler, 1, aof, 1, benchFormat);
+            break;
+    }
+    r.seconds = benchNow() - start;
+    r.allocations = zmalloc_allocations() - allocations;
+    r.ok = ret == PARSE_OK;
+    stats = rdbParserGetStats(p);
+    r.bytes = stats->total_bytes;
+    for (t = 0; t < TOTAL_DATA_TYPES; t++) r.keys += stats->parse_num[t];
+    rdbParserFree(p);
+    return r;
+}
+
+/* Fork a run of mode, its result comes back through a pipe. */
+static int benchFork(const char *filename, int mode, char *aof, benchResult *r, long *rss) {
+    struct rusage usage;
+    int fds[2], status;
+    char name[1024];
+    pid_t pid;
+
+    if (pipe(fds) == -1 || (pid = fork()) == -1) {
+        fprintf(stderr, "fork err :%s\n", strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        benchResult child = benchRun(filename, mode, aof);
+        close(fds[0]);
+        if (write(fds[1], &child, sizeof(child)) != sizeof(child)) _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    memset(r, 0, sizeof(*r));
+    if (read(fds[0], r, sizeof(*r)) != sizeof(*r)) r->ok = 0;
+    close(fds[0]);
+    if (wait4(pid, &status, 0, &usage) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        r->ok = 0;
+    *rss = usage.ru_maxrss;
+    snprintf(name, sizeof(name), "%s.%09d", aof, 0);
+    unlink(name);
+    return r->ok ? 0 : -1;
+}
+
+static void benchUsage(void) {
+    fprintf(stderr, "Usage: rdb-bench -f rdb file [-r runs] [-m modes] [-o results] [-a aof name]\n"
+            "\t-r runs of each mode, the best time is kept.\n\t\t\tDefault: 3\n"
+            "\t-m modes, some of null,view,scan,memory,text,resp.\n\t\t\tDefault: all\n"
+            "\t-o results file, tab separated.\n\t\t\tDefault: bench.tsv\n"
+            "\t-a name of the aof file text and resp write, removed after each run.\n\t\t\tDefault: bench.aof\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char *filename = NULL, *results = "bench.tsv", *aof = "bench.aof", *modes = NULL, *tok;
+    int runs = 3, selected[BENCH_MODES], mode, run, ch, failed = 0;
+    benchResult best, r;
+    long rss, peak;
+    FILE *fp;
+
+    for (mode = 0; mode < BENCH_MODES; mode++) selected[mode] = 1;
+    while ((ch = getopt(argc, argv, "f:r:m:o:a:")) != -1) {
+        switch (ch) {
+            case 'f': filename = optarg; break;
+            case 'r': if ((runs = atoi(optarg)) < 1) benchUsage(); break;
+            case 'm': modes = optarg; break;
+            case 'o': results = optarg; break;
+            case 'a': aof = optarg; break;
+            default: benchUsage();
+        }
+    }
+    if (!filename) benchUsage();
+    if (modes) {
+        for (mode = 0; mode < BENCH_MODES; mode++) selected[mode] = 0;
+        for (tok = strtok(modes, ","); tok; tok = strtok(NULL, ",")) {
+            for (mode = 0; mode < BENCH_MODES && strcmp(tok, bench_modes[mode]) != 0; mode++);
+            if (mode == BENCH_MODES) benchUsage();
+            selected[mode] = 1;
+        }
+    }
+    if ((fp = fopen(results, "w")) == NULL) {
+        fprintf(stderr, "open %s err :%s\n", results, strerror(errno));
+        exit(1);
+    }
+    fputs(BENCH_HEADER, fp);
+    printf("%-8s %12s %14s %10s %10s %12s %12s %14s\n",
+            "mode", "keys", "bytes", "seconds", "MB/s", "keys/s", "peak RSS KB", "allocations");
+    for (mode = 0; mode < BENCH_MODES; mode++) {
+        if (!selected[mode]) continue;
+        peak = 0;
+        for (run = 0; run < runs; run++) {
+            if (benchFork(filename, mode, aof, &r, &rss) == -1) break;
+            if (run == 0 || r.seconds < best.seconds) best = r;
+            if (rss > peak) peak = rss;
+        }
+        if (run < runs) {
+            fprintf(stderr, "%s failed\n", bench_modes[mode]);
+            failed = 1;
+            continue;
+        }
+        fprintf(fp, "%s\t%lld\t%lld\t%.6f\t%.2f\t%.0f\t%ld\t%zu\n", bench_modes[mode],
+                best.keys, best.bytes, best.seconds, best.bytes / best.seconds / (1024 * 1024),
+                best.keys / best.seconds, peak, best.allocations);
+        printf("%-8s %12lld %14lld %10.4f %10.2f %12.0f %12ld %14zu\n", bench_modes[mode],
+                best.keys, best.bytes, best.seconds, best.bytes / best.seconds / (1024 * 1024),
+                best.keys / best.seconds, peak, best.allocations);
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "write %s err :%s\n", results, strerror(errno));
+        exit(1);
+    }
+    return failed;
+}
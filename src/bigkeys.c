@@ -0,0 +1,184 @@
+/*
+ * bigkeys, the N biggest keys of an rdb file, in one pass. See bigkeys.h.
+ */
+#include "bigkeys.h"
+
+typedef struct {
+    unsigned long long score;
+    sds key;
+} bigkeysEntry;
+
+/* min heap, entries[0] is the smallest of the top keys */
+typedef struct {
+    bigkeysEntry *entries;
+    unsigned int count;
+} bigkeysHeap;
+
+typedef struct {
+    unsigned long long keys;
+    unsigned long long totals[BIGKEYS_METRICS];
+    bigkeysHeap heaps[BIGKEYS_METRICS];
+} bigkeysType;
+
+typedef struct {
+    uint32_t dbid;
+    bigkeysType types[TOTAL_DATA_TYPES];
+} bigkeysDb;
+
+struct bigkeys {
+    unsigned int top;
+    bigkeysDb *dbs; /* in the order they were met */
+    int ndbs;
+    int last;       /* index of the db of the previous key */
+};
+
+static const char *bigkeysTypeNames[TOTAL_DATA_TYPES] = {"string", "list", "set", "zset", "hash"};
+static const char *bigkeysMetricNames[BIGKEYS_METRICS] = {"rdb bytes", "elements", "memory bytes"};
+
+bigkeys *bigkeysCreate(unsigned int top) {
+    bigkeys *bk = zcalloc(sizeof(*bk));
+
+    bk->top = top ? top : BIGKEYS_TOP;
+    return bk;
+}
+
+void bigkeysFree(bigkeys *bk) {
+    int i, t, m;
+    unsigned int j;
+
+    for (i = 0; i < bk->ndbs; i++) {
+        for (t = 0; t < TOTAL_DATA_TYPES; t++) {
+            for (m = 0; m < BIGKEYS_METRICS; m++) {
+                bigkeysHeap *h = &bk->dbs[i].types[t].heaps[m];
+                for (j = 0; j < h->count; j++) sdsfree(h->entries[j].key);
+                zfree(h->entries);
+            }
+        }
+    }
+    zfree(bk->dbs);
+    zfree(bk);
+}
+
+static bigkeysDb *bigkeysGetDb(bigkeys *bk, uint32_t dbid) {
+    int i;
+
+    /* keys come db by db */
+    if (bk->ndbs && bk->dbs[bk->last].dbid == dbid) return bk->dbs + bk->last;
+    for (i = 0; i < bk->ndbs; i++) {
+        if (bk->dbs[i].dbid == dbid) {
+            bk->last = i;
+            return bk->dbs + i;
+        }
+    }
+    bk->dbs = zrealloc(bk->dbs, (bk->ndbs + 1) * sizeof(bigkeysDb));
+    memset(bk->dbs + bk->ndbs, 0, sizeof(bigkeysDb));
+    bk->dbs[bk->ndbs].dbid = dbid;
+    bk->last = bk->ndbs++;
+    return bk->dbs + bk->last;
+}
+
+static void bigkeysSiftDown(bigkeysHeap *h, unsigned int i) {
+    bigkeysEntry e = h->entries[i];
+    unsigned int child;
+
+    while ((child = 2 * i + 1) < h->count) {
+        if (child + 1 < h->count && h->entries[child + 1].score < h->entries[child].score)
+            child++;
+        if (h->entries[child].score >= e.score) break;
+        h->entries[i] = h->entries[child];
+        i = child;
+    }
+    h->entries[i] = e;
+}
+
+static void bigkeysSiftUp(bigkeysHeap *h, unsigned int i) {
+    bigkeysEntry e = h->entries[i];
+    unsigned int parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (h->entries[parent].score <= e.score) break;
+        h->entries[i] = h->entries[parent];
+        i = parent;
+    }
+    h->entries[i] = e;
+}
+
+static void bigkeysPush(bigkeysHeap *h, unsigned int top, rdbStr *key, unsigned long long score) {
+    if (h->count < top) {
+        if (h->entries == NULL) h->entries = zmalloc(top * sizeof(bigkeysEntry));
+        h->entries[h->count].score = score;
+        h->entries[h->count].key = sdsnewlen(key->ptr, key->len);
+        bigkeysSiftUp(h, h->count++);
+        return;
+    }
+    /* most keys stop here, without a copy */
+    if (score <= h->entries[0].score) return;
+    sdsfree(h->entries[0].key);
+    h->entries[0].score = score;
+    h->entries[0].key = sdsnewlen(key->ptr, key->len);
+    bigkeysSiftDown(h, 0);
+}
+
+void bigkeysAdd(bigkeys *bk, rdbStr *key, rdbKeyMemory *mem) {
+    unsigned long long scores[BIGKEYS_METRICS];
+    bigkeysType *t;
+    int m;
+
+    if (mem->type < 0 || mem->type >= TOTAL_DATA_TYPES) return;
+    t = &bigkeysGetDb(bk, mem->dbid)->types[mem->type];
+    scores[BIGKEYS_SERIALIZED] = mem->serialized;
+    scores[BIGKEYS_ELEMENTS] = mem->elements;
+    scores[BIGKEYS_MEMORY] = mem->bytes;
+    t->keys++;
+    for (m = 0; m < BIGKEYS_METRICS; m++) {
+        t->totals[m] += scores[m];
+        bigkeysPush(&t->heaps[m], bk->top, key, scores[m]);
+    }
+}
+
+static int bigkeysCompareEntries(const void *a, const void *b) {
+    const bigkeysEntry *x = a, *y = b;
+
+    if (x->score == y->score) return 0;
+    return x->score < y->score ? 1 : -1;
+}
+
+static int bigkeysCompareDbs(const void *a, const void *b) {
+    const bigkeysDb *x = a, *y = b;
+
+    if (x->dbid == y->dbid) return 0;
+    return x->dbid < y->dbid ? -1 : 1;
+}
+
+void bigkeysPrint(bigkeys *bk, FILE *fp) {
+    bigkeysEntry *sorted = zmalloc(bk->top * sizeof(bigkeysEntry));
+    unsigned int j;
+    int i, t, m;
+
+    qsort(bk->dbs, bk->ndbs, sizeof(bigkeysDb), bigkeysCompareDbs);
+    bk->last = 0;
+    for (i = 0; i < bk->ndbs; i++) {
+        for (t = 0; t < TOTAL_DATA_TYPES; t++) {
+            bigkeysType *type = &bk->dbs[i].types[t];
+            if (!type->keys) continue;
+            fprintf(fp, "db %u %s: %llu keys, %llu rdb bytes, %llu elements, %llu memory bytes\n",
+                    bk->dbs[i].dbid, bigkeysTypeNames[t], type->keys,
+                    type->totals[BIGKEYS_SERIALIZED], type->totals[BIGKEYS_ELEMENTS],
+                    type->totals[BIGKEYS_MEMORY]);
+            for (m = 0; m < BIGKEYS_METRICS; m++) {
+                bigkeysHeap *h = &type->heaps[m];
+                /* sort a copy, the heaps can still take keys */
+                memcpy(sorted, h->entries, h->count * sizeof(bigkeysEntry));
+                qsort(sorted, h->count, sizeof(bigkeysEntry), bigkeysCompareEntries);
+                fprintf(fp, "  biggest by %s:\n", bigkeysMetricNames[m]);
+                for (j = 0; j < h->count; j++) {
+                    fprintf(fp, "    %2u. %llu \"", j + 1, sorted[j].score);
+                    fwrite(sorted[j].key, 1, sdslen(sorted[j].key), fp);
+                    fputs("\"\n", fp);
+                }
+            }
+        }
+    }
+    zfree(sorted);
+}
@@ -0,0 +1,34 @@
+/*
+ * bigkeys, the N biggest keys of an rdb file, in one pass.
+ *
+ * Keys are ranked three ways: by the bytes their value takes in the file,
+ * by their number of elements and by the memory redis would need for them
+ * (see memory.h), separately for every db and type. Each ranking is a min
+ * heap of N keys, so a key only has to beat the smallest of the N to get
+ * in and memory stays O(N) however many keys there are. Keys are copied
+ * when they get in, not before.
+ */
+#ifndef __BIGKEYS_H_
+#define __BIGKEYS_H_
+#include "rdb_parser.h"
+
+#define BIGKEYS_SERIALIZED 0 /* bytes in the rdb file */
+#define BIGKEYS_ELEMENTS 1   /* members or fields */
+#define BIGKEYS_MEMORY 2     /* estimated bytes in redis */
+#define BIGKEYS_METRICS 3
+
+/* default N */
+#define BIGKEYS_TOP 10
+
+typedef struct bigkeys bigkeys;
+
+bigkeys *bigkeysCreate(unsigned int top);
+void bigkeysFree(bigkeys *bk);
+
+/* Rank one key, as handed to a keyMemoryHandler. */
+void bigkeysAdd(bigkeys *bk, rdbStr *key, rdbKeyMemory *mem);
+
+/* Print the totals and rankings of every db and type, biggest first. */
+void bigkeysPrint(bigkeys *bk, FILE *fp);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef __CRC64_H
+#define __CRC64_H
+
+#include <stdint.h>
+
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
+uint64_t crc64_bytewise(uint64_t crc, const unsigned char *s, uint64_t l);
+const char *crc64_engine(void);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * format, the text layouts keys are written in. See format.h.
+ */
+#include "format.h"
+#include "util.h"
+
+const fmtLayout fmtText = {
+    "text",
+    {
+        /* head, open, item, sep, item_end, close */
+        {FMT_STR("STRING\t"), FMT_STR("\t   "), FMT_STR(""), FMT_STR(""), FMT_STR(""), FMT_STR("\n")},
+        {FMT_STR("LIST\t"), FMT_STR("\t["), FMT_STR(""), FMT_STR(""), FMT_STR(" "), FMT_STR("]\n")},
+        {FMT_STR("SET\t"), FMT_STR("\t["), FMT_STR(""), FMT_STR(""), FMT_STR(" "), FMT_STR("]\n")},
+        {FMT_STR("ZSET\t"), FMT_STR("\t"), FMT_STR("("), FMT_STR(", "), FMT_STR(")"), FMT_STR("\n")},
+        {FMT_STR("HASH\t"), FMT_STR("\t"), FMT_STR("("), FMT_STR(", "), FMT_STR(")"), FMT_STR("\n")}
+    },
+    0
+};
+
+const fmtLayout fmtLines = {
+    "lines",
+    {
+        {FMT_STR("string\t"), FMT_STR("\t"), FMT_STR(""), FMT_STR(""), FMT_STR("\n"), FMT_STR("")},
+        {FMT_STR("list\t"), FMT_STR("\t"), FMT_STR(""), FMT_STR(""), FMT_STR("\n"), FMT_STR("")},
+        {FMT_STR("set\t"), FMT_STR("\t"), FMT_STR(""), FMT_STR(""), FMT_STR("\n"), FMT_STR("")},
+        {FMT_STR("zset\t"), FMT_STR("\t"), FMT_STR(""), FMT_STR("\t"), FMT_STR("\n"), FMT_STR("")},
+        {FMT_STR("hash\t"), FMT_STR("\t"), FMT_STR(""), FMT_STR("\t"), FMT_STR("\n"), FMT_STR("")}
+    },
+    FMT_ITEM_LINES
+};
+
+static const fmtLayout *fmtLayouts[] = {&fmtText, &fmtLines, NULL};
+
+const fmtLayout *fmtLayoutByName(const char *name) {
+    int i;
+
+    for (i = 0; fmtLayouts[i]; i++) {
+        if (strcmp(fmtLayouts[i]->name, name) == 0) return fmtLayouts[i];
+    }
+    return NULL;
+}
+
+/* sds per item: zset members come with their score, hash fields with their
+ * value. */
+static inline unsigned int fmtWidth(int type) {
+    return (type == REDIS_ZSET || type == REDIS_HASH) ? 2 : 1;
+}
+
+static inline char *fmtWrite(char *p, const char *s, size_t len) {
+    memcpy(p, s, len);
+    return p + len;
+}
+
+size_t fmtPairLen(const fmtLayout *l, int type, size_t keylen, void *val, unsigned int vlen) {
+    sds *elems = type == REDIS_STRING ? (sds *)&val : val;
+    const fmtType *t;
+    size_t len, items, i;
+    unsigned int width;
+
+    if (type < REDIS_STRING || type > REDIS_HASH) return 0;
+    t = l->types + type;
+    width = fmtWidth(type);
+    items = type == REDIS_STRING ? 1 : vlen / width;
+    len = items * (t->item.len + t->item_end.len + (width == 2 ? t->sep.len : 0));
+    if (l->flags & FMT_ITEM_LINES)
+        len += items * (t->head.len + keylen + t->open.len);
+    else
+        len += t->head.len + keylen + t->open.len + t->close.len;
+    for (i = 0; i < items * width; i++) len += sdslen(elems[i]);
+    return len;
+}
+
+sds fmtAppendPair(sds s, const fmtLayout *l, int type, const char *key, size_t keylen,
+        void *val, unsigned int vlen) {
+    sds *elems = type == REDIS_STRING ? (sds *)&val : val;
+    size_t len = fmtPairLen(l, type, keylen, val, vlen), items, i, incr;
+    int lines = l->flags & FMT_ITEM_LINES;
+    const fmtType *t;
+    unsigned int width;
+    char *p;
+
+    if (len == 0) return s;
+    s = sdsMakeRoomFor(s, len);
+    p = s + sdslen(s);
+    t = l->types + type;
+    width = fmtWidth(type);
+    items = type == REDIS_STRING ? 1 : vlen / width;
+    if (!lines) {
+        p = fmtWrite(p, t->head.ptr, t->head.len);
+        p = fmtWrite(p, key, keylen);
+        p = fmtWrite(p, t->open.ptr, t->open.len);
+    }
+    for (i = 0; i < items * width; i += width) {
+        if (lines) {
+            p = fmtWrite(p, t->head.ptr, t->head.len);
+            p = fmtWrite(p, key, keylen);
+            p = fmtWrite(p, t->open.ptr, t->open.len);
+        }
+        p = fmtWrite(p, t->item.ptr, t->item.len);
+        p = fmtWrite(p, elems[i], sdslen(elems[i]));
+        if (width == 2) {
+            p = fmtWrite(p, t->sep.ptr, t->sep.len);
+            p = fmtWrite(p, elems[i+1], sdslen(elems[i+1]));
+        }
+        p = fmtWrite(p, t->item_end.ptr, t->item_end.len);
+    }
+    if (!lines) p = fmtWrite(p, t->close.ptr, t->close.len);
+    if ((size_t)(p - (s + sdslen(s))) != len) parsePanic("format length mismatch");
+    /* sdsIncrLen takes an int. */
+    while (len) {
+        incr = len > INT_MAX ? INT_MAX : len;
+        sdsIncrLen(s, incr);
+        len -= incr;
+    }
+    return s;
+}
+
+char *fmtCounter(const char *key, size_t keylen, long long value) {
+    unsigned long long v = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+    uint32_t digits = digits10(v);
+    char *buf = malloc(keylen + digits + 4), *p = buf;
+
+    if (!buf) return NULL;
+    p = fmtWrite(p, key, keylen);
+    *p++ = ':';
+    if (value < 0) *p++ = '-';
+    ull2digits(p, v, digits);
+    p += digits;
+    *p++ = '\n';
+    *p = '\0';
+    return buf;
+}
+
+#ifdef TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+/* main.c is not linked in. */
+void _parsePanic(char *msg, char *file, int line) {
+    fprintf(stderr, "!!! %s #%s:%d\n", msg, file, line);
+}
+
+/* The sdscatprintf formatter _format_kv used before, the reference. */
+static sds fmtTextPrintf(int type, char *key, void *value, int value_len) {
+    sds kv_pair = sdsempty();
+    sds *res = (sds *)value;
+    int i;
+
+    if (type == REDIS_STRING) {
+        kv_pair = sdscatprintf(kv_pair, "STRING\t%s\t   %s\n", key, (char *)value);
+    } else if (type == REDIS_SET || type == REDIS_LIST) {
+        kv_pair = sdscatprintf(kv_pair, "%s\t%s\t[", type == REDIS_SET ? "SET" : "LIST", key);
+        for (i = 0; i < value_len; i++) kv_pair = sdscatprintf(kv_pair, "%s ", res[i]);
+        kv_pair = sdscatprintf(kv_pair, "]\n");
+    } else {
+        kv_pair = sdscatprintf(kv_pair, "%s\t%s\t", type == REDIS_ZSET ? "ZSET" : "HASH", key);
+        for (i = 0; i < value_len; i += 2)
+            kv_pair = sdscatprintf(kv_pair, "(%s, %s)", res[i], res[i + 1]);
+        kv_pair = sdscatprintf(kv_pair, "\n");
+    }
+    return kv_pair;
+}
+
+static long long fmtUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+#define FMT_BENCH_KEYS 1000
+#define FMT_BENCH_ROUNDS 200
+
+/* Format FMT_BENCH_KEYS keys of every type, 'elems' sds each, with both
+ * paths, check they agree byte for byte and print the time per key. */
+static int fmtBench(unsigned int elems) {
+    sds keys[FMT_BENCH_KEYS], *vals[FMT_BENCH_KEYS];
+    long long start, old_us = 0, new_us = 0;
+    size_t bytes = 0;
+    unsigned int i, j, round;
+    int type, errors = 0;
+    sds a, b;
+
+    srand(elems);
+    for (i = 0; i < FMT_BENCH_KEYS; i++) {
+        keys[i] = sdscatprintf(sdsempty(), "user:%u:%d", i, rand());
+        vals[i] = zmalloc(elems * sizeof(sds));
+        for (j = 0; j < elems; j++) {
+            vals[i][j] = (rand() & 1) ? sdsfromlonglong(rand() - RAND_MAX / 2)
+                : sdscatprintf(sdsempty(), "value-%08x-%x", rand(), rand() & 0xfff);
+        }
+    }
+    for (type = REDIS_STRING; type <= REDIS_HASH; type++) {
+        for (i = 0; i < FMT_BENCH_KEYS; i++) {
+            void *val = type == REDIS_STRING ? (void *)vals[i][0] : (void *)vals[i];
+            a = fmtTextPrintf(type, keys[i], val, elems);
+            b = fmtAppendPair(sdsempty(), &fmtText, type, keys[i], sdslen(keys[i]), val, elems);
+            if (sdscmp(a, b) != 0) {
+                printf("mismatch: type=%d key=%s\n", type, keys[i]);
+                errors++;
+            }
+            bytes += sdslen(b) * FMT_BENCH_ROUNDS;
+            sdsfree(a);
+            sdsfree(b);
+        }
+        start = fmtUstime();
+        for (round = 0; round < FMT_BENCH_ROUNDS; round++) {
+            for (i = 0; i < FMT_BENCH_KEYS; i++) {
+                void *val = type == REDIS_STRING ? (void *)vals[i][0] : (void *)vals[i];
+                sdsfree(fmtTextPrintf(type, keys[i], val, elems));
+            }
+        }
+        old_us += fmtUstime() - start;
+        start = fmtUstime();
+        for (round = 0; round < FMT_BENCH_ROUNDS; round++) {
+            for (i = 0; i < FMT_BENCH_KEYS; i++) {
+                void *val = type == REDIS_STRING ? (void *)vals[i][0] : (void *)vals[i];
+                sdsfree(fmtAppendPair(sdsempty(), &fmtText, type, keys[i], sdslen(keys[i]), val, elems));
+            }
+        }
+        new_us += fmtUstime() - start;
+    }
+    printf("%3u elements: sdscatprintf %7.1f ns/key, fmtAppendPair %7.1f ns/key, %.1fx, %.1f MB/s\n",
+        elems,
+        old_us * 1000.0 / (FMT_BENCH_KEYS * FMT_BENCH_ROUNDS * 5),
+        new_us * 1000.0 / (FMT_BENCH_KEYS * FMT_BENCH_ROUNDS * 5),
+        new_us ? (double)old_us / new_us : 0,
+        new_us ? bytes / (double)new_us : 0);
+    for (i = 0; i < FMT_BENCH_KEYS; i++) {
+        for (j = 0; j < elems; j++) sdsfree(vals[i][j]);
+        zfree(vals[i]);
+        sdsfree(keys[i]);
+    }
+    return errors;
+}
+
+int main(void) {
+    unsigned int sizes[] = {2, 8, 32, 128};
+    unsigned int i;
+    int errors = 0;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) errors += fmtBench(sizes[i]);
+    printf("format bench: %s\n", errors ? "FAILED" : "ok");
+    return errors ? 1 : 0;
+}
+#endif
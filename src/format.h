@@ -0,0 +1,75 @@
+/*
+ * format, the text layouts keys are written in by format_kv_handler.
+ *
+ * A layout is a table of constant pieces per type: what goes before the key,
+ * between the key and the elements, around every element (or around and in
+ * the middle of every member/score or field/value pair) and at the end. A key
+ * is formatted in two passes: fmtPairLen() adds up the pieces and the element
+ * lengths, then fmtAppendPair() makes room once and copies everything with
+ * memcpy. Nothing goes through printf, and nothing is reallocated per
+ * element.
+ *
+ * Two layouts are provided:
+ *
+ * 1. fmtText, the historical one, one line per key:
+ *      STRING\tkey\t   value
+ *      LIST\tkey\t[a b c ]        (SET too)
+ *      ZSET\tkey\t(member, score)(member, score)
+ *      HASH\tkey\t(field, value)(field, value)
+ * 2. fmtLines, one line per element, easy to sort, grep or cut:
+ *      string\tkey\tvalue
+ *      list\tkey\ta               (set too)
+ *      zset\tkey\tmember\tscore
+ *      hash\tkey\tfield\tvalue
+ */
+#ifndef __FORMAT_H_
+#define __FORMAT_H_
+#include "main.h"
+
+typedef struct fmtStr {
+    const char *ptr;
+    size_t len;
+} fmtStr;
+
+#define FMT_STR(s) {s, sizeof(s) - 1}
+
+typedef struct fmtType {
+    fmtStr head;     /* before the key */
+    fmtStr open;     /* after the key */
+    fmtStr item;     /* before each element or pair */
+    fmtStr sep;      /* between the two halves of a pair */
+    fmtStr item_end; /* after each element or pair */
+    fmtStr close;    /* after the last one */
+} fmtType;
+
+/* head, key and open are repeated in front of every element instead of
+ * being written once. */
+#define FMT_ITEM_LINES (1<<0)
+
+typedef struct fmtLayout {
+    const char *name;
+    fmtType types[REDIS_HASH + 1];
+    int flags;
+} fmtLayout;
+
+extern const fmtLayout fmtText;
+extern const fmtLayout fmtLines;
+
+/* The layout called name, NULL if there is none. */
+const fmtLayout *fmtLayoutByName(const char *name);
+
+/* Bytes fmtAppendPair() adds for this key. */
+size_t fmtPairLen(const fmtLayout *l, int type, size_t keylen, void *val, unsigned int vlen);
+
+/*
+ * Append one key, as the parser hands it to keyValueHandler (val is an sds
+ * for STRING, an array of vlen sds otherwise, members and scores / fields
+ * and values alternating).
+ */
+sds fmtAppendPair(sds s, const fmtLayout *l, int type, const char *key, size_t keylen,
+        void *val, unsigned int vlen);
+
+/* "key:value\n", the rediscounter layout, in a malloc()ed string. */
+char *fmtCounter(const char *key, size_t keylen, long long value);
+
+#endif
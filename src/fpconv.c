@@ -0,0 +1,592 @@
+/*
+ * fpconv, double <-> string conversions for zset scores. See fpconv.h.
+ *
+ * fpconv_dtoa() is Ulf Adams' Ryu ("Ryu: fast float-to-string conversion",
+ * PLDI 2018), with the full tables. fpconv_strtod() is the Eisel-Lemire
+ * algorithm as described in Daniel Lemire, "Number Parsing at a Gigabyte per
+ * Second" (2021), behind Clinger's fast path.
+ *
+ * fpconv_tables.h is generated, with Python:
+ *
+ *   for i in range(342):   # FPCONV_POW5_INV_SPLIT
+ *       p = 5**i; j = p.bit_length() - 1 + 125; v = (1 << j) // p + 1
+ *   for i in range(326):   # FPCONV_POW5_SPLIT
+ *       p = 5**i; j = p.bit_length() - 125; v = p >> j if j > 0 else p << -j
+ *   for q in range(-342, 309):   # FPCONV_POW5_128
+ *       if q < 0:
+ *           p = 5**-q; z = (p - 1).bit_length()
+ *           v = (1 << (z + 127 if q >= -27 else 2*z + 128)) // p + 1
+ *           while v >= 1 << 128: v //= 2
+ *       else:
+ *           v = 5**q
+ *           while v < 1 << 127: v *= 2
+ *           while v >= 1 << 128: v //= 2
+ */
+#include "fpconv.h"
+#include "util.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <float.h>
+#include "fpconv_tables.h"
+
+/* ------------------------------ 64 bit helpers ---------------------------- */
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 fpconv_uint128;
+
+/* Return the low 64 bits of a * b, set *hi to the high ones. */
+static inline uint64_t fpconvMul128(uint64_t a, uint64_t b, uint64_t *hi) {
+    fpconv_uint128 r = (fpconv_uint128)a * b;
+    *hi = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+}
+#else
+static inline uint64_t fpconvMul128(uint64_t a, uint64_t b, uint64_t *hi) {
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t b00 = a_lo * b_lo, b01 = a_lo * b_hi;
+    uint64_t b10 = a_hi * b_lo, b11 = a_hi * b_hi;
+    uint64_t mid1 = b10 + (b00 >> 32);
+    uint64_t mid2 = b01 + (uint32_t)mid1;
+
+    *hi = b11 + (mid1 >> 32) + (mid2 >> 32);
+    return (mid2 << 32) | (uint32_t)b00;
+}
+#endif
+
+static inline int fpconvClz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_clzll(v);
+#else
+    int n = 0;
+    while (!(v & ((uint64_t)1 << 63))) {
+        v <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* ---------------------------- double to string ---------------------------- */
+
+#define FPCONV_MANTISSA_BITS 52
+#define FPCONV_EXPONENT_BITS 11
+#define FPCONV_BIAS 1023
+
+/* floor(e * log10(2)), floor(e * log10(5)) and ceil(e * log2(5)) (1 for 0),
+ * exact for the range of exponents a double has. */
+static inline uint32_t fpconvLog10Pow2(int32_t e) {
+    return ((uint32_t)e * 78913) >> 18;
+}
+
+static inline uint32_t fpconvLog10Pow5(int32_t e) {
+    return ((uint32_t)e * 732923) >> 20;
+}
+
+static inline int32_t fpconvPow5Bits(int32_t e) {
+    return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+static inline uint32_t fpconvPow5Factor(uint64_t value) {
+    uint32_t count = 0;
+
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count;
+}
+
+static inline int fpconvMultipleOfPowerOf5(uint64_t value, uint32_t p) {
+    return fpconvPow5Factor(value) >= p;
+}
+
+static inline int fpconvMultipleOfPowerOf2(uint64_t value, uint32_t p) {
+    return (value & (((uint64_t)1 << p) - 1)) == 0;
+}
+
+/* (m * mul) >> j, mul being the 128 bit {low, high}, j >= 64. */
+static inline uint64_t fpconvMulShift64(uint64_t m, const uint64_t *mul, int32_t j) {
+    uint64_t high0, high1, low1, sum_lo, sum_hi;
+    int32_t dist = j - 64;
+
+    fpconvMul128(m, mul[0], &high0);
+    low1 = fpconvMul128(m, mul[1], &high1);
+    sum_lo = low1 + high0;
+    sum_hi = high1 + (sum_lo < high0);
+    if (dist == 0) return sum_lo;
+    return (sum_hi << (64 - dist)) | (sum_lo >> dist);
+}
+
+/* The shortest decimal in the rounding interval of a finite, non zero
+ * double: the value is mantissa * 10^exponent. */
+static void fpconvD2d(uint64_t ieee_mantissa, uint32_t ieee_exponent,
+        uint64_t *mantissa, int32_t *exponent) {
+    int32_t e2, e10;
+    uint64_t m2, mv, vr, vp, vm, output;
+    uint32_t mm_shift, q, removed = 0;
+    uint8_t last_removed_digit = 0;
+    int even, accept_bounds, vm_trailing_zeros = 0, vr_trailing_zeros = 0, round_up = 0;
+
+    if (ieee_exponent == 0) {
+        e2 = 1 - FPCONV_BIAS - FPCONV_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (int32_t)ieee_exponent - FPCONV_BIAS - FPCONV_MANTISSA_BITS - 2;
+        m2 = ((uint64_t)1 << FPCONV_MANTISSA_BITS) | ieee_mantissa;
+    }
+    even = (m2 & 1) == 0;
+    accept_bounds = even;
+
+    /* The interval of values rounding to this double is [mm, mp], scaled by
+     * 4 so its bounds are integers. */
+    mv = 4 * m2;
+    mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    /* Scale the interval to decimal, vr, vp and vm being mv, mp and mm times
+     * 10^-e10. */
+    if (e2 >= 0) {
+        int32_t k, i;
+
+        q = fpconvLog10Pow2(e2) - (e2 > 3);
+        e10 = (int32_t)q;
+        k = FPCONV_POW5_INV_BITCOUNT + fpconvPow5Bits((int32_t)q) - 1;
+        i = -e2 + (int32_t)q + k;
+        vr = fpconvMulShift64(4 * m2, FPCONV_POW5_INV_SPLIT[q], i);
+        vp = fpconvMulShift64(4 * m2 + 2, FPCONV_POW5_INV_SPLIT[q], i);
+        vm = fpconvMulShift64(4 * m2 - 1 - mm_shift, FPCONV_POW5_INV_SPLIT[q], i);
+        if (q <= 21) {
+            /* Only one of mp, mv and mm can be a multiple of 5, if any. */
+            if (mv % 5 == 0) {
+                vr_trailing_zeros = fpconvMultipleOfPowerOf5(mv, q);
+            } else if (accept_bounds) {
+                vm_trailing_zeros = fpconvMultipleOfPowerOf5(mv - 1 - mm_shift, q);
+            } else {
+                vp -= fpconvMultipleOfPowerOf5(mv + 2, q);
+            }
+        }
+    } else {
+        int32_t k, i, j;
+
+        q = fpconvLog10Pow5(-e2) - (-e2 > 1);
+        e10 = (int32_t)q + e2;
+        i = -e2 - (int32_t)q;
+        k = fpconvPow5Bits(i) - FPCONV_POW5_BITCOUNT;
+        j = (int32_t)q - k;
+        vr = fpconvMulShift64(4 * m2, FPCONV_POW5_SPLIT[i], j);
+        vp = fpconvMulShift64(4 * m2 + 2, FPCONV_POW5_SPLIT[i], j);
+        vm = fpconvMulShift64(4 * m2 - 1 - mm_shift, FPCONV_POW5_SPLIT[i], j);
+        if (q <= 1) {
+            /* mv = 4 * m2 has at least two trailing zero bits. */
+            vr_trailing_zeros = 1;
+            if (accept_bounds) {
+                vm_trailing_zeros = mm_shift == 1;
+            } else {
+                --vp;
+            }
+        } else if (q < 63) {
+            vr_trailing_zeros = fpconvMultipleOfPowerOf2(mv, q);
+        }
+    }
+
+    /* Drop digits while the interval still holds a shorter number. */
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed_digit == 0;
+            last_removed_digit = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed_digit == 0;
+                last_removed_digit = (uint8_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        /* Round half to even. */
+        if (vr_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0)
+            last_removed_digit = 4;
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+                last_removed_digit >= 5);
+    } else {
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+    *mantissa = output;
+    *exponent = e10 + (int32_t)removed;
+}
+
+int fpconv_dtoa(double value, char *buf) {
+    char digits[20];
+    uint64_t bits, ieee_mantissa, mantissa;
+    uint32_t ieee_exponent;
+    int32_t exponent, decpt, n, i;
+    char *p = buf;
+
+    memcpy(&bits, &value, sizeof(bits));
+    ieee_mantissa = bits & (((uint64_t)1 << FPCONV_MANTISSA_BITS) - 1);
+    ieee_exponent = (uint32_t)(bits >> FPCONV_MANTISSA_BITS) & ((1u << FPCONV_EXPONENT_BITS) - 1);
+    if (ieee_exponent == (1u << FPCONV_EXPONENT_BITS) - 1) {
+        if (ieee_mantissa) memcpy(buf, "nan", 4);
+        else memcpy(buf, bits >> 63 ? "-inf" : "inf", bits >> 63 ? 5 : 4);
+        return strlen(buf);
+    }
+    if (bits >> 63) *p++ = '-';
+    if (ieee_exponent == 0 && ieee_mantissa == 0) {
+        *p++ = '0';
+        *p = '\0';
+        return p - buf;
+    }
+
+    fpconvD2d(ieee_mantissa, ieee_exponent, &mantissa, &exponent);
+    while (mantissa % 10 == 0) {
+        mantissa /= 10;
+        exponent++;
+    }
+    n = digits10(mantissa);
+    ull2digits(digits, mantissa, n);
+    /* the decimal point goes after digit decpt */
+    decpt = n + exponent;
+
+    if (decpt > -4 && decpt <= 16) {
+        if (decpt <= 0) {
+            *p++ = '0';
+            *p++ = '.';
+            for (i = decpt; i < 0; i++) *p++ = '0';
+            memcpy(p, digits, n);
+            p += n;
+        } else if (decpt >= n) {
+            memcpy(p, digits, n);
+            p += n;
+            for (i = n; i < decpt; i++) *p++ = '0';
+        } else {
+            memcpy(p, digits, decpt);
+            p += decpt;
+            *p++ = '.';
+            memcpy(p, digits + decpt, n - decpt);
+            p += n - decpt;
+        }
+    } else {
+        *p++ = digits[0];
+        if (n > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, n - 1);
+            p += n - 1;
+        }
+        *p++ = 'e';
+        exponent = decpt - 1;
+        *p++ = exponent < 0 ? '-' : '+';
+        if (exponent < 0) exponent = -exponent;
+        if (exponent < 10) *p++ = '0';
+        i = digits10(exponent);
+        ull2digits(p, exponent, i);
+        p += i;
+    }
+    *p = '\0';
+    return p - buf;
+}
+
+/* ---------------------------- string to double ---------------------------- */
+
+static const double fpconvPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* w * 10^q rounded to nearest, w != 0, as the bits of a positive double.
+ * Return 0 if the result is subnormal or infinite, strtod() takes those. */
+static int fpconvEiselLemire(uint64_t w, int64_t q, uint64_t *bits) {
+    const uint64_t *pow5 = FPCONV_POW5_128[q - FPCONV_SMALLEST_POWER10];
+    uint64_t lo, hi, hi2, mantissa;
+    int lz = fpconvClz64(w), upperbit, shift;
+    int64_t power2;
+
+    w <<= lz;
+    lo = fpconvMul128(w, pow5[0], &hi);
+    /* The low 9 bits of hi only matter for rounding. If they are all ones
+     * the lower half of the power may carry into them. */
+    if ((hi & 0x1FF) == 0x1FF) {
+        fpconvMul128(w, pow5[1], &hi2);
+        lo += hi2;
+        if (hi2 > lo) hi++;
+        if ((hi & 0x1FF) == 0x1FF && lo == UINT64_MAX) return 0;
+    }
+    upperbit = (int)(hi >> 63);
+    shift = upperbit + 64 - FPCONV_MANTISSA_BITS - 3;
+    mantissa = hi >> shift;
+    power2 = ((((152170 + 65536) * q) >> 16) + 63) + upperbit - lz + FPCONV_BIAS;
+    if (power2 <= 0) return 0;
+
+    /* Exactly halfway between two doubles: round to even, not up. */
+    if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+            (mantissa << shift) == hi) {
+        mantissa &= ~(uint64_t)1;
+    }
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= ((uint64_t)2 << FPCONV_MANTISSA_BITS)) {
+        mantissa = (uint64_t)1 << FPCONV_MANTISSA_BITS;
+        power2++;
+    }
+    mantissa &= ~((uint64_t)1 << FPCONV_MANTISSA_BITS);
+    if (power2 >= (1 << FPCONV_EXPONENT_BITS) - 1) return 0;
+    *bits = mantissa | ((uint64_t)power2 << FPCONV_MANTISSA_BITS);
+    return 1;
+}
+
+static int fpconvStrtodSlow(const char *s, size_t len, double *value) {
+    char small[128], *buf = small, *eptr;
+    int ok;
+
+    if (len == 0) return 0;
+    if (len >= sizeof(small) && (buf = malloc(len + 1)) == NULL) return 0;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    *value = strtod(buf, &eptr);
+    ok = eptr == buf + len;
+    if (buf != small) free(buf);
+    return ok;
+}
+
+int fpconv_strtod(const char *s, size_t len, double *value) {
+    const char *p = s, *end = s + len;
+    uint64_t w = 0, bits;
+    int64_t exp10 = 0, e = 0;
+    int negative = 0, ndigits = 0, any = 0, eneg = 0;
+    double d;
+
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        any = 1;
+        if (w == 0 && *p == '0') continue;
+        if (++ndigits > 19) goto slow;
+        w = w * 10 + (*p - '0');
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            any = 1;
+            exp10--;
+            if (w == 0 && *p == '0') continue;
+            if (++ndigits > 19) goto slow;
+            w = w * 10 + (*p - '0');
+        }
+    }
+    if (!any) goto slow;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '-' || *p == '+')) eneg = *p++ == '-';
+        if (p == end || *p < '0' || *p > '9') goto slow;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (e < 100000) e = e * 10 + (*p - '0');
+        }
+        exp10 += eneg ? -e : e;
+    }
+    if (p != end) goto slow;
+
+    if (w == 0) {
+        *value = negative ? -0.0 : 0.0;
+        return 1;
+    }
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    /* w and 10^|exp10| are exact doubles, one correctly rounded operation
+     * gives the correctly rounded result. */
+    if (w <= ((uint64_t)1 << 53) && exp10 >= -22 && exp10 <= 22) {
+        d = (double)w;
+        d = exp10 < 0 ? d / fpconvPow10[-exp10] : d * fpconvPow10[exp10];
+        *value = negative ? -d : d;
+        return 1;
+    }
+#endif
+    if (exp10 < FPCONV_SMALLEST_POWER10 || exp10 > FPCONV_LARGEST_POWER10) goto slow;
+    if (!fpconvEiselLemire(w, exp10, &bits)) goto slow;
+    if (negative) bits |= (uint64_t)1 << 63;
+    memcpy(value, &bits, sizeof(bits));
+    return 1;
+
+slow:
+    return fpconvStrtodSlow(s, len, value);
+}
+
+#ifdef TEST_MAIN
+#include <stdio.h>
+#include <math.h>
+#include <sys/time.h>
+
+/* util.c pulls in ziplist.c, which wants it. */
+void _parsePanic(char *msg, char *file, int line) {
+    fprintf(stderr, "!!! %s #%s:%d\n", msg, file, line);
+}
+
+static long long fpconvUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint64_t fpconvRand64(void) {
+    static uint64_t x = 0x9E3779B97F4A7C15ULL;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+/* Doubles of every shape: any bit pattern, integers, short decimals, powers
+ * of two, and the neighbours of those. */
+static double fpconvRandDouble(int kind) {
+    uint64_t bits = fpconvRand64();
+    double d;
+
+    switch (kind % 5) {
+    case 0: memcpy(&d, &bits, sizeof(d)); break;
+    case 1: d = (double)(int64_t)(bits >> (bits % 64)); break;
+    case 2: d = (double)(bits % 100000000) / fpconvPow10[bits % 12]; break;
+    case 3: d = ldexp(1.0, (int)(bits % 2098) - 1074); break;
+    default:
+        d = (double)(bits % 1000) / 1000;
+        memcpy(&bits, &d, sizeof(d));
+        bits += fpconvRand64() % 3 - 1;
+        memcpy(&d, &bits, sizeof(d));
+    }
+    return d;
+}
+
+/* The fewest %.*g digits reading back as d. Rounding to nearest may miss a
+ * shorter string that is in the interval, so this is an upper bound. */
+static int fpconvShortestDigits(double d) {
+    char buf[64];
+    int prec;
+
+    for (prec = 1; prec < 17; prec++) {
+        snprintf(buf, sizeof(buf), "%.*g", prec, d);
+        if (strtod(buf, NULL) == d) break;
+    }
+    return prec;
+}
+
+static int fpconvDigits(const char *s) {
+    int n = 0, lead = 1;
+
+    for (; *s && *s != 'e'; s++) {
+        if (*s < '0' || *s > '9') continue;
+        if (lead && *s == '0') continue;
+        lead = 0;
+        n++;
+    }
+    /* trailing zeros of an integer are not significant */
+    while (n > 1 && s[-1] == '0' && !strchr(s - n, '.')) {
+        s--;
+        n--;
+    }
+    return n;
+}
+
+#define FPCONV_TEST_ROUNDS 2000000
+
+static int fpconvCheck(void) {
+    static const char *strs[] = {
+        "0", "-0", "1", "-1.5", "0.1", "3.14159", "1e23", "8.98846567431158e307",
+        "2.2250738585072014e-308", "4.9e-324", "1e-400", "1e400", "inf", "-inf",
+        "nan", "0x1p3", "123456789012345678901234567890", "9007199254740993",
+        "1.7976931348623157e308", "1.7976931348623159e308", ".5", "5.", "1e",
+        "", "-", "1.2.3", " 1", "1 ", "+7", "00012.50", "0.000000000000000000001"
+    };
+    char buf[FPCONV_DTOA_MAX], ref[64];
+    double d, back, a, b;
+    int i, len, errors = 0, ok_a, ok_b;
+    char *eptr;
+
+    for (i = 0; i < FPCONV_TEST_ROUNDS; i++) {
+        d = fpconvRandDouble(i);
+        if (isnan(d)) continue;
+        len = fpconv_dtoa(d, buf);
+        back = strtod(buf, NULL);
+        if ((size_t)len != strlen(buf) || memcmp(&back, &d, sizeof(d)) != 0 ||
+                (d != 0 && !isinf(d) && fpconvDigits(buf) > fpconvShortestDigits(d))) {
+            printf("dtoa %.17g -> %s\n", d, buf);
+            if (++errors > 10) return errors;
+        }
+        snprintf(ref, sizeof(ref), "%.*g", (int)(fpconvRand64() % 17) + 1, d);
+        ok_a = fpconv_strtod(ref, strlen(ref), &a);
+        b = strtod(ref, NULL);
+        if (!ok_a || memcmp(&a, &b, sizeof(a)) != 0) {
+            printf("strtod %s -> %.17g, expected %.17g\n", ref, a, b);
+            if (++errors > 10) return errors;
+        }
+    }
+    for (i = 0; i < (int)(sizeof(strs) / sizeof(strs[0])); i++) {
+        ok_a = fpconv_strtod(strs[i], strlen(strs[i]), &a);
+        b = strtod(strs[i], &eptr);
+        ok_b = *strs[i] && *eptr == '\0';
+        if (ok_a != ok_b || (ok_a && memcmp(&a, &b, sizeof(a)) != 0 && !(isnan(a) && isnan(b)))) {
+            printf("strtod \"%s\" -> %d %.17g, expected %d %.17g\n", strs[i], ok_a, a, ok_b, b);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+static void fpconvBench(void) {
+    static double vals[4096];
+    static char strs[4096][FPCONV_DTOA_MAX];
+    char buf[64];
+    long long start, us[4];
+    volatile double sum = 0;
+    double d;
+    int i, round;
+
+    for (i = 0; i < 4096; i++) {
+        vals[i] = fpconvRandDouble(i % 4 == 0 ? 2 : i);
+        if (isnan(vals[i]) || isinf(vals[i])) vals[i] = i;
+        fpconv_dtoa(vals[i], strs[i]);
+    }
+    start = fpconvUstime();
+    for (round = 0; round < 500; round++)
+        for (i = 0; i < 4096; i++) sum += snprintf(buf, sizeof(buf), "%.17g", vals[i]);
+    us[0] = fpconvUstime() - start;
+    start = fpconvUstime();
+    for (round = 0; round < 500; round++)
+        for (i = 0; i < 4096; i++) sum += fpconv_dtoa(vals[i], buf);
+    us[1] = fpconvUstime() - start;
+    start = fpconvUstime();
+    for (round = 0; round < 500; round++)
+        for (i = 0; i < 4096; i++) sum += strtod(strs[i], NULL);
+    us[2] = fpconvUstime() - start;
+    start = fpconvUstime();
+    for (round = 0; round < 500; round++) {
+        for (i = 0; i < 4096; i++) {
+            fpconv_strtod(strs[i], strlen(strs[i]), &d);
+            sum += d;
+        }
+    }
+    us[3] = fpconvUstime() - start;
+    printf("dtoa:   snprintf %%.17g %6.1f ns, fpconv_dtoa   %6.1f ns\n",
+        us[0] * 1000.0 / (500 * 4096), us[1] * 1000.0 / (500 * 4096));
+    printf("strtod: strtod        %6.1f ns, fpconv_strtod %6.1f ns\n",
+        us[2] * 1000.0 / (500 * 4096), us[3] * 1000.0 / (500 * 4096));
+}
+
+int main(void) {
+    int errors = fpconvCheck();
+
+    fpconvBench();
+    printf("fpconv test: %s\n", errors ? "FAILED" : "ok");
+    return errors ? 1 : 0;
+}
+#endif
@@ -0,0 +1,35 @@
+/*
+ * fpconv, double <-> string conversions for zset scores.
+ *
+ * fpconv_dtoa() writes the shortest string that reads back as the same
+ * double (Ryu), so scores neither lose precision like "%f" did nor carry the
+ * noise digits of "%.17g". Fixed notation is used for decimal exponents from
+ * -4 to 16 ("0.0001", "1234.5", "3"), scientific notation otherwise
+ * ("1e-05", "1.5e+20"), the same choice Python's repr() makes except that
+ * integral values get no ".0". Infinities and NaN are "inf", "-inf" and
+ * "nan". redis takes the infinities back as scores but ZADD rejects "nan";
+ * redis never saves a NaN score, only a damaged rdb file can hold one.
+ *
+ * fpconv_strtod() is an exact string to double conversion: small inputs are
+ * done with one exact floating point operation (Clinger's fast path), the
+ * rest with a 128 bit multiplication by a power of five (Eisel-Lemire). The
+ * few inputs neither can settle (more than 19 significant digits, "inf",
+ * hex, ...) go to strtod().
+ */
+#ifndef __FPCONV_H_
+#define __FPCONV_H_
+#include <stddef.h>
+
+/* Longest fpconv_dtoa() output, the null term included. */
+#define FPCONV_DTOA_MAX 32
+
+/* Write value to buf (FPCONV_DTOA_MAX bytes), null terminated, return the
+ * length. */
+int fpconv_dtoa(double value, char *buf);
+
+/* Convert the len bytes at s, return 1 and set *value if they are a number
+ * as a whole, 0 otherwise. Like strtod(), out of range values become zero or
+ * infinity. */
+int fpconv_strtod(const char *s, size_t len, double *value);
+
+#endif
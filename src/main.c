@@ -7,6 +7,27 @@
 #include "aof.h"
 #include "rdb_parser.h"
 #include "rediscounter.h"
+#include "format.h"
+#include "shard.h"
+#include "memory.h"
+#include "bigkeys.h"
+#include "prefix.h"
+#include "sketch.h"
+#include "progress.h"
+
+// text layout of _format_kv, set with -F.
+static const fmtLayout *kv_layout = &fmtText;
+// aof file of a key, set with -H.
+static shardFunc *kv_shard = shardByHash;
+// memory service report, and the line being written.
+static FILE *mem_report;
+static sds mem_line;
+// bigkeys service rankings.
+static bigkeys *big_keys;
+// prefix service trie.
+static prefixTrie *prefix_trie;
+// sketch service sketches.
+static sketch *key_sketch;
 
 void _parsePanic(char *msg, char *file, int line) {
     fprintf(stderr,"!!! Software Failure. Press left mouse button to continue");
@@ -35,57 +56,17 @@ void _parsePanic(char *msg, char *file, int line) {
  * @return Formatted string of k&v
  */
 sds _format_kv(int service_type, int value_type, void * key, int key_len, void * value, int value_len, void *hashed_key, int aof_number){
-    int i;
     if(key_len <= 0)
         return NULL;
-    *(int *)hashed_key = (((char *)key)[0] - '0') % aof_number;
+    *(int *)hashed_key = kv_shard((char *)key, key_len, aof_number);
 
-    sds kv_pair = sdsempty();
     // for rediscounter
-    if(service_type == REDIS_COUNTER){
-        // faster without sdscatprintf.
-        char tmp[1024];
-        sprintf(tmp, "%s:%ld\n", (char *)key, (long)value);
-        return (char *)strdup(tmp);
-    }
-    // for rdb-parser
-    else if(service_type == RDB_PARSER){
-        if(value_type == REDIS_STRING)
-            kv_pair = sdscatprintf(kv_pair, "STRING\t%s\t   %s\n", (char *)key, (char *)value);
-        else if(value_type == REDIS_SET){
-            kv_pair = sdscatprintf(kv_pair, "SET\t%s\t[", (char *)key);
-            sds *res = (sds *)value;
-            for(i = 0; i < value_len; i++){
-                kv_pair = sdscatprintf(kv_pair, "%s ", res[i]);
-            }
-            kv_pair = sdscatprintf(kv_pair, "]\n");
-        }
-        else if(value_type == REDIS_LIST){
-            kv_pair = sdscatprintf(kv_pair, "LIST\t%s\t[", (char *)key);
-            sds *res = (sds *)value;
-            for(i = 0; i < value_len; i++){
-                kv_pair = sdscatprintf(kv_pair, "%s ", res[i]);
-            }
-            kv_pair = sdscatprintf(kv_pair, "]\n");
-        }
-        else if(value_type == REDIS_ZSET) {
-            kv_pair = sdscatprintf(kv_pair, "ZSET\t%s\t", (char *)key);
-            sds *res = (sds *)value;
-            for(i = 0; i < value_len; i += 2) {
-                kv_pair = sdscatprintf(kv_pair,"(%s, %s)", res[i], res[i + 1]);
-            }
-            kv_pair = sdscatprintf(kv_pair, "\n");
-        }
-        else if(value_type == REDIS_HASH) {
-                sds *res = (sds *)value;
-                kv_pair = sdscatprintf(kv_pair,"HASH\t%s\t",(char *)key);
-                for(i = 0; i < value_len; i += 2) {
-                    kv_pair = sdscatprintf(kv_pair,"(%s, %s)", res[i], res[i + 1]);
-                }
-                kv_pair = sdscatprintf(kv_pair, "\n");
-            }
-        return kv_pair;
-    }
+    if(service_type == REDIS_COUNTER)
+        return fmtCounter((char *)key, key_len, (long)value);
+    // for rdb-parser, in the layout picked with -F.
+    else if(service_type == RDB_PARSER)
+        return fmtAppendPair(sdsempty(), kv_layout, value_type, (char *)key, key_len, value, value_len);
+    return NULL;
 }
 
 // rdb-parser user handler.
@@ -130,15 +111,121 @@ void* userHandler (int type, void *key, void *val, unsigned int vlen, time_t exp
 #endif
 }
 
+// rdb-parser user handler for zero-copy mode, views are only valid in here.
+void* userViewHandler (int type, rdbStr *key, rdbStr *val, unsigned int vlen, time_t expiretime) {
+#if 0
+    unsigned int i;
+    printf("%d\t%d\t%.*s\t[", type, (int)expiretime, (int)key->len, key->ptr);
+    for(i = 0; i < vlen; i++) {
+        if(val[i].ptr) printf("%.*s, ", (int)val[i].len, val[i].ptr);
+        else printf("%.17g, ", val[i].num);
+    }
+    printf("]\n");
+#endif
+    (void) type; (void) key; (void) val; (void) vlen; (void) expiretime;
+    return NULL;
+}
+
+// rdb-parser user handler for scan mode, key is NULL when only types are scanned.
+void* userScanHandler (int type, rdbStr *key, time_t expiretime) {
+#if 0
+    if(key)
+        printf("%d\t%d\t%.*s\n", type, (int)expiretime, (int)key->len, key->ptr);
+    else
+        printf("%d\t%d\n", type, (int)expiretime);
+#endif
+    (void) type; (void) key; (void) expiretime;
+    return NULL;
+}
+
+// rdb-parser user handlers for streaming mode, elements come in batches.
+void* userBeginHandler (int type, sds key, unsigned long len, time_t expiretime, void *privdata) {
+#if 0
+    printf("%d\t%d\t%s\t%lu\t[", type, (int)expiretime, key, len);
+#endif
+    (void) type; (void) key; (void) len; (void) expiretime; (void) privdata;
+    return NULL;
+}
+
+void* userElementsHandler (int type, sds *elems, unsigned int count, void *privdata) {
+#if 0
+    unsigned int i;
+    for(i = 0; i < count; i++) {
+        printf("%s, ", elems[i]);
+    }
+#endif
+    (void) type; (void) elems; (void) count; (void) privdata;
+    return NULL;
+}
+
+void* userEndHandler (int type, sds key, void *privdata) {
+#if 0
+    printf("]\n");
+#endif
+    (void) type; (void) key; (void) privdata;
+    return NULL;
+}
+
+// memory service handler, a csv line per key.
+void* memoryHandler (rdbStr *key, rdbKeyMemory *mem) {
+    sdsclear(mem_line);
+    mem_line = memCsvRow(mem_line, key, mem);
+    fwrite(mem_line, 1, sdslen(mem_line), mem_report);
+    return NULL;
+}
+
+// bigkeys service handler.
+void* bigkeysHandler (rdbStr *key, rdbKeyMemory *mem) {
+    bigkeysAdd(big_keys, key, mem);
+    return NULL;
+}
+
+// prefix service handler.
+void* prefixHandler (rdbStr *key, rdbKeyMemory *mem) {
+    prefixAdd(prefix_trie, key, mem);
+    return NULL;
+}
+
+// sketch service handler.
+void* sketchHandler (rdbStr *key, rdbKeyMemory *mem) {
+    sketchAdd(key_sketch, key, mem);
+    return NULL;
+}
 
 int main(int argc, char **argv) {
     //rdbParse("/home/simon/rdbtools/src/r7462.rdb", userHandler, 1, "output.aof", 1, _format_kv);
-    char *usage = "Usage:\nrdb_tools -[t service name] -[f rdb file path] [-d] [-n number] [-o file name] [-s]"
-            "\nService name: rdbparser or rediscounter\n"
-            "\t-d --dump \t[rdbparser]parser info, to dump parser stats info.\n\t\t\tDefault: no\n"
+    char *usage = "Usage:\nrdb_tools -[t service name] -[f rdb file path] [-d] [-n number] [-o file name] [-s] [-b bytes] [-w writers] [-F text|lines|resp] [-c count] [-H slot|hash|jump|crc64] [-K top] [-S delimiter] [-M megabytes] [-R time] [-z] [-N] [-j threads] [-u] [-e batch] [-k keys|types]"
+            " [-J file] [-P seconds] [-X file] [-m pattern] [-p prefix] [-T types] [-D dbs] [-E min:max] [sketch files]"
+            "\nService name: rdbparser, rediscounter, memory, bigkeys, prefix or sketch\n"
+            "\t-d --dump \t[rdbparser]parser info, to dump parser stats info, with the time of each phase.\n\t\t\tDefault: no\n"
+            "\t-J --json \t[rdbparser]write the parser stats, with the time of each phase, as JSON to this file.\n\t\t\tDefault: no\n"
+            "\t-P --progress \tprint bytes/s, keys/s, ETA and RSS to stderr every this many seconds.\n\t\t\tDefault: no\n"
+            "\t-X --metrics \trewrite this Prometheus textfile collector file with the progress, every -P seconds.\n\t\t\tDefault: no, every 10 seconds with -X alone\n"
             "\t-n --number \tspecify number of aof files.\n\t\t\tDefault: 1\n"
-            "\t-o --name \tspecify name of aof files. \n\t\t\tDefault: output.aof\n"
+            "\t-o --name \tspecify name of aof files, of the memory or prefix report, or of the sketch file. \n\t\t\tDefault: output.aof, memory.csv, prefix.csv, rdb.sketch\n"
             "\t-s --save \tSave mode, save aof file. \n\t\t\tDefault: no\n"
+            "\t-b --buffer \tbytes buffered per aof file before a write.\n\t\t\tDefault: 10240\n"
+            "\t-F --format \t[rdbparser]aof format, text, lines (a line per element) or resp (redis commands, for redis-cli --pipe).\n\t\t\tDefault: text\n"
+            "\t-c --count \t[rdbparser]with -F resp, most elements per RPUSH/SADD/ZADD/HMSET.\n\t\t\tDefault: 64\n"
+            "\t-H --shard \thow keys are split over the aof files: slot (Redis Cluster hash slot ranges), hash, jump (jump consistent hash) or crc64.\n\t\t\tDefault: hash\n"
+            "\t-K --top \t[bigkeys]keys listed per db, type and ranking (rdb bytes, elements, memory bytes).\n\t\t\tDefault: 10\n"
+            "\t-S --delimiter \t[prefix, sketch]character keys are split at.\n\t\t\tDefault: :\n"
+            "\t-M --budget \t[prefix]megabytes the prefix trie may take before its smallest branches are pruned.\n\t\t\tDefault: 256\n"
+            "\t-R --reference \t[sketch]unix time the ttls are counted from.\n\t\t\tDefault: now\n"
+            "\t-w --writers \tthreads writing the aof files while parsing goes on.\n\t\t\tDefault: 4\n"
+            "\t-z --zerocopy \t[rdbparser]hand string views to the handler instead of copies, no aof output.\n\t\t\tDefault: no\n"
+            "\t-N --native \t[rdbparser]with -z, hand zset scores to the handler as doubles instead of text.\n\t\t\tDefault: no\n"
+            "\t-j --jobs \tdecode (rdbparser) or scan the table (rediscounter) with this many threads.\n\t\t\tDefault: 1\n"
+            "\t-e --stream \t[rdbparser]stream elements to the handler in batches of this size, no aof output.\n\t\t\tDefault: no\n"
+            "\t-k --scan \t[rdbparser]only report key names and types (keys) or types (types), values are skipped.\n\t\t\tDefault: no\n"
+            "\t-m --match \t[rdbparser]only keys matching this glob pattern, may be repeated.\n"
+            "\t-p --prefix \t[rdbparser]only keys starting with this prefix, may be repeated.\n"
+            "\t-T --types \t[rdbparser]only keys of these types, like string,hash.\n"
+            "\t-D --dbs \t[rdbparser]only keys in these dbs, like 0,3.\n"
+            "\t-E --expire \t[rdbparser]only keys expiring within min:max, unix times in ms, no expire counts as -1.\n"
+            "\t\t\tValues of the other keys are skipped, not decoded.\n"
+            "\t-u --unordered \t[rdbparser]with -j, let keys reach the handler out of file order.\n\t\t\tDefault: no\n"
+            "\tsketch files \t[sketch]sketches saved by earlier runs, merged in. -f may be a sketch too.\n"
             "Notice: This tool only test on redis 2.2 and 2.4, so it may be error in 2.4 later.\n";
     if(argc <= 4) {
         fprintf(stderr, "%s", usage);
@@ -147,23 +234,66 @@ int main(int argc, char **argv) {
     char *rdbFile = NULL;
     // option variables for rdb-parser
     BOOL dumpParseInfo = FALSE;
+    char *statsFile = NULL;
+    // progress reporting
+    double progressInterval = 0;
+    char *metricsFile = NULL;
+    progressMeter *meter = NULL;
+    BOOL zeroCopy = FALSE;
+    BOOL nativeScores = FALSE;
+    BOOL unordered = FALSE;
+    int threads = 1;
+    int stream_batch = 0;
+    int scan = -1;
+    // key filters, applied to the parser once it's created
+    char *patterns[64], *prefixes[64];
+    int npatterns = 0, nprefixes = 0;
+    char *types = NULL, *dbs = NULL, *expire = NULL;
     int parse_result;
     // service to use
     int service = -1;
     // option variables for redis-counter
     int aof_number = 1;
-    char *aof_filename = "output.aof";
+    char *aof_filename = NULL;
     int dump_aof = -1;
+    size_t aof_buffer = 0;
+    int aof_writers = 0;
+    int aof_format = RDB_AOF_TEXT;
+    unsigned int resp_batch = 0;
+    unsigned int top = 0;
+    char delimiter = PREFIX_DELIMITER;
+    size_t budget = 0;
+    long long reference = 0;
     /***
      * Arguments
      * -f rdb file path
-     * -d rdbparser, dump parser info.
-     * -t service name like "rdbparser", "rediscounter"
+     * -d rdbparser and memory, dump parser info.
+     * -J rdbparser and memory, parser info as JSON to this file.
+     * -P seconds between progress reports on stderr.
+     * -X Prometheus metrics file rewritten with the progress.
+     * -t service name like "rdbparser", "rediscounter", "memory", "bigkeys", "prefix", "sketch"
      * -n rediscounter, aof file number for save kv
-     * -o rediscounter, aof output file name
+     * -o rediscounter, aof output file name, or memory report file name
      * -s rediscounter, is dump aof file.
+     * -b aof buffer size in bytes.
+     * -w aof writer threads.
+     * -F rdbparser, aof format, "text", "lines" or "resp".
+     * -c rdbparser, items per RESP command.
+     * -H shard function, "slot", "hash", "jump" or "crc64".
+     * -K bigkeys, keys per ranking.
+     * -S prefix and sketch, key delimiter.
+     * -M prefix, trie budget in megabytes.
+     * -R sketch, reference time of ttls.
+     * -z rdbparser, zero-copy view handler.
+     * -N rdbparser, native double scores with -z.
+     * -j number of decoding (rdbparser) or scanning (rediscounter) threads.
+     * -u rdbparser, relaxed key order with -j.
+     * -e rdbparser, streaming handlers, batch size.
+     * -k rdbparser, scan mode, "keys" or "types".
+     * -m -p -T -D -E rdbparser, key filters.
+     * other arguments, sketch files to merge.
      ***/
-    char * optstring = "f:dt:n:o:s";
+    char * optstring = "f:dJ:P:X:t:n:o:sb:w:F:c:H:K:S:M:R:zNj:ue:k:m:p:T:D:E:";
     int ch;
     while((ch = getopt(argc, argv, optstring)) != -1){
         switch(ch){
@@ -173,6 +303,19 @@ int main(int argc, char **argv) {
         case 'd':
             dumpParseInfo = TRUE;
             break;
+        case 'J':
+            statsFile = optarg;
+            break;
+        case 'P':
+            progressInterval = atof(optarg);
+            if(progressInterval <= 0) {
+                fprintf(stderr, "-P needs a positive number of seconds\n");
+                exit(1);
+            }
+            break;
+        case 'X':
+            metricsFile = optarg;
+            break;
         case 't':
             if(strcmp("rdbparser", optarg) == 0){
                 service = RDB_PARSER;
@@ -180,6 +323,18 @@ int main(int argc, char **argv) {
             else if(strcmp("rediscounter", optarg) == 0){
                 service = REDIS_COUNTER;
             }
+            else if(strcmp("memory", optarg) == 0){
+                service = MEMORY_REPORT;
+            }
+            else if(strcmp("bigkeys", optarg) == 0){
+                service = BIGKEYS_REPORT;
+            }
+            else if(strcmp("prefix", optarg) == 0){
+                service = PREFIX_REPORT;
+            }
+            else if(strcmp("sketch", optarg) == 0){
+                service = SKETCH_REPORT;
+            }
             else{
                 fprintf(stderr, "Wrong service type: %s\n", optarg);
                 exit(1);
@@ -194,6 +349,103 @@ int main(int argc, char **argv) {
         case 's':
             dump_aof = 1;
             break;
+        case 'b':
+            aof_buffer = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            aof_writers = atoi(optarg);
+            break;
+        case 'F':
+            if(fmtLayoutByName(optarg)){
+                aof_format = RDB_AOF_TEXT;
+                kv_layout = fmtLayoutByName(optarg);
+            }
+            else if(strcmp("resp", optarg) == 0){
+                aof_format = RDB_AOF_RESP;
+            }
+            else{
+                fprintf(stderr, "Wrong format: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'c':
+            resp_batch = atoi(optarg);
+            break;
+        case 'H':
+            if((kv_shard = shardByName(optarg)) == NULL){
+                fprintf(stderr, "Wrong shard function: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'K':
+            top = atoi(optarg);
+            break;
+        case 'S':
+            if(strlen(optarg) != 1){
+                fprintf(stderr, "-S needs a single character\n");
+                exit(1);
+            }
+            delimiter = optarg[0];
+            break;
+        case 'M':
+            budget = strtoul(optarg, NULL, 10) * 1024 * 1024;
+            break;
+        case 'R':
+            reference = atoll(optarg);
+            break;
+        case 'z':
+            zeroCopy = TRUE;
+            break;
+        case 'N':
+            nativeScores = TRUE;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'u':
+            unordered = TRUE;
+            break;
+        case 'k':
+            if(strcmp("keys", optarg) == 0){
+                scan = RDB_SCAN_KEYS;
+            }
+            else if(strcmp("types", optarg) == 0){
+                scan = RDB_SCAN_TYPES;
+            }
+            else{
+                fprintf(stderr, "Wrong scan mode: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'm':
+        case 'p':
+            if(npatterns + nprefixes == 64) {
+                fprintf(stderr, "Too many -m/-p options\n");
+                exit(1);
+            }
+            if(ch == 'm') patterns[npatterns++] = optarg;
+            else prefixes[nprefixes++] = optarg;
+            break;
+        case 'T':
+            types = optarg;
+            break;
+        case 'D':
+            dbs = optarg;
+            break;
+        case 'E':
+            expire = optarg;
+            if(!strchr(expire, ':')) {
+                fprintf(stderr, "-E needs min:max\n");
+                exit(1);
+            }
+            break;
+        case 'e':
+            stream_batch = atoi(optarg);
+            if(stream_batch <= 0) {
+                fprintf(stderr, "-e needs a positive batch size\n");
+                exit(1);
+            }
+            break;
         default:
             fprintf(stderr, "Unknown option -%c\n", (char)ch);
             exit(1);
@@ -207,18 +459,178 @@ int main(int argc, char **argv) {
         fprintf(stderr, "U need to specify a service name first with -t option.\n");
         exit(1);
     }
-    if(service == RDB_PARSER){
-        printf("--------------------------------------------RDB PARSER------------------------------------------\n");
-        parse_result = rdbParse(rdbFile, userHandler, aof_number, aof_filename, dump_aof, _format_kv);
-        printf("--------------------------------------------RDB PARSER------------------------------------------\n");
+    if(!aof_filename)
+        aof_filename = service == MEMORY_REPORT ? "memory.csv" :
+            service == PREFIX_REPORT ? "prefix.csv" :
+            service == SKETCH_REPORT ? "rdb.sketch" : "output.aof";
+    if(optind < argc && service != SKETCH_REPORT){
+        fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+        exit(1);
+    }
+    if(progressInterval > 0 || metricsFile){
+        meter = progressCreate(rdbFile);
+        if(progressReport(meter, progressInterval, progressInterval > 0, metricsFile) == -1)
+            exit(1);
+    }
+    if(service == RDB_PARSER || service == MEMORY_REPORT || service == BIGKEYS_REPORT ||
+            service == PREFIX_REPORT || service == SKETCH_REPORT){
+        char *banner = service == MEMORY_REPORT ?
+            "--------------------------------------------MEMORY REPORT------------------------------------------\n" :
+            service == BIGKEYS_REPORT ?
+            "--------------------------------------------BIGKEYS------------------------------------------\n" :
+            service == PREFIX_REPORT ?
+            "--------------------------------------------PREFIX REPORT------------------------------------------\n" :
+            service == SKETCH_REPORT ?
+            "--------------------------------------------SKETCH------------------------------------------\n" :
+            "--------------------------------------------RDB PARSER------------------------------------------\n";
+        printf("%s", banner);
+        rdbParser *parser = rdbParserCreate(rdbFile);
+        int i;
+        rdbParserSetAofBuffer(parser, aof_buffer);
+        rdbParserSetAofWriters(parser, aof_writers);
+        rdbParserSetAofFormat(parser, aof_format, resp_batch);
+        rdbParserSetNativeScores(parser, nativeScores);
+        rdbParserSetShard(parser, kv_shard);
+        rdbParserSetTiming(parser, dumpParseInfo || statsFile);
+        rdbParserSetProgress(parser, meter);
+        char *tok;
+        for(i = 0; i < npatterns; i++) rdbParserFilterPattern(parser, patterns[i]);
+        for(i = 0; i < nprefixes; i++) rdbParserFilterPrefix(parser, prefixes[i]);
+        for(tok = types ? strtok(types, ",") : NULL; tok; tok = strtok(NULL, ",")) {
+            if(strcasecmp(tok, "string") == 0) rdbParserFilterType(parser, REDIS_STRING);
+            else if(strcasecmp(tok, "list") == 0) rdbParserFilterType(parser, REDIS_LIST);
+            else if(strcasecmp(tok, "set") == 0) rdbParserFilterType(parser, REDIS_SET);
+            else if(strcasecmp(tok, "zset") == 0) rdbParserFilterType(parser, REDIS_ZSET);
+            else if(strcasecmp(tok, "hash") == 0) rdbParserFilterType(parser, REDIS_HASH);
+            else {
+                fprintf(stderr, "Wrong type: %s\n", tok);
+                exit(1);
+            }
+        }
+        for(tok = dbs ? strtok(dbs, ",") : NULL; tok; tok = strtok(NULL, ",")) {
+            rdbParserFilterDb(parser, atoi(tok));
+        }
+        if(expire)
+            rdbParserFilterExpire(parser, atol(expire), atol(strchr(expire, ':') + 1));
+        if(service == MEMORY_REPORT) {
+            if((mem_report = fopen(aof_filename, "w")) == NULL) {
+                fprintf(stderr, "open %s err :%s\n", aof_filename, strerror(errno));
+                exit(1);
+            }
+            if(threads > 1)
+                fprintf(stderr, "-j is ignored by the memory report.\n");
+            setvbuf(mem_report, NULL, _IOFBF, 1 << 20);
+            fputs(MEM_CSV_HEADER, mem_report);
+            mem_line = sdsempty();
+            parse_result = rdbParserParseMemory(parser, memoryHandler);
+            if(fclose(mem_report) != 0) {
+                fprintf(stderr, "write %s err :%s\n", aof_filename, strerror(errno));
+                parse_result = PARSE_ERR;
+            }
+            sdsfree(mem_line);
+        } else if(service == BIGKEYS_REPORT) {
+            if(threads > 1)
+                fprintf(stderr, "-j is ignored by bigkeys.\n");
+            big_keys = bigkeysCreate(top);
+            parse_result = rdbParserParseMemory(parser, bigkeysHandler);
+            if(parse_result == PARSE_OK)
+                bigkeysPrint(big_keys, stdout);
+            bigkeysFree(big_keys);
+        } else if(service == PREFIX_REPORT) {
+            FILE *fp;
+            size_t nodes, bytes;
+            int prunes;
+            if(threads > 1)
+                fprintf(stderr, "-j is ignored by the prefix report.\n");
+            prefix_trie = prefixCreate(delimiter, budget);
+            parse_result = rdbParserParseMemory(parser, prefixHandler);
+            prefixStats(prefix_trie, &nodes, &bytes, &prunes);
+            printf("%zu prefixes in %zu bytes, pruned %d times\n", nodes, bytes, prunes);
+            if(parse_result == PARSE_OK) {
+                if((fp = fopen(aof_filename, "w")) == NULL) {
+                    fprintf(stderr, "open %s err :%s\n", aof_filename, strerror(errno));
+                    exit(1);
+                }
+                setvbuf(fp, NULL, _IOFBF, 1 << 20);
+                fputs(PREFIX_CSV_HEADER, fp);
+                if(prefixWrite(prefix_trie, fp) == -1 || fclose(fp) != 0) {
+                    fprintf(stderr, "write %s err :%s\n", aof_filename, strerror(errno));
+                    parse_result = PARSE_ERR;
+                }
+            }
+            prefixFree(prefix_trie);
+        } else if(service == SKETCH_REPORT) {
+            FILE *fp;
+            if(threads > 1)
+                fprintf(stderr, "-j is ignored by sketch.\n");
+            key_sketch = sketchCreate(delimiter, reference);
+            // a sketch saved by an earlier run is merged rather than parsed
+            if(sketchIsFile(rdbFile))
+                parse_result = sketchMergeFile(key_sketch, rdbFile) == -1 ? PARSE_ERR : PARSE_OK;
+            else
+                parse_result = rdbParserParseMemory(parser, sketchHandler);
+            for(i = optind; i < argc && parse_result == PARSE_OK; i++) {
+                if(sketchMergeFile(key_sketch, argv[i]) == -1) parse_result = PARSE_ERR;
+            }
+            if(parse_result == PARSE_OK) {
+                sketchPrint(key_sketch, stdout);
+                if((fp = fopen(aof_filename, "w")) == NULL) {
+                    fprintf(stderr, "open %s err :%s\n", aof_filename, strerror(errno));
+                    exit(1);
+                }
+                if(sketchSave(key_sketch, fp) == -1 || fclose(fp) != 0) {
+                    fprintf(stderr, "write %s err :%s\n", aof_filename, strerror(errno));
+                    parse_result = PARSE_ERR;
+                }
+            }
+            sketchFree(key_sketch);
+        } else if(scan != -1) {
+            if(dump_aof == 1)
+                fprintf(stderr, "-s is ignored in scan mode.\n");
+            if(threads > 1)
+                fprintf(stderr, "-j is ignored in scan mode.\n");
+            parse_result = rdbParserParseScan(parser, userScanHandler, scan);
+        } else if(zeroCopy) {
+            if(dump_aof == 1)
+                fprintf(stderr, "-s is ignored in zero-copy mode.\n");
+            if(threads > 1)
+                fprintf(stderr, "-j is ignored in zero-copy mode.\n");
+            parse_result = rdbParserParseView(parser, userViewHandler);
+        } else if(stream_batch) {
+            rdbStreamHandler stream = {userBeginHandler, userElementsHandler, userEndHandler, stream_batch, NULL};
+            if(dump_aof == 1)
+                fprintf(stderr, "-s is ignored in streaming mode.\n");
+            if(threads > 1)
+                fprintf(stderr, "-j is ignored in streaming mode.\n");
+            parse_result = rdbParserParseStream(parser, &stream);
+        } else if(threads > 1) {
+            parse_result = rdbParserParseParallel(parser, userHandler, threads, !unordered,
+                    aof_number, aof_filename, dump_aof, _format_kv);
+        } else {
+            parse_result = rdbParserParse(parser, userHandler, aof_number, aof_filename, dump_aof, _format_kv);
+        }
+        printf("%s", banner);
         if(parse_result == PARSE_OK && dumpParseInfo) {
-            dumpParserInfo();
+            rdbParserDumpInfo(parser);
+        }
+        if(parse_result == PARSE_OK && statsFile) {
+            FILE *fp = fopen(statsFile, "w");
+            if(!fp) {
+                fprintf(stderr, "open %s err :%s\n", statsFile, strerror(errno));
+                exit(1);
+            }
+            if(rdbParserDumpInfoJson(parser, fp) == -1 || fclose(fp) != 0) {
+                fprintf(stderr, "write %s err :%s\n", statsFile, strerror(errno));
+                exit(1);
+            }
         }
+        rdbParserFree(parser);
     }
     if(service == REDIS_COUNTER){
         printf("--------------------------------------------REDIS COUNTER------------------------------------------\n");
-        rdb_load(rdbFile, _format_kv, aof_number, aof_filename, dump_aof);
+        rdb_load(rdbFile, _format_kv, aof_number, aof_filename, dump_aof, aof_buffer, aof_writers, threads, meter);
         printf("--------------------------------------------REDIS COUNTER------------------------------------------\n");
     }
+    progressFree(meter);
     return 0;
 }
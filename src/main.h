@@ -5,6 +5,7 @@
  */
 #ifndef __MAIN_H_
 #define __MAIN_H_
+#include "fmacros.h"
 #include <stdio.h>
 #include <time.h>
 #include <sys/types.h>
@@ -21,7 +22,6 @@
 #include <getopt.h>
 #include "zmalloc.h"
 #include "sds.h"
-#include "fmacros.h"
 #include "intset.h"                     
 #include "ziplist.h"                    
 #include "zipmap.h"                     
@@ -88,6 +88,10 @@
 /* service type */
 #define RDB_PARSER 1
 #define REDIS_COUNTER 2
+#define MEMORY_REPORT 3
+#define BIGKEYS_REPORT 4
+#define PREFIX_REPORT 5
+#define SKETCH_REPORT 6
 enum BOOL_TYPE {FALSE, TRUE};
 typedef enum BOOL_TYPE BOOL;
 
@@ -0,0 +1,151 @@
+/*
+ * memory, how many bytes a key would take in a Redis 2.4 server. See
+ * memory.h for what is counted.
+ */
+#include "memory.h"
+#include "util.h"
+
+/* sizeof() of the redis 2.4 structures on a 64 bit box */
+#define MEM_ROBJ 16
+#define MEM_SDSHDR 8            /* len, free, then the bytes and a null term */
+#define MEM_DICT_ENTRY 24       /* key, val, next */
+#define MEM_DICT 88             /* type, privdata, two tables, rehashidx, iterators */
+#define MEM_DICT_MIN_TABLE 4    /* DICT_HT_INITIAL_SIZE */
+#define MEM_LIST 48
+#define MEM_LIST_NODE 24
+#define MEM_ZSET 16             /* dict and skiplist pointers */
+#define MEM_SKIPLIST 32
+#define MEM_SKIPLIST_NODE 24    /* obj, score, backward, then the levels */
+#define MEM_SKIPLIST_LEVEL 16   /* forward, span */
+#define MEM_SKIPLIST_MAXLEVEL 32
+#define MEM_SKIPLIST_P 0.25
+#define MEM_SHARED_INTEGERS 10000
+#define MEM_POINTER 8
+
+/* jemalloc 2.2 as built by redis 2.4: 16 byte quantum, 64 byte cachelines,
+ * 256 byte subpages, 4KB pages, 4MB chunks. */
+#define MEM_PAGE 4096
+#define MEM_CHUNK (4 * 1024 * 1024)
+
+static size_t memRound(size_t size, size_t to) {
+    return (size + to - 1) / to * to;
+}
+
+size_t memAlloc(size_t size) {
+    if (size == 0) return 0;
+    if (size <= 8) return 8;
+    if (size <= 128) return memRound(size, 16);
+    if (size <= 512) return memRound(size, 64);
+    if (size <= 3840) return memRound(size, 256);
+    if (size <= MEM_CHUNK - MEM_PAGE) return memRound(size, MEM_PAGE);
+    return memRound(size, MEM_CHUNK);
+}
+
+size_t memStringObject(size_t len, int isint, long long value) {
+    if (isint)
+        return (value >= 0 && value < MEM_SHARED_INTEGERS) ? 0 : MEM_ROBJ;
+    return MEM_ROBJ + memAlloc(MEM_SDSHDR + len + 1);
+}
+
+size_t memBlobObject(size_t len) {
+    return MEM_ROBJ + memAlloc(len);
+}
+
+/* The bucket array of a dict holding count entries: it doubles as soon as
+ * it is full, from 4 buckets on. */
+static size_t memDictTable(unsigned long count) {
+    unsigned long size = MEM_DICT_MIN_TABLE;
+
+    if (count == 0) return 0;
+    while (size < count) size *= 2;
+    return memAlloc(size * MEM_POINTER);
+}
+
+/* The mean allocation of a skiplist node, whose level is 1 with probability
+ * 1-p, 2 with (1-p)p, and so on. */
+static double memSkiplistNode(void) {
+    static double mean = 0;
+    double p = 1 - MEM_SKIPLIST_P;
+    int level;
+
+    if (mean != 0) return mean;
+    for (level = 1; level < MEM_SKIPLIST_MAXLEVEL; level++) {
+        mean += p * memAlloc(MEM_SKIPLIST_NODE + level * MEM_SKIPLIST_LEVEL);
+        p *= MEM_SKIPLIST_P;
+    }
+    mean += p / (1 - MEM_SKIPLIST_P) *
+        memAlloc(MEM_SKIPLIST_NODE + MEM_SKIPLIST_MAXLEVEL * MEM_SKIPLIST_LEVEL);
+    return mean;
+}
+
+size_t memContainer(int encoding, unsigned long count) {
+    switch (encoding) {
+        case REDIS_ENCODING_LINKEDLIST:
+            return MEM_ROBJ + memAlloc(MEM_LIST) + count * memAlloc(MEM_LIST_NODE);
+        case REDIS_ENCODING_HT:
+            return MEM_ROBJ + memAlloc(MEM_DICT) + memDictTable(count) +
+                count * memAlloc(MEM_DICT_ENTRY);
+        case REDIS_ENCODING_SKIPLIST:
+            /* the skiplist header has every level */
+            return MEM_ROBJ + memAlloc(MEM_ZSET) +
+                memAlloc(MEM_DICT) + memDictTable(count) + count * memAlloc(MEM_DICT_ENTRY) +
+                memAlloc(MEM_SKIPLIST) +
+                memAlloc(MEM_SKIPLIST_NODE + MEM_SKIPLIST_MAXLEVEL * MEM_SKIPLIST_LEVEL) +
+                (size_t)(count * memSkiplistNode() + 0.5);
+        default:
+            return 0;
+    }
+}
+
+size_t memKey(size_t keylen, int expires) {
+    size_t bytes = memAlloc(MEM_DICT_ENTRY) + MEM_POINTER + memAlloc(MEM_SDSHDR + keylen + 1);
+
+    /* the expires dict shares the key sds, its value is a long long robj */
+    if (expires)
+        bytes += memAlloc(MEM_DICT_ENTRY) + MEM_POINTER + MEM_ROBJ;
+    return bytes;
+}
+
+const char *memEncodingName(int encoding) {
+    static const char *names[] = {
+        "raw", "int", "hashtable", "zipmap", "linkedlist", "ziplist", "intset", "skiplist"
+    };
+
+    if (encoding < 0 || encoding >= (int)(sizeof(names) / sizeof(*names))) return "unknown";
+    return names[encoding];
+}
+
+static sds memCatLongLong(sds s, long long value) {
+    char buf[32];
+
+    return sdscatlen(s, buf, ll2string(buf, sizeof(buf), value));
+}
+
+sds memCsvRow(sds s, rdbStr *key, rdbKeyMemory *mem) {
+    static const char *types[] = {"string", "list", "set", "zset", "hash"};
+    const char *p = key->ptr, *end = key->ptr + key->len, *q;
+
+    s = memCatLongLong(s, mem->dbid);
+    s = sdscatlen(s, ",", 1);
+    s = sdscat(s, (char *)(mem->type >= 0 && mem->type < TOTAL_DATA_TYPES ? types[mem->type] : "unknown"));
+    /* quotes in the key are doubled */
+    s = sdscatlen(s, ",\"", 2);
+    while ((q = memchr(p, '"', end - p)) != NULL) {
+        s = sdscatlen(s, (char *)p, q - p + 1);
+        s = sdscatlen(s, "\"", 1);
+        p = q + 1;
+    }
+    s = sdscatlen(s, (char *)p, end - p);
+    s = sdscatlen(s, "\",", 2);
+    s = memCatLongLong(s, mem->bytes);
+    s = sdscatlen(s, ",", 1);
+    s = sdscat(s, (char *)memEncodingName(mem->encoding));
+    s = sdscatlen(s, ",", 1);
+    s = memCatLongLong(s, mem->elements);
+    s = sdscatlen(s, ",", 1);
+    s = memCatLongLong(s, mem->largest);
+    s = sdscatlen(s, ",", 1);
+    if (mem->expiretime != -1)
+        s = memCatLongLong(s, mem->expiretime);
+    return sdscatlen(s, "\n", 1);
+}
@@ -0,0 +1,54 @@
+/*
+ * memory, how many bytes a key would take in a Redis 2.4 server.
+ *
+ * The estimate follows the structures redis 2.4 builds on a 64 bit box and
+ * rounds every allocation up to the size classes of the jemalloc it ships
+ * with (8, 16 to 128 by 16, 192 to 512 by 64, 768 to 3840 by 256, then
+ * pages, then 4MB chunks):
+ *
+ *   key       dict entry, key sds and value robj, plus a bucket pointer, and
+ *             for a volatile key an entry in the expires dict with its robj.
+ *   string    sds, nothing for an integer (the robj holds it, or is one of
+ *             the shared integers below 10000).
+ *   zipmap, ziplist, intset
+ *             the blob as it is on disk.
+ *   linkedlist  list, a node per element, a string object per element.
+ *   hashtable   dict, table, a dict entry per element, string objects.
+ *   skiplist    zset, dict and skiplist, a dict entry and a node of random
+ *             level per member, the member's string object.
+ *
+ * A value's encoding is the one it has in the rdb file: redis saves values
+ * the way it holds them, so that is the encoding they had when saved.
+ * Fragmentation and the main dict tables are not counted.
+ */
+#ifndef __MEMORY_H_
+#define __MEMORY_H_
+#include "rdb_parser.h"
+
+/* The allocation a request of size bytes really gets, 0 for 0. */
+size_t memAlloc(size_t size);
+
+/* A string object of len bytes, or an integer if isint. */
+size_t memStringObject(size_t len, int isint, long long value);
+
+/* A zipmap, ziplist or intset of len bytes and its robj. */
+size_t memBlobObject(size_t len);
+
+/* A linkedlist, hashtable or skiplist value of count elements and its robj,
+ * the string objects of the elements aside. */
+size_t memContainer(int encoding, unsigned long count);
+
+/* What a key costs besides its value. */
+size_t memKey(size_t keylen, int expires);
+
+/* "raw", "int", "hashtable", ..., the names of OBJECT ENCODING. */
+const char *memEncodingName(int encoding);
+
+/* The report, one line per key:
+ * database,type,key,size_in_bytes,encoding,num_elements,len_largest_element,expiry
+ * The key is quoted, expiry is a unix time in milliseconds, empty if there
+ * is none. */
+#define MEM_CSV_HEADER "database,type,key,size_in_bytes,encoding,num_elements,len_largest_element,expiry\n"
+sds memCsvRow(sds s, rdbStr *key, rdbKeyMemory *mem);
+
+#endif
@@ -0,0 +1,520 @@
+/*
+ * microbench, timings of the small kernels the parser spends its time in
+ * (make microbench).
+ *
+ * Each kernel runs a batch of operations per repetition. The batch is sized
+ * during warmup so a repetition takes at least MBENCH_REP_NS, then -r
+ * repetitions are timed one by one and reported as nanoseconds per
+ * operation: min, median, p90, p99 and max over the repetitions, and MB/s
+ * at the median for the kernels that go through bytes. With -c the process
+ * is pinned to one cpu first, so the numbers don't move with the scheduler.
+ *
+ * The kernels are the ones of this tree, called the way the parser calls
+ * them, on inputs built once before timing:
+ *
+ *   lzf_decompress   64KB of lzf compressed text
+ *   crc64            64KB, the engine picked at runtime and the bytewise one
+ *   rdbLoadLen       a mix of 6, 14 and 32 bit lengths, through a memory rio
+ *   ziplist-iter     ziplistNext/ziplistGet over 512 strings and integers
+ *   zipmap-iter      zipmapNext over 256 fields
+ *   intset-string    intsetGet then ll2string over 512 64 bit integers
+ *   sdsfromlonglong  sdsfromlonglong then sdsfree
+ *   score-fpconv     fpconv_dtoa of zset scores
+ *   score-printf     snprintf %.17g of the same scores, for reference
+ *   zmalloc          zmalloc of 16 blocks of 8 to 128 bytes, then zfree
+ *   zmalloc-mt       the same in 1, 2, 4 ... 32 threads at once (-t), new
+ *                    threads for each count; ns per operation is the wall time
+ *                    over the operations of one thread, so it stays flat
+ *                    as threads are added as long as they don't contend
+ *                    (and there are cpus for them, leave -c out)
+ *
+ * Results are also written to -o, tab separated, to diff between builds.
+ */
+#define _GNU_SOURCE
+#include "main.h"
+#include <sched.h>
+#include <pthread.h>
+#include "rdb_parser.h"
+#include "rio.h"
+#include "crc64.h"
+#include "fpconv.h"
+#include "util.h"
+
+#define MBENCH_REP_NS 200000    /* shortest repetition */
+#define MBENCH_BUFFER (64 * 1024)
+#define MBENCH_LENGTHS 4096
+#define MBENCH_ZIPLIST 512
+#define MBENCH_ZIPMAP 256
+#define MBENCH_INTSET 512
+#define MBENCH_SCORES 1024
+#define MBENCH_BLOCKS 16
+#define MBENCH_THREADS 32       /* most -t threads */
+#define MBENCH_HEADER "kernel\tops_per_rep\treps\tns_min\tns_p50\tns_p90\tns_p99\tns_max\tmb_per_s\n"
+
+typedef struct {
+    const char *name;
+    size_t bytes;               /* per operation, 0 if MB/s means nothing */
+    void (*setup)(void);
+    size_t (*run)(size_t loops);  /* returns the operations done */
+} mbenchKernel;
+
+/* results go here so the compiler can't drop the work */
+static volatile uint64_t mbench_sink;
+
+static unsigned char mbench_text[MBENCH_BUFFER];
+static unsigned char mbench_lzf[MBENCH_BUFFER];
+static unsigned int mbench_lzf_len;
+static unsigned char mbench_lengths[MBENCH_LENGTHS * 5];
+static size_t mbench_lengths_len;
+static unsigned char *mbench_ziplist;
+static unsigned char *mbench_zipmap;
+static intset *mbench_intset;
+static double mbench_scores[MBENCH_SCORES];
+static uint64_t mbench_state = 1;
+
+/* zmalloc-mt, threads run the batch of the main one between two barriers */
+static pthread_barrier_t mbench_start, mbench_done;
+static pthread_t mbench_pool[MBENCH_THREADS];
+static int mbench_pool_size;
+static size_t mbench_pool_loops;
+static int mbench_pool_stop;
+
+void _parsePanic(char *msg, char *file, int line) {
+    fprintf(stderr, "rdb-microbench: %s #%s:%d\n", msg, file, line);
+}
+
+/* xorshift64, the inputs only need to be the same from run to run */
+static uint64_t mbenchRandom(void) {
+    mbench_state ^= mbench_state << 13;
+    mbench_state ^= mbench_state >> 7;
+    mbench_state ^= mbench_state << 17;
+    return mbench_state;
+}
+
+/* words from a small vocabulary, which lzf compresses like real values */
+static void mbenchSetupText(void) {
+    static const char *words[] = {"user", "session", "id", "name", "value", "count", "2014", "null",
+        "true", "http://", "example", ".com", "cache", "item", "price", "status"};
+    size_t i = 0, len;
+    const char *w;
+
+    while (i < MBENCH_BUFFER) {
+        w = words[mbenchRandom() % (sizeof(words) / sizeof(*words))];
+        len = strlen(w);
+        if (i + len + 1 > MBENCH_BUFFER) len = MBENCH_BUFFER - i - 1;
+        memcpy(mbench_text + i, w, len);
+        i += len;
+        mbench_text[i++] = mbenchRandom() % 4 ? ':' : '0' + mbenchRandom() % 10;
+    }
+}
+
+static void mbenchSetupLzf(void) {
+    mbenchSetupText();
+    mbench_lzf_len = lzf_compress(mbench_text, MBENCH_BUFFER, mbench_lzf, MBENCH_BUFFER);
+}
+
+static size_t mbenchLzf(size_t loops) {
+    static unsigned char out[MBENCH_BUFFER];
+    size_t i;
+
+    for (i = 0; i < loops; i++)
+        mbench_sink += lzf_decompress(mbench_lzf, mbench_lzf_len, out, MBENCH_BUFFER);
+    return loops;
+}
+
+static size_t mbenchCrc64(size_t loops) {
+    uint64_t crc = 0;
+    size_t i;
+
+    for (i = 0; i < loops; i++) crc = crc64(crc, mbench_text, MBENCH_BUFFER);
+    mbench_sink += crc;
+    return loops;
+}
+
+static size_t mbenchCrc64Bytewise(size_t loops) {
+    uint64_t crc = 0;
+    size_t i;
+
+    for (i = 0; i < loops; i++) crc = crc64_bytewise(crc, mbench_text, MBENCH_BUFFER);
+    mbench_sink += crc;
+    return loops;
+}
+
+/* mostly 6 bit lengths, like the element lengths of an rdb file */
+static void mbenchSetupLengths(void) {
+    uint32_t len, n;
+    size_t i, p = 0;
+
+    for (i = 0; i < MBENCH_LENGTHS; i++) {
+        n = mbenchRandom() % 100;
+        if (n < 80) {
+            mbench_lengths[p++] = (REDIS_RDB_6BITLEN << 6) | (mbenchRandom() % 64);
+        } else if (n < 98) {
+            len = mbenchRandom() % 16384;
+            mbench_lengths[p++] = (REDIS_RDB_14BITLEN << 6) | (len >> 8);
+            mbench_lengths[p++] = len & 0xff;
+        } else {
+            len = htonl((uint32_t)mbenchRandom());
+            mbench_lengths[p++] = REDIS_RDB_32BITLEN << 6;
+            memcpy(mbench_lengths + p, &len, 4);
+            p += 4;
+        }
+    }
+    mbench_lengths_len = p;
+}
+
+static size_t mbenchLoadLen(size_t loops) {
+    uint64_t sum = 0;
+    size_t i, j;
+    rio r;
+
+    for (i = 0; i < loops; i++) {
+        rioInitWithMemory(&r, mbench_lengths, mbench_lengths_len, 0);
+        for (j = 0; j < MBENCH_LENGTHS; j++) sum += rdbLoadLen(&r, NULL);
+        rioClose(&r);
+    }
+    mbench_sink += sum;
+    return loops * MBENCH_LENGTHS;
+}
+
+static void mbenchSetupZiplist(void) {
+    char buf[64];
+    int i, len;
+
+    mbench_ziplist = ziplistNew();
+    for (i = 0; i < MBENCH_ZIPLIST; i++) {
+        if (i % 2)
+            len = ll2string(buf, sizeof(buf), (long long)(mbenchRandom() % 100000000));
+        else
+            len = snprintf(buf, sizeof(buf), "member:%llu", (unsigned long long)(mbenchRandom() % 1000000));
+        mbench_ziplist = ziplistPush(mbench_ziplist, (unsigned char *)buf, len, REDIS_TAIL);
+    }
+}
+
+static size_t mbenchZiplist(size_t loops) {
+    unsigned char *p, *sval;
+    unsigned int slen;
+    long long lval;
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < loops; i++) {
+        p = ziplistIndex(mbench_ziplist, 0);
+        while (ziplistGet(p, &sval, &slen, &lval)) {
+            sum += sval ? slen : (uint64_t)lval;
+            p = ziplistNext(mbench_ziplist, p);
+        }
+    }
+    mbench_sink += sum;
+    return loops * MBENCH_ZIPLIST;
+}
+
+static void mbenchSetupZipmap(void) {
+    char field[32], value[64];
+    int i, flen, vlen;
+
+    mbench_zipmap = zipmapNew();
+    for (i = 0; i < MBENCH_ZIPMAP; i++) {
+        flen = snprintf(field, sizeof(field), "field:%d", i);
+        vlen = snprintf(value, sizeof(value), "value:%llu", (unsigned long long)mbenchRandom());
+        mbench_zipmap = zipmapSet(mbench_zipmap, (unsigned char *)field, flen,
+                (unsigned char *)value, vlen, NULL);
+    }
+}
+
+static size_t mbenchZipmap(size_t loops) {
+    unsigned char *p, *field, *value;
+    unsigned int flen, vlen;
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < loops; i++) {
+        p = zipmapRewind(mbench_zipmap);
+        while ((p = zipmapNext(p, &field, &flen, &value, &vlen)) != NULL) sum += flen + vlen;
+    }
+    mbench_sink += sum;
+    return loops * MBENCH_ZIPMAP;
+}
+
+static void mbenchSetupIntset(void) {
+    int i;
+
+    mbench_intset = intsetNew();
+    for (i = 0; i < MBENCH_INTSET; i++)
+        mbench_intset = intsetAdd(mbench_intset, (int64_t)mbenchRandom() >> (mbenchRandom() % 48), NULL);
+}
+
+static size_t mbenchIntsetString(size_t loops) {
+    char buf[32];
+    int64_t value;
+    uint64_t sum = 0;
+    uint32_t j;
+    size_t i;
+
+    for (i = 0; i < loops; i++)
+        for (j = 0; intsetGet(mbench_intset, j, &value); j++) sum += ll2string(buf, sizeof(buf), value);
+    mbench_sink += sum;
+    return loops * intsetLen(mbench_intset);
+}
+
+static size_t mbenchSdsFromLongLong(size_t loops) {
+    uint64_t sum = 0;
+    size_t i;
+    sds s;
+
+    for (i = 0; i < loops; i++) {
+        s = sdsfromlonglong((long long)(i * 2654435761u) - 1000000000);
+        sum += sdslen(s);
+        sdsfree(s);
+    }
+    mbench_sink += sum;
+    return loops;
+}
+
+/* integers, cents and doubles with every digit, the kinds of zset scores */
+static void mbenchSetupScores(void) {
+    int i;
+
+    for (i = 0; i < MBENCH_SCORES; i++) {
+        switch (i % 3) {
+            case 0: mbench_scores[i] = (double)(mbenchRandom() % 10000000); break;
+            case 1: mbench_scores[i] = (mbenchRandom() % 10000000) / 100.0; break;
+            default: mbench_scores[i] = (double)(mbenchRandom() >> 11) / 9007199254740992.0; break;
+        }
+    }
+}
+
+static size_t mbenchScoreFpconv(size_t loops) {
+    char buf[FPCONV_DTOA_MAX];
+    uint64_t sum = 0;
+    size_t i;
+    int j;
+
+    for (i = 0; i < loops; i++)
+        for (j = 0; j < MBENCH_SCORES; j++) sum += fpconv_dtoa(mbench_scores[j], buf);
+    mbench_sink += sum;
+    return loops * MBENCH_SCORES;
+}
+
+static size_t mbenchScorePrintf(size_t loops) {
+    char buf[64];
+    uint64_t sum = 0;
+    size_t i;
+    int j;
+
+    for (i = 0; i < loops; i++)
+        for (j = 0; j < MBENCH_SCORES; j++) sum += snprintf(buf, sizeof(buf), "%.17g", mbench_scores[j]);
+    mbench_sink += sum;
+    return loops * MBENCH_SCORES;
+}
+
+static size_t mbenchZmalloc(size_t loops) {
+    void *blocks[MBENCH_BLOCKS];
+    size_t i;
+    int j;
+
+    for (i = 0; i < loops; i++) {
+        for (j = 0; j < MBENCH_BLOCKS; j++) blocks[j] = zmalloc(8 + j * 8);
+        for (j = 0; j < MBENCH_BLOCKS; j++) zfree(blocks[j]);
+    }
+    return loops * MBENCH_BLOCKS;
+}
+
+static void *mbenchPoolMain(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_barrier_wait(&mbench_start);
+        if (mbench_pool_stop) break;
+        mbenchZmalloc(mbench_pool_loops);
+        pthread_barrier_wait(&mbench_done);
+    }
+    return NULL;
+}
+
+static size_t mbenchZmallocThreads(size_t loops) {
+    mbench_pool_loops = loops;
+    pthread_barrier_wait(&mbench_start);
+    mbenchZmalloc(loops);
+    pthread_barrier_wait(&mbench_done);
+    return loops * MBENCH_BLOCKS;
+}
+
+static mbenchKernel mbench_kernels[] = {
+    {"lzf_decompress", MBENCH_BUFFER, mbenchSetupLzf, mbenchLzf},
+    {"crc64", MBENCH_BUFFER, mbenchSetupText, mbenchCrc64},
+    {"crc64-bytewise", MBENCH_BUFFER, mbenchSetupText, mbenchCrc64Bytewise},
+    {"rdbLoadLen", 0, mbenchSetupLengths, mbenchLoadLen},
+    {"ziplist-iter", 0, mbenchSetupZiplist, mbenchZiplist},
+    {"zipmap-iter", 0, mbenchSetupZipmap, mbenchZipmap},
+    {"intset-string", 0, mbenchSetupIntset, mbenchIntsetString},
+    {"sdsfromlonglong", 0, NULL, mbenchSdsFromLongLong},
+    {"score-fpconv", 0, mbenchSetupScores, mbenchScoreFpconv},
+    {"score-printf", 0, mbenchSetupScores, mbenchScorePrintf},
+    {"zmalloc", 0, NULL, mbenchZmalloc},
+    {"zmalloc-mt", 0, NULL, mbenchZmallocThreads},
+};
+
+#define MBENCH_KERNELS (sizeof(mbench_kernels) / sizeof(*mbench_kernels))
+
+static long long mbenchNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int mbenchCompare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double mbenchPercentile(double *sorted, int n, double q) {
+    int i = (int)(q * n + 0.5) - 1;
+
+    if (i < 0) i = 0;
+    if (i >= n) i = n - 1;
+    return sorted[i];
+}
+
+/* Size the batch during warmup, then time reps repetitions of it. */
+static void mbenchRunKernel(mbenchKernel *k, int warmup, int reps, FILE *fp) {
+    double *ns = zmalloc(reps * sizeof(double)), p50, mbs;
+    size_t loops = 1, ops = 0;
+    long long start, elapsed;
+    int i;
+
+    if (k->setup) k->setup();
+    for (i = 0; i < warmup || ops == 0; i++) {
+        start = mbenchNs();
+        ops = k->run(loops);
+        elapsed = mbenchNs() - start;
+        if (elapsed < MBENCH_REP_NS) {
+            loops *= 2;
+            ops = 0;
+        }
+    }
+    for (i = 0; i < reps; i++) {
+        start = mbenchNs();
+        ops = k->run(loops);
+        ns[i] = (double)(mbenchNs() - start) / ops;
+    }
+    qsort(ns, reps, sizeof(double), mbenchCompare);
+    p50 = mbenchPercentile(ns, reps, 0.5);
+    mbs = k->bytes ? k->bytes / p50 * 1e9 / (1024 * 1024) : 0;
+    printf("%-16s %10zu %10.2f %10.2f %10.2f %10.2f %10.2f", k->name, ops, ns[0], p50,
+            mbenchPercentile(ns, reps, 0.9), mbenchPercentile(ns, reps, 0.99), ns[reps - 1]);
+    if (k->bytes) printf(" %10.1f\n", mbs);
+    else printf(" %10s\n", "-");
+    fprintf(fp, "%s\t%zu\t%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.1f\n", k->name, ops, reps, ns[0], p50,
+            mbenchPercentile(ns, reps, 0.9), mbenchPercentile(ns, reps, 0.99), ns[reps - 1], mbs);
+    zfree(ns);
+}
+
+/* zmalloc-mt once per thread count, the main thread being one of them. */
+static void mbenchRunThreads(mbenchKernel *k, int *counts, int ncounts, int warmup, int reps, FILE *fp) {
+    mbenchKernel run = *k;
+    char name[32];
+    int c, i, err;
+
+    for (c = 0; c < ncounts; c++) {
+        pthread_barrier_init(&mbench_start, NULL, counts[c]);
+        pthread_barrier_init(&mbench_done, NULL, counts[c]);
+        mbench_pool_stop = 0;
+        for (mbench_pool_size = 0; mbench_pool_size < counts[c] - 1; mbench_pool_size++) {
+            if ((err = pthread_create(&mbench_pool[mbench_pool_size], NULL, mbenchPoolMain, NULL)) != 0) {
+                fprintf(stderr, "pthread_create err :%s\n", strerror(err));
+                exit(1);
+            }
+        }
+        snprintf(name, sizeof(name), "%s/%d", k->name, counts[c]);
+        run.name = name;
+        mbenchRunKernel(&run, warmup, reps, fp);
+        mbench_pool_stop = 1;
+        pthread_barrier_wait(&mbench_start);
+        for (i = 0; i < mbench_pool_size; i++) pthread_join(mbench_pool[i], NULL);
+        pthread_barrier_destroy(&mbench_start);
+        pthread_barrier_destroy(&mbench_done);
+    }
+}
+
+static void mbenchUsage(void) {
+    size_t i;
+
+    fprintf(stderr, "Usage: rdb-microbench [-w warmup] [-r reps] [-c cpu] [-t threads] [-k kernels] [-o results]\n"
+            "\t-w warmup repetitions, after the batch is sized.\n\t\t\tDefault: 20\n"
+            "\t-r timed repetitions.\n\t\t\tDefault: 200\n"
+            "\t-c cpu to pin the process to.\n\t\t\tDefault: not pinned\n"
+            "\t-t thread counts zmalloc-mt runs with, comma separated, up to 32.\n\t\t\tDefault: 1,2,4,8,16,32\n"
+            "\t-o results file, tab separated.\n\t\t\tDefault: microbench.tsv\n"
+            "\t-k kernels, comma separated, of:");
+    for (i = 0; i < MBENCH_KERNELS; i++) fprintf(stderr, " %s", mbench_kernels[i].name);
+    fprintf(stderr, "\n\t\t\tDefault: all\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char *results = "microbench.tsv", *kernels = NULL, *threads = NULL, *tok;
+    int warmup = 20, reps = 200, cpu = -1, ch, selected[MBENCH_KERNELS];
+    int counts[MBENCH_THREADS] = {1, 2, 4, 8, 16, 32}, ncounts = 6;
+    cpu_set_t set;
+    size_t i;
+    FILE *fp;
+
+    for (i = 0; i < MBENCH_KERNELS; i++) selected[i] = 1;
+    while ((ch = getopt(argc, argv, "w:r:c:t:k:o:")) != -1) {
+        switch (ch) {
+            case 'w': warmup = atoi(optarg); break;
+            case 'r': if ((reps = atoi(optarg)) < 1) mbenchUsage(); break;
+            case 'c': cpu = atoi(optarg); break;
+            case 't': threads = optarg; break;
+            case 'k': kernels = optarg; break;
+            case 'o': results = optarg; break;
+            default: mbenchUsage();
+        }
+    }
+    if (kernels) {
+        for (i = 0; i < MBENCH_KERNELS; i++) selected[i] = 0;
+        for (tok = strtok(kernels, ","); tok; tok = strtok(NULL, ",")) {
+            for (i = 0; i < MBENCH_KERNELS && strcmp(tok, mbench_kernels[i].name) != 0; i++);
+            if (i == MBENCH_KERNELS) mbenchUsage();
+            selected[i] = 1;
+        }
+    }
+    if (threads) {
+        for (ncounts = 0, tok = strtok(threads, ","); tok; tok = strtok(NULL, ",")) {
+            if (ncounts == MBENCH_THREADS || (counts[ncounts] = atoi(tok)) < 1 ||
+                    counts[ncounts] > MBENCH_THREADS)
+                mbenchUsage();
+            ncounts++;
+        }
+    }
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+            fprintf(stderr, "pin to cpu %d err :%s\n", cpu, strerror(errno));
+            exit(1);
+        }
+    }
+    if ((fp = fopen(results, "w")) == NULL) {
+        fprintf(stderr, "open %s err :%s\n", results, strerror(errno));
+        exit(1);
+    }
+    fputs(MBENCH_HEADER, fp);
+    printf("crc64 engine: %s, %d repetitions%s\n", crc64_engine(), reps, cpu >= 0 ? ", pinned" : "");
+    printf("%-16s %10s %10s %10s %10s %10s %10s %10s\n", "kernel", "ops/rep", "ns min", "ns p50",
+            "ns p90", "ns p99", "ns max", "MB/s");
+    for (i = 0; i < MBENCH_KERNELS; i++) {
+        if (!selected[i]) continue;
+        if (mbench_kernels[i].run == mbenchZmallocThreads)
+            mbenchRunThreads(&mbench_kernels[i], counts, ncounts, warmup, reps, fp);
+        else
+            mbenchRunKernel(&mbench_kernels[i], warmup, reps, fp);
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "write %s err :%s\n", results, strerror(errno));
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * prefix, keyspace cost broken down by key prefix. See prefix.h.
+ *
+ * The children of a node are a sibling list, used to walk the trie, and
+ * every node is also in one open addressing table hashed by parent and
+ * segment, used to find a child in one probe however many siblings it has
+ * (think "user:" and its millions of ids). Slots keep the hash next to the
+ * node, so probing and growing the table don't have to touch the nodes. The
+ * table is rebuilt after a prune pass rather than deleted from.
+ */
+#include "prefix.h"
+#include "shard.h"
+#include "util.h"
+
+typedef struct prefixNode {
+    struct prefixNode *parent;
+    struct prefixNode *child;   /* first child */
+    struct prefixNode *next;    /* next sibling */
+    unsigned long long keys;
+    unsigned long long memory;
+    unsigned long long serialized;
+    unsigned long long expires;
+    unsigned long long types[TOTAL_DATA_TYPES];
+    uint32_t len;               /* of seg */
+    unsigned char depth;
+    unsigned char pruned;       /* children were folded into this node */
+    char seg[];                 /* the segment, delimiter included */
+} prefixNode;
+
+typedef struct {
+    uint64_t hash;
+    prefixNode *node;           /* NULL if the slot is free */
+} prefixSlot;
+
+struct prefixTrie {
+    char delimiter;
+    size_t budget;
+    size_t used;        /* bytes taken by the nodes and the table */
+    size_t nodes;       /* root aside */
+    prefixNode *root;
+    prefixSlot *table;  /* every node but the root */
+    size_t cap;         /* slots in table, a power of two */
+    unsigned long long threshold; /* leaves with this many keys or less get pruned */
+    int prunes;
+};
+
+#define PREFIX_MIN_TABLE 1024
+
+static uint64_t prefixHash(prefixNode *parent, const char *seg, size_t len) {
+    return shardHash64(seg, len, (uint64_t)(uintptr_t)parent);
+}
+
+/* Preorder successor of n, NULL after the last node. */
+static prefixNode *prefixNextNode(prefixNode *n) {
+    if (n->child) return n->child;
+    while (n) {
+        if (n->next) return n->next;
+        n = n->parent;
+    }
+    return NULL;
+}
+
+static void prefixTableAdd(prefixTrie *t, uint64_t hash, prefixNode *n) {
+    size_t i = hash & (t->cap - 1);
+
+    while (t->table[i].node) i = (i + 1) & (t->cap - 1);
+    t->table[i].hash = hash;
+    t->table[i].node = n;
+}
+
+/* Make a table of cap slots. The nodes are moved over from the old table,
+ * or found by walking the trie if that one holds pruned nodes. */
+static void prefixRehash(prefixTrie *t, size_t cap, int walk) {
+    prefixSlot *old = t->table;
+    prefixNode *n;
+    size_t oldcap = t->cap, i;
+
+    t->cap = cap;
+    t->table = zcalloc(cap * sizeof(prefixSlot));
+    t->used += cap * sizeof(prefixSlot);
+    t->used -= oldcap * sizeof(prefixSlot);
+    if (walk) {
+        for (n = prefixNextNode(t->root); n; n = prefixNextNode(n))
+            prefixTableAdd(t, prefixHash(n->parent, n->seg, n->len), n);
+    } else {
+        for (i = 0; i < oldcap; i++)
+            if (old[i].node) prefixTableAdd(t, old[i].hash, old[i].node);
+    }
+    zfree(old);
+}
+
+/* The child of parent called seg, created if there is none. */
+static prefixNode *prefixChild(prefixTrie *t, prefixNode *parent, const char *seg, size_t len) {
+    uint64_t hash = prefixHash(parent, seg, len);
+    size_t i = hash & (t->cap - 1);
+    prefixNode *n;
+
+    while ((n = t->table[i].node) != NULL) {
+        if (t->table[i].hash == hash && n->parent == parent && n->len == len &&
+                memcmp(n->seg, seg, len) == 0)
+            return n;
+        i = (i + 1) & (t->cap - 1);
+    }
+    n = zcalloc(sizeof(prefixNode) + len);
+    memcpy(n->seg, seg, len);
+    n->len = len;
+    n->depth = parent->depth + 1;
+    n->parent = parent;
+    n->next = parent->child;
+    parent->child = n;
+    t->table[i].hash = hash;
+    t->table[i].node = n;
+    t->nodes++;
+    t->used += sizeof(prefixNode) + len;
+    if (t->nodes * 2 > t->cap) prefixRehash(t, t->cap * 2, 0);
+    return n;
+}
+
+static void prefixCount(prefixNode *n, rdbKeyMemory *mem) {
+    n->keys++;
+    n->memory += mem->bytes;
+    n->serialized += mem->serialized;
+    if (mem->expiretime != -1) n->expires++;
+    if (mem->type >= 0 && mem->type < TOTAL_DATA_TYPES) n->types[mem->type]++;
+}
+
+/* Fold the leaves under n holding threshold keys or less into their
+ * parent, bottom up, so a parent left without children can go too. */
+static void prefixPruneNode(prefixTrie *t, prefixNode *n, unsigned long long threshold) {
+    prefixNode **link = &n->child, *c;
+
+    while ((c = *link) != NULL) {
+        prefixPruneNode(t, c, threshold);
+        if (c->child == NULL && c->keys <= threshold) {
+            *link = c->next;
+            n->pruned = 1;
+            t->nodes--;
+            t->used -= sizeof(prefixNode) + c->len;
+            zfree(c);
+        } else {
+            link = &c->next;
+        }
+    }
+}
+
+static void prefixPrune(prefixTrie *t) {
+    size_t cap;
+
+    while (1) {
+        prefixPruneNode(t, t->root, t->threshold);
+        t->prunes++;
+        for (cap = PREFIX_MIN_TABLE; cap < t->nodes * 2; cap *= 2);
+        prefixRehash(t, cap, 1);
+        if (t->used <= t->budget / 4 * 3 || t->nodes == 0) break;
+        t->threshold *= 2;
+    }
+}
+
+prefixTrie *prefixCreate(char delimiter, size_t budget) {
+    prefixTrie *t = zcalloc(sizeof(*t));
+
+    t->delimiter = delimiter;
+    t->budget = budget ? budget : PREFIX_BUDGET;
+    t->root = zcalloc(sizeof(prefixNode));
+    t->threshold = 1;
+    prefixRehash(t, PREFIX_MIN_TABLE, 0);
+    return t;
+}
+
+static void prefixFreeNode(prefixNode *n) {
+    prefixNode *c, *next;
+
+    for (c = n->child; c; c = next) {
+        next = c->next;
+        prefixFreeNode(c);
+    }
+    zfree(n);
+}
+
+void prefixFree(prefixTrie *t) {
+    prefixFreeNode(t->root);
+    zfree(t->table);
+    zfree(t);
+}
+
+void prefixAdd(prefixTrie *t, rdbStr *key, rdbKeyMemory *mem) {
+    prefixNode *n = t->root;
+    const char *p = key->ptr, *end = key->ptr + key->len, *d;
+
+    prefixCount(n, mem);
+    while (n->depth < PREFIX_MAX_DEPTH && (d = memchr(p, t->delimiter, end - p)) != NULL) {
+        n = prefixChild(t, n, p, d - p + 1);
+        prefixCount(n, mem);
+        p = d + 1;
+    }
+    if (t->used > t->budget) prefixPrune(t);
+}
+
+static int prefixCompareNodes(const void *a, const void *b) {
+    const prefixNode *x = *(const prefixNode **)a, *y = *(const prefixNode **)b;
+
+    if (x->memory == y->memory) return 0;
+    return x->memory < y->memory ? 1 : -1;
+}
+
+static sds prefixCatLongLong(sds s, unsigned long long value) {
+    char buf[32];
+
+    return sdscatlen(s, buf, ll2string(buf, sizeof(buf), (long long)value));
+}
+
+/* Write n, then its children biggest first. path holds the prefix of n,
+ * line is scratch space. */
+static int prefixWriteNode(prefixNode *n, FILE *fp, sds *path, sds *line) {
+    prefixNode **children, *c;
+    size_t count = 0, i, pathlen = sdslen(*path);
+    const char *p = *path, *end = *path + pathlen, *q;
+    int t, ret = 0;
+
+    sdsclear(*line);
+    *line = sdscatlen(*line, "\"", 1);
+    while ((q = memchr(p, '"', end - p)) != NULL) {
+        *line = sdscatlen(*line, (char *)p, q - p + 1);
+        *line = sdscatlen(*line, "\"", 1);
+        p = q + 1;
+    }
+    *line = sdscatlen(*line, (char *)p, end - p);
+    *line = sdscatlen(*line, "*\",", 3);
+    *line = prefixCatLongLong(*line, n->depth);
+    *line = sdscatlen(*line, ",", 1);
+    *line = prefixCatLongLong(*line, n->keys);
+    *line = sdscatlen(*line, ",", 1);
+    *line = prefixCatLongLong(*line, n->memory);
+    *line = sdscatlen(*line, ",", 1);
+    *line = prefixCatLongLong(*line, n->serialized);
+    *line = sdscatlen(*line, ",", 1);
+    *line = prefixCatLongLong(*line, n->expires);
+    for (t = 0; t < TOTAL_DATA_TYPES; t++) {
+        *line = sdscatlen(*line, ",", 1);
+        *line = prefixCatLongLong(*line, n->types[t]);
+    }
+    *line = sdscatlen(*line, n->pruned ? ",1\n" : ",0\n", 3);
+    if (fwrite(*line, 1, sdslen(*line), fp) != sdslen(*line)) return -1;
+
+    for (c = n->child; c; c = c->next) count++;
+    if (count == 0) return 0;
+    children = zmalloc(count * sizeof(prefixNode *));
+    for (c = n->child, i = 0; c; c = c->next) children[i++] = c;
+    qsort(children, count, sizeof(prefixNode *), prefixCompareNodes);
+    for (i = 0; i < count && ret == 0; i++) {
+        *path = sdscatlen(*path, children[i]->seg, children[i]->len);
+        ret = prefixWriteNode(children[i], fp, path, line);
+        sdsIncrLen(*path, -(int)children[i]->len);
+    }
+    zfree(children);
+    return ret;
+}
+
+int prefixWrite(prefixTrie *t, FILE *fp) {
+    sds path = sdsempty(), line = sdsempty();
+    int ret;
+
+    ret = prefixWriteNode(t->root, fp, &path, &line);
+    sdsfree(path);
+    sdsfree(line);
+    return ret;
+}
+
+void prefixStats(prefixTrie *t, size_t *nodes, size_t *bytes, int *prunes) {
+    *nodes = t->nodes;
+    *bytes = t->used;
+    *prunes = t->prunes;
+}
@@ -0,0 +1,49 @@
+/*
+ * prefix, keyspace cost broken down by key prefix.
+ *
+ * Keys are cut into segments at a delimiter, "user:123:profile" into
+ * "user:" and "123:" (what follows the last delimiter is the key's own
+ * name and is not kept), and folded into a trie of those segments. Every
+ * node adds up the keys below it: how many, their estimated memory and rdb
+ * bytes, how many have an expire time and how many of each type, so
+ * "user:*" answers for the whole namespace.
+ *
+ * Only prefixes are stored, never whole keys, and the trie is kept under a
+ * memory budget: when it goes over, leaves holding at most 'threshold' keys
+ * are folded into their parent, deepest first, the threshold doubling until
+ * the trie is back under three quarters of the budget. Totals are never
+ * lost, since a parent already counts its children; only the detail under
+ * the parent is, and the parent is marked as pruned.
+ */
+#ifndef __PREFIX_H_
+#define __PREFIX_H_
+#include "rdb_parser.h"
+
+/* default delimiter and budget */
+#define PREFIX_DELIMITER ':'
+#define PREFIX_BUDGET (256 * 1024 * 1024)
+
+/* segments past this depth are not split any further */
+#define PREFIX_MAX_DEPTH 64
+
+typedef struct prefixTrie prefixTrie;
+
+prefixTrie *prefixCreate(char delimiter, size_t budget);
+void prefixFree(prefixTrie *t);
+
+/* Fold one key in, as handed to a keyMemoryHandler. */
+void prefixAdd(prefixTrie *t, rdbStr *key, rdbKeyMemory *mem);
+
+/*
+ * Write the trie as csv, one line per prefix, children after their parent
+ * by decreasing memory:
+ * prefix,depth,keys,memory_bytes,rdb_bytes,expires,strings,lists,sets,zsets,hashes,pruned
+ * The root is "*", others "user:*", "user:123:*". Returns -1 on write error.
+ */
+#define PREFIX_CSV_HEADER "prefix,depth,keys,memory_bytes,rdb_bytes,expires,strings,lists,sets,zsets,hashes,pruned\n"
+int prefixWrite(prefixTrie *t, FILE *fp);
+
+/* Prefix nodes kept, bytes they take, and prune passes so far. */
+void prefixStats(prefixTrie *t, size_t *nodes, size_t *bytes, int *prunes);
+
+#endif
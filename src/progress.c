@@ -0,0 +1,246 @@
+/*
+ * progress, a meter of how far a long parse is. See progress.h.
+ */
+#include "progress.h"
+#include <pthread.h>
+#include <sys/resource.h>
+
+struct progressMeter {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;   /* signaled to stop the reporter */
+    progressState state;
+    sds name;
+
+    /* reporter */
+    pthread_t thread;
+    int reporting;
+    int stop;
+    double interval;
+    int print;
+    sds metrics;           /* NULL for none */
+    sds tmp;               /* written, then renamed to metrics */
+    long long start;       /* unix time of progressCreate() */
+    long long last_ns;     /* what the previous report saw */
+    long long last_bytes;
+    long long last_keys;
+};
+
+static long long progressNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Resident memory of the process, the peak if the current is unknown. */
+static long long progressRss(void) {
+    long long pages, rss;
+    struct rusage usage;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/self/statm", "r")) != NULL) {
+        rss = fscanf(fp, "%*s %lld", &pages) == 1 ? pages * sysconf(_SC_PAGESIZE) : -1;
+        fclose(fp);
+        if (rss != -1) return rss;
+    }
+    if (getrusage(RUSAGE_SELF, &usage) == -1) return 0;
+    return (long long)usage.ru_maxrss * 1024;
+}
+
+progressMeter *progressCreate(const char *name) {
+    progressMeter *m = zcalloc(sizeof(*m));
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    m->name = sdsnew(name);
+    m->start = time(NULL);
+    m->state.begin_ns = m->last_ns = progressNs();
+    return m;
+}
+
+void progressBegin(progressMeter *m, long long total) {
+    long long now = progressNs();
+
+    pthread_mutex_lock(&m->lock);
+    m->state.total = total;
+    m->state.bytes = m->state.keys = 0;
+    m->state.begin_ns = m->last_ns = now;
+    m->state.running = 1;
+    m->last_bytes = m->last_keys = 0;
+    pthread_mutex_unlock(&m->lock);
+}
+
+void progressEnd(progressMeter *m) {
+    pthread_mutex_lock(&m->lock);
+    m->state.running = 0;
+    pthread_mutex_unlock(&m->lock);
+}
+
+void progressAdd(progressMeter *m, long long bytes, long long keys) {
+    pthread_mutex_lock(&m->lock);
+    m->state.bytes += bytes;
+    m->state.keys += keys;
+    pthread_mutex_unlock(&m->lock);
+}
+
+void progressRead(progressMeter *m, progressState *state) {
+    pthread_mutex_lock(&m->lock);
+    *state = m->state;
+    pthread_mutex_unlock(&m->lock);
+}
+
+/* A label value, with \, " and newlines escaped. */
+static sds progressLabel(sds s, const char *value) {
+    for (; *value; value++) {
+        if (*value == '\\' || *value == '"') s = sdscatprintf(s, "\\%c", *value);
+        else if (*value == '\n') s = sdscat(s, "\\n");
+        else s = sdscatlen(s, (void *)value, 1);
+    }
+    return s;
+}
+
+static sds progressMetric(sds s, const char *name, const char *type, const char *help,
+        sds label, double value) {
+    return sdscatprintf(s, "# HELP %s %s\n# TYPE %s %s\n%s{file=\"%s\"} %.17g\n",
+            name, help, name, type, name, label, value);
+}
+
+static int progressWriteMetrics(progressMeter *m, progressState *st, double bytes_rate,
+        double keys_rate, double eta, long long rss) {
+    sds label = progressLabel(sdsempty(), m->name), s = sdsempty();
+    FILE *fp;
+    int ret = 0;
+
+    s = progressMetric(s, "rdbtools_input_bytes", "gauge", "Bytes of the rdb file, 0 if unknown.",
+            label, st->total);
+    s = progressMetric(s, "rdbtools_parsed_bytes", "gauge", "Bytes of the rdb file parsed so far.",
+            label, st->bytes);
+    s = progressMetric(s, "rdbtools_parsed_keys", "gauge", "Keys parsed so far.", label, st->keys);
+    s = progressMetric(s, "rdbtools_bytes_per_second", "gauge",
+            "Bytes parsed per second over the last interval.", label, bytes_rate);
+    s = progressMetric(s, "rdbtools_keys_per_second", "gauge",
+            "Keys parsed per second over the last interval.", label, keys_rate);
+    if (eta >= 0)
+        s = progressMetric(s, "rdbtools_eta_seconds", "gauge",
+                "Seconds left at the average rate since the start.", label, eta);
+    s = progressMetric(s, "rdbtools_resident_memory_bytes", "gauge",
+            "Resident memory of the process.", label, rss);
+    s = progressMetric(s, "rdbtools_running", "gauge", "1 while the parse goes on.",
+            label, st->running);
+    s = progressMetric(s, "rdbtools_start_timestamp_seconds", "gauge",
+            "Unix time the job started.", label, m->start);
+    s = progressMetric(s, "rdbtools_last_update_timestamp_seconds", "gauge",
+            "Unix time of this report.", label, time(NULL));
+    if ((fp = fopen(m->tmp, "w")) == NULL ||
+            fwrite(s, 1, sdslen(s), fp) != sdslen(s) ||
+            fclose(fp) != 0 || rename(m->tmp, m->metrics) == -1) {
+        fprintf(stderr, "write %s err :%s\n", m->metrics, strerror(errno));
+        ret = -1;
+    }
+    sdsfree(label);
+    sdsfree(s);
+    return ret;
+}
+
+/* One report, of what was added since the previous one. */
+static void progressOnce(progressMeter *m) {
+    progressState st;
+    long long now = progressNs(), rss = progressRss();
+    double seconds, elapsed, bytes_rate, keys_rate, eta = -1;
+    char left[32];
+
+    progressRead(m, &st);
+    if (m->last_ns < st.begin_ns) {
+        /* a pass began since the last report */
+        m->last_ns = st.begin_ns;
+        m->last_bytes = m->last_keys = 0;
+    }
+    seconds = (now - m->last_ns) / 1e9;
+    bytes_rate = seconds > 0 ? (st.bytes - m->last_bytes) / seconds : 0;
+    keys_rate = seconds > 0 ? (st.keys - m->last_keys) / seconds : 0;
+    elapsed = (now - st.begin_ns) / 1e9;
+    /* too early to tell under 0.1% */
+    if (st.total && st.bytes >= st.total / 1000 && st.running)
+        eta = (st.total > st.bytes ? st.total - st.bytes : 0) * elapsed / st.bytes;
+    else if (st.total && !st.running)
+        eta = 0;
+    m->last_ns = now;
+    m->last_bytes = st.bytes;
+    m->last_keys = st.keys;
+
+    if (m->print) {
+        if (eta >= 0)
+            snprintf(left, sizeof(left), "%lldh%02lldm%02llds", (long long)eta / 3600,
+                    (long long)eta / 60 % 60, (long long)eta % 60);
+        else
+            snprintf(left, sizeof(left), "unknown");
+        if (st.total)
+            fprintf(stderr, "progress %.1f%% %.2f of %.2f GB, ", 100.0 * st.bytes / st.total,
+                    st.bytes / 1073741824.0, st.total / 1073741824.0);
+        else
+            fprintf(stderr, "progress %.2f GB, ", st.bytes / 1073741824.0);
+        fprintf(stderr, "%.2f MB/s, %.0f keys/s, %lld keys, eta %s, rss %.1f MB%s\n",
+                bytes_rate / 1048576, keys_rate, st.keys, left, rss / 1048576.0,
+                st.running ? "" : ", done");
+    }
+    if (m->metrics) progressWriteMetrics(m, &st, bytes_rate, keys_rate, eta, rss);
+}
+
+static void *progressMain(void *arg) {
+    progressMeter *m = arg;
+    struct timespec ts;
+    long long until;
+
+    pthread_mutex_lock(&m->lock);
+    while (!m->stop) {
+        until = progressNs() + (long long)(m->interval * 1e9);
+        ts.tv_sec = until / 1000000000LL;
+        ts.tv_nsec = until % 1000000000LL;
+        while (!m->stop && pthread_cond_timedwait(&m->cond, &m->lock, &ts) == 0);
+        if (m->stop) break;
+        pthread_mutex_unlock(&m->lock);
+        progressOnce(m);
+        pthread_mutex_lock(&m->lock);
+    }
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+int progressReport(progressMeter *m, double interval, int print, const char *metrics) {
+    int err;
+
+    m->interval = interval > 0 ? interval : PROGRESS_INTERVAL;
+    m->print = print;
+    if (metrics) {
+        m->metrics = sdsnew(metrics);
+        m->tmp = sdscat(sdsnew(metrics), ".tmp");
+    }
+    if ((err = pthread_create(&m->thread, NULL, progressMain, m)) != 0) {
+        fprintf(stderr, "pthread_create err :%s\n", strerror(err));
+        return -1;
+    }
+    m->reporting = 1;
+    return 0;
+}
+
+void progressFree(progressMeter *m) {
+    if (!m) return;
+    if (m->reporting) {
+        pthread_mutex_lock(&m->lock);
+        m->stop = 1;
+        pthread_cond_signal(&m->cond);
+        pthread_mutex_unlock(&m->lock);
+        pthread_join(m->thread, NULL);
+        progressOnce(m);
+    }
+    pthread_mutex_destroy(&m->lock);
+    pthread_cond_destroy(&m->cond);
+    sdsfree(m->name);
+    sdsfree(m->metrics);
+    sdsfree(m->tmp);
+    zfree(m);
+}
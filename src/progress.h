@@ -0,0 +1,60 @@
+/*
+ * progress, a meter of how far a long parse is, and a thread reporting it.
+ *
+ * Whoever does the work (the parser, its workers, the rediscounter scan
+ * threads) adds the bytes and keys it got through to a progressMeter, from
+ * any thread and every thousand keys or so. A reporter thread started with
+ * progressReport() wakes up every interval and, from what was added since
+ * the last time:
+ *
+ * 1. prints a line to stderr: percent done, bytes/s and keys/s over the
+ *    interval, the keys so far, the ETA at the average rate since the start,
+ *    and the resident memory of the process;
+ * 2. rewrites a metrics file in the Prometheus text format, for the
+ *    node-exporter textfile collector. The file is written next to its name
+ *    and renamed over it, so the collector never reads half a file.
+ *    rdbtools_last_update_timestamp_seconds tells a stuck job from a slow
+ *    one, rdbtools_running goes to 0 once the parse is over.
+ *
+ * The last report is made when the meter is freed, with the final counts.
+ */
+#ifndef __PROGRESS_H_
+#define __PROGRESS_H_
+#include "main.h"
+
+/* seconds between reports when only a metrics file is asked for */
+#define PROGRESS_INTERVAL 10
+
+typedef struct progressMeter progressMeter;
+
+/* What a meter has counted, see progressRead(). */
+typedef struct {
+    long long total;   /* bytes of input, 0 if unknown */
+    long long bytes;   /* bytes of input got through */
+    long long keys;    /* keys got through, filtered ones included */
+    long long begin_ns; /* monotonic time of progressBegin() */
+    int running;       /* between progressBegin() and progressEnd() */
+} progressState;
+
+/* name labels the metrics, the file name of the input. */
+progressMeter *progressCreate(const char *name);
+
+/* Stop the reporter if there is one, report a last time, and free. */
+void progressFree(progressMeter *m);
+
+/*
+ * Report every interval seconds, on stderr if print is set, and to the
+ * metrics file if not NULL. -1 with a message on stderr if the thread can't
+ * be started.
+ */
+int progressReport(progressMeter *m, double interval, int print, const char *metrics);
+
+/* A pass over total bytes of input starts (0 if unknown), counts restart. */
+void progressBegin(progressMeter *m, long long total);
+void progressEnd(progressMeter *m);
+
+/* Thread safe. */
+void progressAdd(progressMeter *m, long long bytes, long long keys);
+void progressRead(progressMeter *m, progressState *state);
+
+#endif
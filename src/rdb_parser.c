@@ -12,103 +12,104 @@
  */
 #include "rdb_parser.h"
 #include "lzf.h"
-#include "crc64.c"
+#include "rio.h"
 #include "util.h"
+#include "resp.h"
+#include "fpconv.h"
+#include "shard.h"
+#include "memory.h"
+#include "progress.h"
 #include <stdlib.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/resource.h>
 
-int rdb_version;
-double R_Zero, R_PosInf, R_NegInf, R_Nan;
-static parserStats parser_stats;
-/* record check sum */
-static long long digest = 0;
+/* Switch the phase the time of p is charged to, see the phase clock. */
+static int rdbPhase(rdbParser *p, int phase);
 
-static size_t freadCheck(void *ptr, size_t size, size_t nmemb, FILE *stream)
-{
-    size_t len = fread(ptr, size, nmemb, stream);
-    digest = crc64(digest, (unsigned char*)ptr, size*len);
-    return len; 
+static int rdbLoadType(rio *rdb) {
+    unsigned char *p;
+    if ((p = rioNext(rdb,1)) == NULL) return -1;
+    return p[0];
 }
 
-static int rdbLoadType(FILE *fp) {
-    unsigned char type;
-    if (freadCheck(&type,1,1,fp) == 0) return -1;
-    return type;
-}
-
-static long long rdbLoadTime(FILE *fp) {
+static long long rdbLoadTime(rio *rdb, int rdb_version) {
     if (rdb_version < 5) {
         int32_t t32;
-        if (freadCheck(&t32,4,1,fp) == 0) return -1;
+        if (rioRead(rdb,&t32,4) == 0) return -1;
         return (long long) t32;
     } else {
         int64_t t64;
-        if (freadCheck(&t64,8,1,fp) == 0) return -1;
+        if (rioRead(rdb,&t64,8) == 0) return -1;
         return (long long) t64;
     }
 }
 
 /* For information about double serialization check rdbSaveDoubleValue() */
-static int rdbLoadDoubleValue(FILE *fp, double *val) {
-    char buf[256];
+static int rdbLoadDoubleValue(rio *rdb, double *val) {
+    unsigned char *p;
     unsigned char len;
 
-    if (freadCheck(&len,1,1,fp) == 0) return -1;
+    if ((p = rioNext(rdb,1)) == NULL) return -1;
+    len = p[0];
     switch(len) {
-        case 255: *val = R_NegInf; return 0;
-        case 254: *val = R_PosInf; return 0;
-        case 253: *val = R_Nan; return 0;
+        case 255: *val = -INFINITY; return 0;
+        case 254: *val = INFINITY; return 0;
+        case 253: *val = NAN; return 0;
         default:
-                  if (freadCheck(buf,len,1,fp) == 0) return -1;
-                  buf[len] = '\0';
-                  sscanf(buf, "%lg", val);
+                  /* parsed in place, no copy to terminate it */
+                  if ((p = rioNext(rdb,len)) == NULL) return -1;
+                  if (!fpconv_strtod((char *)p, len, val)) *val = 0;
                   return 0;
     }
 }
 
-static uint32_t rdbLoadLen(FILE *fp, int *isencoded) {
-    unsigned char buf[2];
+uint32_t rdbLoadLen(rio *rdb, int *isencoded) {
+    unsigned char *p;
+    unsigned char b0;
     uint32_t len;
     int type;
 
     if (isencoded) *isencoded = 0;
-    if (freadCheck(buf,1,1,fp) == 0) return REDIS_RDB_LENERR;
-    type = (buf[0]&0xC0)>>6;
+    if ((p = rioNext(rdb,1)) == NULL) return REDIS_RDB_LENERR;
+    b0 = p[0];
+    type = (b0&0xC0)>>6;
     if (type == REDIS_RDB_6BITLEN) {
         /* Read a 6 bit len */
-        return buf[0]&0x3F;
+        return b0&0x3F;
     } else if (type == REDIS_RDB_ENCVAL) {
         /* Read a 6 bit len encoding type */
         if (isencoded) *isencoded = 1;
-        return buf[0]&0x3F;
+        return b0&0x3F;
     } else if (type == REDIS_RDB_14BITLEN) {
         /* Read a 14 bit len */
-        if (freadCheck(buf+1,1,1,fp) == 0) return REDIS_RDB_LENERR;
-        return ((buf[0]&0x3F)<<8)|buf[1];
+        if ((p = rioNext(rdb,1)) == NULL) return REDIS_RDB_LENERR;
+        return ((b0&0x3F)<<8)|p[0];
     } else {
         /* Read a 32 bit len */
-        if (freadCheck(&len,4,1,fp) == 0) return REDIS_RDB_LENERR;
+        if (rioRead(rdb,&len,4) == 0) return REDIS_RDB_LENERR;
         return ntohl(len);
     }
 }
 
-static sds rdbLoadIntegerObject(FILE *fp, int enctype, int encode) {
-    unsigned char enc[4];
+static sds rdbLoadIntegerObject(rio *rdb, int enctype, int encode) {
+    unsigned char *enc;
     long long val;
 
     encode = -1; /* unsed */
     if (enctype == REDIS_RDB_ENC_INT8) {
-        if (freadCheck(enc,1,1,fp) == 0) return NULL;
+        if ((enc = rioNext(rdb,1)) == NULL) return NULL;
         val = (signed char)enc[0];
     } else if (enctype == REDIS_RDB_ENC_INT16) {
         uint16_t v;
-        if (freadCheck(enc,2,1,fp) == 0) return NULL;
+        if ((enc = rioNext(rdb,2)) == NULL) return NULL;
         v = enc[0]|(enc[1]<<8);
         val = (int16_t)v;
     } else if (enctype == REDIS_RDB_ENC_INT32) {
         uint32_t v;
-        if (freadCheck(enc,4,1,fp) == 0) return NULL;
-        v = enc[0]|(enc[1]<<8)|(enc[2]<<16)|(enc[3]<<24);
+        if ((enc = rioNext(rdb,4)) == NULL) return NULL;
+        v = (uint32_t)enc[0]|((uint32_t)enc[1]<<8)|((uint32_t)enc[2]<<16)|((uint32_t)enc[3]<<24);
         val = (int32_t)v;
     } else {
         val = 0; /* anti-warning */
@@ -117,59 +118,59 @@ static sds rdbLoadIntegerObject(FILE *fp, int enctype, int encode) {
     return sdsfromlonglong(val);
 }
 
-static sds rdbLoadLzfStringObject(FILE*fp) {
-    unsigned int len, clen;
-    unsigned char *c = NULL;
+/* The compressed bytes are decompressed straight out of the input window,
+ * no intermediate copy is needed. The sds loaders below charge their time
+ * to the clock of p, which may be NULL. */
+static sds rdbLoadLzfStringObject(rio *rdb, rdbParser *p) {
+    unsigned int len, clen, ok;
+    unsigned char *c;
     sds val = NULL;
+    int phase;
 
-    if ((clen = rdbLoadLen(fp,NULL)) == REDIS_RDB_LENERR) return NULL;
-    if ((len = rdbLoadLen(fp,NULL)) == REDIS_RDB_LENERR) return NULL;
-    if ((c = zmalloc(clen)) == NULL) goto err;
-    if ((val = sdsnewlen(NULL,len)) == NULL) goto err;
-    if (freadCheck(c,clen,1,fp) == 0) goto err;
-    if (lzf_decompress(c,clen,val,len) == 0) goto err;
-    zfree(c);
+    if ((clen = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
+    if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
+    if ((c = rioNext(rdb,clen)) == NULL) return NULL;
+    if ((val = sdsnewlen(NULL,len)) == NULL) return NULL;
+    phase = rdbPhase(p, RDB_PHASE_LZF);
+    ok = lzf_decompress(c,clen,val,len);
+    rdbPhase(p, phase);
+    if (ok == 0) goto err;
     return val;
 err:
-    zfree(c);
     sdsfree(val);
     return NULL;
 }
 
-static sds rdbGenericLoadStringObject(FILE*fp, int encode) {
+static sds rdbGenericLoadStringObject(rio *rdb, int encode, rdbParser *p) {
     int isencoded;
     uint32_t len; 
-    sds val; 
+    unsigned char *buf;
 
-    len = rdbLoadLen(fp,&isencoded);
+    len = rdbLoadLen(rdb,&isencoded);
     if (isencoded) {
         switch(len) {
             case REDIS_RDB_ENC_INT8:
             case REDIS_RDB_ENC_INT16:
             case REDIS_RDB_ENC_INT32:
-                return rdbLoadIntegerObject(fp,len,encode);
+                return rdbLoadIntegerObject(rdb,len,encode);
             case REDIS_RDB_ENC_LZF:
-                return rdbLoadLzfStringObject(fp);
+                return rdbLoadLzfStringObject(rdb,p);
             default:
                 parsePanic("Unknown RDB encoding type");
         }    
     }    
 
     if (len == REDIS_RDB_LENERR) return NULL;
-    val = sdsnewlen(NULL,len);
-    if (len && freadCheck(val,len,1,fp) == 0) { 
-        sdsfree(val);
-        return NULL;
-    }    
-    return val; 
+    if ((buf = rioNext(rdb,len)) == NULL) return NULL;
+    return sdsnewlen(buf,len); 
 }
 
-static sds rdbLoadEncodedStringObject(FILE *fp) {
-    return rdbGenericLoadStringObject(fp,1);
+static sds rdbLoadEncodedStringObject(rio *rdb, rdbParser *p) {
+    return rdbGenericLoadStringObject(rdb,1,p);
 }
 
-static sds rdbLoadStringObject(FILE *fp) {
-    return rdbGenericLoadStringObject(fp,0);
+static sds rdbLoadStringObject(rio *rdb, rdbParser *p) {
+    return rdbGenericLoadStringObject(rdb,0,p);
 }
 
 /* load value which hash encoding with zipmap. */
@@ -238,11 +239,7 @@ static void *loadZsetZiplistObject(unsigned char* zl, unsigned int *rlen) {
     len = ziplistLen (zl);
     eptr = ziplistIndex(zl,0);
     sptr = ziplistNext(zl,eptr);
-    if(rdb_version < 2) {
-        *rlen = len * 2;
-    } else {
-        *rlen = len;
-    }
+    *rlen = len;
     sds *results = zmalloc(*rlen * sizeof(sds));
     while (eptr != NULL) {
         score = zzlGetScore(sptr);
@@ -252,7 +249,7 @@ static void *loadZsetZiplistObject(unsigned char* zl, unsigned int *rlen) {
         else
             ele = sdsnewlen((char*)vstr,vlen);
         results[i] = ele;
-        buf_len = snprintf(buf, 128, "%f", score);
+        buf_len = fpconv_dtoa(score, buf);
         results[i+1] = sdsnewlen(buf, buf_len);
         i += 2;
         zzlNext(zl,&eptr,&sptr);
@@ -261,63 +258,55 @@ static void *loadZsetZiplistObject(unsigned char* zl, unsigned int *rlen) {
     return results;
 }
 
-static void* rdbLoadValueObject(FILE *fp, int type, unsigned int *rlen) {
+static void* rdbLoadValueObject(rio *rdb, int type, unsigned int *rlen, rdbParser *p) {
     unsigned int i, j, len;
-    int buf_len;
+    int buf_len, phase;
     sds ele;
     sds *results = NULL;
     char buf[128];
 
     if(type == REDIS_STRING) {
         /* value type is string. */
-        parser_stats.parse_num[STRING] += 1;
-        ele = rdbLoadEncodedStringObject(fp);
+        if ((ele = rdbLoadEncodedStringObject(rdb,p)) == NULL) return NULL;
         *rlen = sdslen(ele);
         return ele;
 
     } else if(type == REDIS_LIST) {
         /* value type is list. */
-        parser_stats.parse_num[LIST] += 1;
-        if ((len = rdbLoadLen(fp,NULL)) == REDIS_RDB_LENERR) return NULL;
+        if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
         j = 0;
         *rlen = len;
         results = zmalloc(len * sizeof(*results));
         while(len--) {
-            if ((ele = rdbLoadEncodedStringObject(fp)) == NULL) return NULL;
+            if ((ele = rdbLoadEncodedStringObject(rdb,p)) == NULL) return NULL;
             results[j++] = ele;
         }
         return results;
 
     } else if(type == REDIS_SET) {
         /* value type is set. */
-        parser_stats.parse_num[SET] += 1;
-        if ((len = rdbLoadLen(fp,NULL)) == REDIS_RDB_LENERR) return NULL;
+        if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
         *rlen = len;
         results = zmalloc(len * sizeof(*results));
         for (i = 0; i < len; i++) {
-            if ((ele = rdbLoadEncodedStringObject(fp)) == NULL) return NULL;
+            if ((ele = rdbLoadEncodedStringObject(rdb,p)) == NULL) return NULL;
             results[i] = ele; 
         }
         return results;
 
     } else if (type == REDIS_ZSET) {
         /* value type is zset */
-        parser_stats.parse_num[ZSET] += 1;
         size_t zsetlen;
         double score;
         j = 0;    
-        if ((zsetlen = rdbLoadLen(fp,NULL)) == REDIS_RDB_LENERR) return NULL;
+        if ((zsetlen = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
 
-        if(rdb_version < 2) {
-            *rlen = zsetlen * 2;
-        } else {
-            *rlen = zsetlen;
-        }
+        *rlen = zsetlen * 2;
         results = zmalloc( *rlen * sizeof(*results));
         while(zsetlen--) {
-            if ((ele = rdbLoadEncodedStringObject(fp)) == NULL) return NULL;
-            if (rdbLoadDoubleValue(fp,&score) == -1) return NULL;
-            buf_len = snprintf(buf, 128, "%f", score);
+            if ((ele = rdbLoadEncodedStringObject(rdb,p)) == NULL) return NULL;
+            if (rdbLoadDoubleValue(rdb,&score) == -1) return NULL;
+            buf_len = fpconv_dtoa(score, buf);
             results[j] = ele;
             results[j+1] = sdsnewlen(buf, buf_len);
             j += 2;
@@ -326,16 +315,15 @@ static void* rdbLoadValueObject(FILE *fp, int type, unsigned int *rlen) {
 
     } else if (type == REDIS_HASH) {
         /* value type is hash */
-        parser_stats.parse_num[HASH] += 1;
         size_t hashlen;
-        if ((hashlen = rdbLoadLen(fp,NULL)) == REDIS_RDB_LENERR) return NULL;
+        if ((hashlen = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
         sds key, val;
         j = 0;
         *rlen = hashlen * 2;
         results = zmalloc(*rlen * sizeof(*results));
         while(hashlen--) {
-            if ((key = rdbLoadEncodedStringObject(fp)) == NULL) return NULL;
-            if ((val = rdbLoadEncodedStringObject(fp)) == NULL) return NULL;
+            if ((key = rdbLoadEncodedStringObject(rdb,p)) == NULL) return NULL;
+            if ((val = rdbLoadEncodedStringObject(rdb,p)) == NULL) return NULL;
             results[j] = key;
             results[j + 1] = val;
             j += 2;
@@ -347,25 +335,23 @@ static void* rdbLoadValueObject(FILE *fp, int type, unsigned int *rlen) {
             type == REDIS_SET_INTSET ||
             type == REDIS_ZSET_ZIPLIST ||
             type == REDIS_LSET) {
-        sds aux = rdbLoadStringObject(fp); 
+        sds aux = rdbLoadStringObject(rdb,p); 
+        phase = rdbPhase(p, RDB_PHASE_EXPAND);
         switch(type) {
             case REDIS_HASH_ZIPMAP:
-                parser_stats.parse_num[HASH] += 1;
                 results = loadHashZipMapObject((unsigned char*)aux, rlen);
                 break;
             case REDIS_LIST_ZIPLIST:
-                parser_stats.parse_num[LIST] += 1;
                 results = loadListZiplistObject((unsigned char *)aux, rlen);
                 break;
             case REDIS_SET_INTSET:
-                parser_stats.parse_num[SET] += 1;
                 results = loadSetIntsetObject((unsigned char *)aux, rlen);
                 break;
             case REDIS_ZSET_ZIPLIST:
-                parser_stats.parse_num[ZSET] += 1;
                 results = loadZsetZiplistObject((unsigned char *)aux, rlen);
                 break;
         }
+        rdbPhase(p, phase);
         sdsfree(aux);
         return results;
     } else {
@@ -373,189 +359,1943 @@ static void* rdbLoadValueObject(FILE *fp, int type, unsigned int *rlen) {
     }
 }
 
-static void startParse(FILE *fp) {
+
+/*-----------------------------------------------------------------------------
+ * Skipping: step over a value using its lengths only, nothing is decoded or
+ * decompressed. Used to find key boundaries cheaply.
+ *----------------------------------------------------------------------------*/
+
+static int rdbSkipStringObject(rio *rdb) {
+    int isencoded;
+    uint32_t len;
+
+    len = rdbLoadLen(rdb,&isencoded);
+    if (isencoded) {
+        switch(len) {
+            case REDIS_RDB_ENC_INT8: return rioSkip(rdb,1) ? PARSE_OK : PARSE_ERR;
+            case REDIS_RDB_ENC_INT16: return rioSkip(rdb,2) ? PARSE_OK : PARSE_ERR;
+            case REDIS_RDB_ENC_INT32: return rioSkip(rdb,4) ? PARSE_OK : PARSE_ERR;
+            case REDIS_RDB_ENC_LZF:
+                if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return PARSE_ERR;
+                if (rdbLoadLen(rdb,NULL) == REDIS_RDB_LENERR) return PARSE_ERR;
+                break;
+            default:
+                parsePanic("Unknown RDB encoding type");
+        }
+    }
+    if (len == REDIS_RDB_LENERR) return PARSE_ERR;
+    return rioSkip(rdb,len) ? PARSE_OK : PARSE_ERR;
+}
+
+static int rdbSkipDoubleValue(rio *rdb) {
+    unsigned char *p;
+
+    if ((p = rioNext(rdb,1)) == NULL) return PARSE_ERR;
+    if (p[0] >= 253) return PARSE_OK; /* -inf, +inf, nan */
+    return rioSkip(rdb,p[0]) ? PARSE_OK : PARSE_ERR;
+}
+
+static int rdbSkipValueObject(rio *rdb, int type) {
+    uint32_t len;
+
+    if (type == REDIS_STRING ||
+            type == REDIS_HASH_ZIPMAP ||
+            type == REDIS_LIST_ZIPLIST ||
+            type == REDIS_SET_INTSET ||
+            type == REDIS_ZSET_ZIPLIST ||
+            type == REDIS_LSET) {
+        return rdbSkipStringObject(rdb);
+    }
+    if (type != REDIS_LIST && type != REDIS_SET &&
+            type != REDIS_ZSET && type != REDIS_HASH) {
+        parsePanic("Unknown object type");
+    }
+    if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return PARSE_ERR;
+    while(len--) {
+        if (rdbSkipStringObject(rdb) == PARSE_ERR) return PARSE_ERR;
+        if (type == REDIS_ZSET && rdbSkipDoubleValue(rdb) == PARSE_ERR) return PARSE_ERR;
+        if (type == REDIS_HASH && rdbSkipStringObject(rdb) == PARSE_ERR) return PARSE_ERR;
+    }
+    return PARSE_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * Key filter. Type, db and expire time are checked before the key is even
+ * read, patterns right after it, and values of keys that don't match are
+ * skipped without being decoded.
+ *----------------------------------------------------------------------------*/
+
+typedef struct {
+    sds str;
+    int prefix; /* str is a literal prefix, not a glob pattern */
+} rdbPattern;
+
+struct rdbFilter {
+    rdbPattern *patterns; /* a key has to match one of them, if there are any */
+    int npatterns;
+    int types;            /* mask of 1<<type, 0 for any type */
+    uint32_t *dbs;        /* db ids to keep, all if ndbs is 0 */
+    int ndbs;
+    int expire_range;     /* set if expire_min/max apply */
+    time_t expire_min;
+    time_t expire_max;
+};
+
+static rdbFilter *rdbFilterCreate(void) {
+    return zcalloc(sizeof(rdbFilter));
+}
+
+static void rdbFilterFree(rdbFilter *f) {
     int i;
-    struct stat sb;
-    parser_stats.start_time = time(NULL);
-    parser_stats.parsed_bytes = 0;
-    if (fstat(fileno(fp), &sb) == -1) {
-        parser_stats.total_bytes = 1;
-    } else {
-        parser_stats.total_bytes = sb.st_size;
+
+    if(!f) return;
+    for(i = 0; i < f->npatterns; i++) {
+        sdsfree(f->patterns[i].str);
     }
-    for(i = 0; i < TOTAL_DATA_TYPES; i++) {
-        parser_stats.parse_num[i] = 0;
+    zfree(f->patterns);
+    zfree(f->dbs);
+    zfree(f);
+}
+
+static void rdbFilterAddPattern(rdbFilter *f, const char *str, int prefix) {
+    f->patterns = zrealloc(f->patterns, (f->npatterns + 1) * sizeof(rdbPattern));
+    f->patterns[f->npatterns].str = sdsnew(str);
+    f->patterns[f->npatterns].prefix = prefix;
+    f->npatterns++;
+}
+
+/* Everything that can be checked before the key is loaded. */
+/* expiretime is in ms, whatever the rdb version. */
+static int rdbFilterMatchMeta(rdbFilter *f, int type, uint32_t dbid, time_t expiretime) {
+    int i;
+
+    if(f->types && (type >= TOTAL_DATA_TYPES || !(f->types & (1 << type)))) return 0;
+    if(f->expire_range && (expiretime < f->expire_min || expiretime > f->expire_max)) return 0;
+    if(f->ndbs) {
+        for(i = 0; i < f->ndbs; i++) {
+            if(f->dbs[i] == dbid) break;
+        }
+        if(i == f->ndbs) return 0;
     }
+    return 1;
 }
 
-void parseProgress(off_t pos) {
-    parser_stats.parsed_bytes = pos;
+static int rdbFilterMatchKey(rdbFilter *f, rdbStr *key) {
+    rdbPattern *pat;
+    int i;
+
+    for(i = 0; i < f->npatterns; i++) {
+        pat = f->patterns + i;
+        if(pat->prefix) {
+            if(key->len >= sdslen(pat->str) && memcmp(key->ptr, pat->str, sdslen(pat->str)) == 0)
+                return 1;
+        } else if(stringmatchlen(pat->str, sdslen(pat->str), key->ptr, key->len, 0)) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-int     rdbParse(char *rdbFile, keyValueHandler handler, int aof_number, char *aof_filename, int dump_aof, format_kv_handler format_handler) {
-    int type, loops = 0, dbid, valType;
-    unsigned int rlen;
-    char buf[2048];
-    time_t expiretime = -1;
-    FILE *fp;
-    sds key, sval; /* sval is simple string value.*/
-    sds *cval; /*complicatae value*/
-    Aof * aof_set  = NULL;/* Aof module.*/
-    /* Double constants initialization */
-    sds kv_temp = NULL;
-    int kv_hashed_key;
-    R_Zero = 0.0;
-    R_PosInf = 1.0/R_Zero;
-    R_NegInf = -1.0/R_Zero;
-    R_Nan = R_Zero/R_Zero;
+/*-----------------------------------------------------------------------------
+ * Parser context. Everything one pass over the input needs lives here rather
+ * than in globals, so several parsers (one per file, or the workers of a
+ * parallel parse) can run at once.
+ *----------------------------------------------------------------------------*/
 
-    if((fp = fopen(rdbFile, "r")) == NULL) {
-        return PARSE_ERR;
+#define RDB_VIEW_INPUT 0 /* off is a file offset */
+#define RDB_VIEW_BLOB 1  /* off is an offset in the blobs scratch */
+#define RDB_VIEW_NUM 2   /* off is an offset in the nums scratch */
+#define RDB_VIEW_DOUBLE 3 /* a native score, in num */
+
+typedef struct {
+    off_t off;
+    size_t len;
+    int where;
+    double num;
+} rdbView;
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} rdbScratch;
+
+/* A decoded key, in the form keyValueHandler takes it. */
+typedef struct {
+    int type;
+    sds key;
+    void *val; /* sds for STRING, sds array of vlen elements otherwise */
+    unsigned int vlen;
+    time_t expiretime;
+    uint32_t dbid;
+} rdbPair;
+
+typedef struct {
+    rdbPair *pairs;
+    size_t count;
+    size_t cap;
+} rdbPairs;
+
+struct rdbParser {
+    char *filename;
+    rio rdb;
+    int rdb_version;
+    off_t chunk_end;  /* stop at this offset instead of the EOF opcode, -1 if none */
+    uint32_t dbid;    /* currently selected db */
+    int checksum;     /* fold the input into the crc64 as we go */
+    parserStats stats;
+    rdbFilter *filter; /* NULL to keep every key */
+
+    /* view mode */
+    rdbView *views;
+    rdbStr *strs;
+    size_t count;
+    size_t cap;
+    rdbScratch blobs; /* decompressed LZF strings */
+    rdbScratch nums;  /* formatted integers and scores */
+    int native_scores; /* hand zset scores over as doubles, not text */
+
+    keyValueHandler *handler;
+    keyValueViewHandler *view_handler;
+    format_kv_handler *format_handler;
+
+    /* scan mode */
+    keyScanHandler *scan_handler;
+    int scan_flags;
+
+    /* memory mode */
+    keyMemoryHandler *memory_handler;
+
+    /* streaming mode */
+    rdbStreamHandler *stream;
+    sds *batch;                /* elements not handed to stream->elements() yet */
+    unsigned int batch_count;
+    unsigned int batch_size;
+
+    Aof *aof_set;
+    int aof_number;
+    int dump_aof;
+    size_t aof_buffer;         /* per file aof buffer size, 0 for the default */
+    int aof_writers;           /* aof writer threads, 0 for the default */
+    int aof_format;            /* RDB_AOF_TEXT or RDB_AOF_RESP */
+    unsigned int aof_batch;    /* items per RESP command, 0 for the default */
+    shardFunc *shard;          /* aof file of a RESP key, NULL for shardByCrc64 */
+    sds aof_scratch;           /* RESP output of the key being emitted */
+    pthread_mutex_t *aof_lock; /* taken around add_aof, NULL if single threaded */
+    rdbPairs *pending;         /* if set, decoded pairs are queued here instead of emitted */
+
+    /* phase clock */
+    int timing;                /* time the phases of the next parses */
+    int clocked;               /* the clock is running */
+    int phase;                 /* phase the time is charged to */
+    long long phase_start;     /* when it became the phase */
+    int (*fill)(rio *r, size_t need); /* fill of the input, wrapped to time it */
+    long long start_ns;
+    size_t start_allocations;
+    long start_faults;
+
+    progressMeter *progress;   /* NULL if nobody watches */
+    off_t progress_off;        /* input offset last added to progress */
+    long long progress_keys;   /* keys last added to progress */
+};
+
+/* Get p ready for a new pass, only the file name, filter, aof and score
+ * settings are kept. */
+static void rdbParserReset(rdbParser *p) {
+    char *filename = p->filename;
+    rdbFilter *filter = p->filter;
+    size_t aof_buffer = p->aof_buffer;
+    int aof_writers = p->aof_writers;
+    int aof_format = p->aof_format;
+    unsigned int aof_batch = p->aof_batch;
+    int native_scores = p->native_scores;
+    shardFunc *shard = p->shard;
+    int timing = p->timing;
+    progressMeter *progress = p->progress;
+
+    free(p->stats.shards);
+    sdsfree(p->stats.largest_key);
+    memset(p, 0, sizeof(*p));
+    p->filename = filename;
+    p->filter = filter;
+    p->aof_buffer = aof_buffer;
+    p->aof_writers = aof_writers;
+    p->aof_format = aof_format;
+    p->aof_batch = aof_batch;
+    p->native_scores = native_scores;
+    p->shard = shard;
+    p->timing = timing;
+    p->progress = progress;
+    p->chunk_end = -1;
+    p->checksum = 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Phase clock. While it runs, time is charged to the current phase, and the
+ * calls making up another phase switch to it and back, so a phase nested in
+ * another is only charged once. Decoding is the phase outside of those
+ * calls. Reading the input is timed by wrapping the fill() of the rio.
+ *----------------------------------------------------------------------------*/
+
+static long long rdbNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Charge the time since the last switch to the current phase and make phase
+ * the current one. Return the phase to switch back to. */
+static int rdbPhase(rdbParser *p, int phase) {
+    long long now;
+    int prev;
+
+    if (!p || !p->clocked) return RDB_PHASE_DECODE;
+    now = rdbNs();
+    prev = p->phase;
+    p->stats.phase_ns[prev] += now - p->phase_start;
+    p->phase_start = now;
+    p->phase = phase;
+    return prev;
+}
+
+static int rdbTimedFill(rio *r, size_t need) {
+    rdbParser *p = (rdbParser *)((char *)r - offsetof(rdbParser, rdb));
+    int phase = rdbPhase(p, RDB_PHASE_IO);
+    int ret = p->fill(r, need);
+
+    rdbPhase(p, phase);
+    return ret;
+}
+
+static void rdbClockStart(rdbParser *p) {
+    if (!p->timing) return;
+    /* a memory rio has nothing to wait for */
+    if (p->rdb.fill && p->rdb.fd != -1 && p->rdb.fill != rdbTimedFill) {
+        p->fill = p->rdb.fill;
+        p->rdb.fill = rdbTimedFill;
     }
+    p->phase = RDB_PHASE_DECODE;
+    p->phase_start = rdbNs();
+    p->clocked = 1;
+}
 
-    if (freadCheck(buf, 9, 1, fp) == 0) {
-        fclose(fp);
-        fprintf(stderr, "fread err :%s\n", strerror(errno));
-        return PARSE_ERR;
+static void rdbClockStop(rdbParser *p) {
+    rdbPhase(p, RDB_PHASE_DECODE);
+    p->clocked = 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * View mode: strings are handed to the handler as (ptr,len) views instead of
+ * sds copies. Raw strings point into the input window, LZF payloads are
+ * decompressed into one reusable scratch buffer and integers are formatted
+ * into another one. Both the window and the scratch buffers can move while a
+ * key is decoded, so views are recorded as offsets and only turned into
+ * pointers right before the handler is called.
+ *----------------------------------------------------------------------------*/
+
+/* Make room for 'len' more bytes, return the offset they start at. */
+static size_t scratchReserve(rdbScratch *sc, size_t len) {
+    if (sc->len + len > sc->cap) {
+        sc->cap = (sc->len + len) * 2;
+        sc->buf = zrealloc(sc->buf, sc->cap);
     }
-    if(buf[8] != 'c')
-        return -1;
-    buf[9] = '\0';
-    if (memcmp(buf, "REDIS", 5) != 0) {
-        fclose(fp);
-        fprintf(stderr, "Wrong signature trying to load DB from file\n");
-        return PARSE_ERR;
+    return sc->len;
+}
+
+static rdbView *viewNew(rdbParser *p) {
+    if (p->count == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 64;
+        p->views = zrealloc(p->views, p->cap * sizeof(rdbView));
+        p->strs = zrealloc(p->strs, p->cap * sizeof(rdbStr));
     }
-    rdb_version = atoi(buf+5);
-    if (rdb_version > 6) {
-        fclose(fp);
-        fprintf(stderr, "Can't handle RDB format version %d\n", rdb_version);
-        return PARSE_ERR;
+    return p->views + p->count++;
+}
+
+static void viewsReset(rdbParser *p) {
+    p->count = 0;
+    p->blobs.len = 0;
+    p->nums.len = 0;
+}
+
+static void viewsFree(rdbParser *p) {
+    zfree(p->views);
+    zfree(p->strs);
+    zfree(p->blobs.buf);
+    zfree(p->nums.buf);
+    p->views = NULL;
+    p->strs = NULL;
+    p->count = p->cap = 0;
+    memset(&p->blobs, 0, sizeof(p->blobs));
+    memset(&p->nums, 0, sizeof(p->nums));
+}
+
+static void viewAddLongLong(rdbParser *p, long long value) {
+    rdbView *v = viewNew(p);
+    v->off = scratchReserve(&p->nums, 32);
+    v->len = ll2string(p->nums.buf + v->off, 32, value);
+    v->where = RDB_VIEW_NUM;
+    p->nums.len += v->len;
+}
+
+static void viewAddDouble(rdbParser *p, double value) {
+    rdbView *v = viewNew(p);
+    int n;
+
+    if (p->native_scores) {
+        v->off = 0;
+        v->len = 0;
+        v->where = RDB_VIEW_DOUBLE;
+        v->num = value;
+        return;
     }
+    v->off = scratchReserve(&p->nums, FPCONV_DTOA_MAX);
+    n = fpconv_dtoa(value, p->nums.buf + v->off);
+    v->len = n;
+    v->where = RDB_VIEW_NUM;
+    p->nums.len += n;
+}
 
-    int len = 0;
-    if(freadCheck(&len ,sizeof(len), 1, fp) == 0)
-        return PARSE_ERR;
-    if(len >= 2048) return -1;
-    if(freadCheck(buf ,len, 1, fp) == 0)
-        return PARSE_ERR;
-    buf[len] = '\0';
-    aof_set = set_aofs(aof_number, aof_filename);
-    if(!aof_set){
-        fprintf(stderr, "aof_set failed\n");
+/* Copy an input view to the blobs scratch, so the input it was on can be
+ * unmarked. */
+static void viewDetach(rdbParser *p, rdbView *v) {
+    size_t off;
+
+    if (v->where != RDB_VIEW_INPUT) return;
+    off = scratchReserve(&p->blobs, v->len);
+    memcpy(p->blobs.buf + off, rioPtrAt(&p->rdb, v->off), v->len);
+    p->blobs.len += v->len;
+    v->off = off;
+    v->where = RDB_VIEW_BLOB;
+}
+
+/* Add a view on a string that lives inside a blob view (ziplist/zipmap
+ * entries). */
+static void viewAddSub(rdbParser *p, rdbView *blob, unsigned char *base, unsigned char *s, size_t len) {
+    rdbView *v = viewNew(p);
+    v->off = blob->off + (s - base);
+    v->len = len;
+    v->where = blob->where;
+}
+
+static unsigned char *viewPtr(rdbParser *p, rdbView *v) {
+    switch(v->where) {
+        case RDB_VIEW_BLOB: return (unsigned char *)p->blobs.buf + v->off;
+        case RDB_VIEW_NUM: return (unsigned char *)p->nums.buf + v->off;
+        case RDB_VIEW_DOUBLE: return NULL;
+        default: return rioPtrAt(&p->rdb, v->off);
     }
-    startParse(fp);
-    while(1) {
-        if(!(loops++ % 1000)) {
-            /* record parse progress every 1000 loops. */
-            parseProgress(ftello(fp));
-        }
-        if((type = rdbLoadType(fp)) == -1) return PARSE_ERR;
+}
 
-        if(type == REDIS_EXPIRETIME) {
-            if ((expiretime = rdbLoadTime(fp)) == -1) return PARSE_ERR;
-            if((type = rdbLoadType(fp)) == -1) return PARSE_ERR;
+static void viewsResolve(rdbParser *p) {
+    size_t i;
+    for (i = 0; i < p->count; i++) {
+        p->strs[i].ptr = (char *)viewPtr(p, p->views + i);
+        p->strs[i].len = p->views[i].len;
+        p->strs[i].num = p->views[i].num;
+    }
+}
+
+/* Load a string object as a view, return PARSE_ERR on short read. */
+static int rdbLoadStringView(rdbParser *p) {
+    rio *rdb = &p->rdb;
+    int isencoded;
+    uint32_t len, clen;
+    unsigned char *c, *enc;
+    rdbView *v;
+    int phase, ok;
+
+    len = rdbLoadLen(rdb,&isencoded);
+    if (isencoded) {
+        switch(len) {
+            case REDIS_RDB_ENC_INT8:
+                if ((enc = rioNext(rdb,1)) == NULL) return PARSE_ERR;
+                viewAddLongLong(p, (signed char)enc[0]);
+                return PARSE_OK;
+            case REDIS_RDB_ENC_INT16:
+                if ((enc = rioNext(rdb,2)) == NULL) return PARSE_ERR;
+                viewAddLongLong(p, (int16_t)(enc[0]|(enc[1]<<8)));
+                return PARSE_OK;
+            case REDIS_RDB_ENC_INT32:
+                if ((enc = rioNext(rdb,4)) == NULL) return PARSE_ERR;
+                viewAddLongLong(p, (int32_t)((uint32_t)enc[0]|((uint32_t)enc[1]<<8)|
+                            ((uint32_t)enc[2]<<16)|((uint32_t)enc[3]<<24)));
+                return PARSE_OK;
+            case REDIS_RDB_ENC_LZF:
+                if ((clen = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return PARSE_ERR;
+                if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return PARSE_ERR;
+                if ((c = rioNext(rdb,clen)) == NULL) return PARSE_ERR;
+                v = viewNew(p);
+                v->off = scratchReserve(&p->blobs, len);
+                v->len = len;
+                v->where = RDB_VIEW_BLOB;
+                phase = rdbPhase(p, RDB_PHASE_LZF);
+                ok = lzf_decompress(c,clen,p->blobs.buf + v->off,len) != 0;
+                rdbPhase(p, phase);
+                if (!ok) return PARSE_ERR;
+                p->blobs.len += len;
+                return PARSE_OK;
+            default:
+                parsePanic("Unknown RDB encoding type");
         }
-        /* file end. */
-        if(type == REDIS_EOF) {
+    }
+
+    if (len == REDIS_RDB_LENERR) return PARSE_ERR;
+    v = viewNew(p);
+    v->off = rioTell(rdb);
+    v->len = len;
+    v->where = RDB_VIEW_INPUT;
+    if (rioNext(rdb,len) == NULL) return PARSE_ERR;
+    return PARSE_OK;
+}
+
+/* Expand a ziplist, zipmap or intset blob (the last view added) into views
+ * of its elements. Only the nums scratch grows while we walk the blob, so
+ * the blob itself stays put. */
+static int rdbExpandBlobViews(rdbParser *p, int type) {
+    rdbView blob = p->views[--p->count];
+    unsigned char *base = viewPtr(p, &blob);
+    unsigned char *e, *q, *vstr;
+    unsigned int vlen, klen;
+    long long vlong;
+    int64_t intele;
+    uint32_t i;
+
+    switch(type) {
+        case REDIS_HASH_ZIPMAP:
+            e = zipmapRewind(base);
+            while((e = zipmapNext(e,&q,&klen,&vstr,&vlen)) != NULL) {
+                viewAddSub(p, &blob, base, q, klen);
+                viewAddSub(p, &blob, base, vstr, vlen);
+            }
+            break;
+        case REDIS_LIST_ZIPLIST:
+            e = ziplistIndex(base,0);
+            while (ziplistGet(e,&vstr,&vlen,&vlong)) {
+                if (vstr) viewAddSub(p, &blob, base, vstr, vlen);
+                else viewAddLongLong(p, vlong);
+                e = ziplistNext(base,e);
+            }
             break;
+        case REDIS_SET_INTSET:
+            for (i = 0; intsetGet((intset*)base,i,&intele); i++)
+                viewAddLongLong(p, intele);
+            break;
+        case REDIS_ZSET_ZIPLIST:
+            e = ziplistIndex(base,0);
+            q = e ? ziplistNext(base,e) : NULL;
+            while (e != NULL) {
+                ziplistGet(e,&vstr,&vlen,&vlong);
+                if (vstr) viewAddSub(p, &blob, base, vstr, vlen);
+                else viewAddLongLong(p, vlong);
+                viewAddDouble(p, zzlGetScore(q));
+                zzlNext(base,&e,&q);
+            }
+            break;
+        default:
+            return PARSE_ERR;
+    }
+    return PARSE_OK;
+}
+
+/* Load a value as views appended after the key view, return the number of
+ * value views or -1 on error. */
+static int rdbLoadValueViews(rdbParser *p, int type) {
+    size_t first = p->count;
+    uint32_t len;
+    double score;
+    int phase, ret;
+
+    if (type == REDIS_STRING) {
+        if (rdbLoadStringView(p) == PARSE_ERR) return -1;
+    } else if (type == REDIS_LIST || type == REDIS_SET) {
+        if ((len = rdbLoadLen(&p->rdb,NULL)) == REDIS_RDB_LENERR) return -1;
+        while(len--) {
+            if (rdbLoadStringView(p) == PARSE_ERR) return -1;
         }
-        /* select db */
-        if(type == REDIS_SELECTDB) {
-            dbid = rdbLoadLen(fp,NULL);
-            continue;
+    } else if (type == REDIS_ZSET) {
+        if ((len = rdbLoadLen(&p->rdb,NULL)) == REDIS_RDB_LENERR) return -1;
+        while(len--) {
+            if (rdbLoadStringView(p) == PARSE_ERR) return -1;
+            if (rdbLoadDoubleValue(&p->rdb,&score) == -1) return -1;
+            viewAddDouble(p, score);
         }
-
-        /* load key. */
-        if ((key = rdbLoadStringObject(fp)) == NULL) {
-            return PARSE_ERR;
-        } 
-
-        if(type == REDIS_HASH_ZIPMAP) {
-            valType = REDIS_HASH;
-        } else if(type == REDIS_LIST_ZIPLIST) {
-            valType = REDIS_LIST;
-        } else if(type == REDIS_SET_INTSET) {
-            valType = REDIS_SET;
-        } else if(type == REDIS_ZSET_ZIPLIST) {
-            valType = REDIS_ZSET;
-        } else {
-            valType = type;
-        }
-        /* load value. */
-        if(type == REDIS_STRING) {
-            sval = rdbLoadValueObject(fp, type, &rlen);
-            handler(valType, key, sval, rlen, expiretime);
-            if(dump_aof == 1)
-                kv_temp = format_handler(RDB_PARSER, valType, key, strlen(key), sval, rlen, &kv_hashed_key, aof_number);
-        } else {
-            cval = rdbLoadValueObject(fp, type, &rlen);
-            handler(valType, key, cval, rlen, expiretime);
-            if(dump_aof == 1)
-                kv_temp = format_handler(RDB_PARSER, valType, key, strlen(key), cval, rlen, &kv_hashed_key, aof_number);
+    } else if (type == REDIS_HASH) {
+        if ((len = rdbLoadLen(&p->rdb,NULL)) == REDIS_RDB_LENERR) return -1;
+        while(len--) {
+            if (rdbLoadStringView(p) == PARSE_ERR) return -1;
+            if (rdbLoadStringView(p) == PARSE_ERR) return -1;
         }
-        // add current kv pair to aof buffer.
-        if(dump_aof == 1 && add_aof(aof_set + kv_hashed_key, kv_temp) == PARSE_ERR)
-            fprintf(stderr, "add_aof error\n");
+    } else if (type == REDIS_HASH_ZIPMAP ||
+            type == REDIS_LIST_ZIPLIST ||
+            type == REDIS_SET_INTSET ||
+            type == REDIS_ZSET_ZIPLIST) {
+        if (rdbLoadStringView(p) == PARSE_ERR) return -1;
+        phase = rdbPhase(p, RDB_PHASE_EXPAND);
+        ret = rdbExpandBlobViews(p, type);
+        rdbPhase(p, phase);
+        if (ret == PARSE_ERR) return -1;
+    } else {
+        parsePanic("Unknown object type");
+    }
+    return p->count - first;
+}
 
-        /* clean*/
-        if(kv_temp)
-            sdsfree(kv_temp);
-        sdsfree(key);
-        if(valType == REDIS_STRING) {
-            sdsfree(sval);
-        } else {
-            unsigned int k;
-            for(k = 0; k < rlen; k++) {
-                sdsfree(cval[k]);
+/*-----------------------------------------------------------------------------
+ * Streaming mode: instead of building the sds array of a whole value, the
+ * elements are handed to stream->elements() in batches of batch_size, between
+ * a begin() and an end() call for the key. Peak memory is one batch, however
+ * big the key is. Encoded values (ziplist, zipmap, intset) are still loaded
+ * as one blob, redis keeps those small.
+ *----------------------------------------------------------------------------*/
+
+static void streamFlush(rdbParser *p, int type) {
+    unsigned int i;
+    int phase;
+
+    if(p->batch_count == 0) return;
+    phase = rdbPhase(p, RDB_PHASE_HANDLER);
+    p->stream->elements(type, p->batch, p->batch_count, p->stream->privdata);
+    rdbPhase(p, phase);
+    for(i = 0; i < p->batch_count; i++) {
+        sdsfree(p->batch[i]);
+    }
+    p->batch_count = 0;
+}
+
+static void streamPush(rdbParser *p, int type, sds ele) {
+    if(p->batch == NULL) p->batch = zmalloc(p->batch_size * sizeof(sds));
+    p->batch[p->batch_count++] = ele;
+    if(p->batch_count == p->batch_size) streamFlush(p, type);
+}
+
+static void streamPushDouble(rdbParser *p, int type, double score) {
+    char buf[FPCONV_DTOA_MAX];
+    int buf_len = fpconv_dtoa(score, buf);
+    streamPush(p, type, sdsnewlen(buf, buf_len));
+}
+
+/* Drop elements left over by a failed key. */
+static void streamFree(rdbParser *p) {
+    unsigned int i;
+
+    for(i = 0; i < p->batch_count; i++) {
+        sdsfree(p->batch[i]);
+    }
+    zfree(p->batch);
+    p->batch = NULL;
+    p->batch_count = 0;
+}
+
+/* Stream the elements of a compact encoded value. */
+static void streamBlob(rdbParser *p, int type, int valType, unsigned char *blob) {
+    unsigned char *e, *q, *vstr;
+    unsigned int vlen, klen;
+    long long vlong;
+    int64_t intele;
+    uint32_t i;
+
+    switch(type) {
+        case REDIS_HASH_ZIPMAP:
+            e = zipmapRewind(blob);
+            while((e = zipmapNext(e,&q,&klen,&vstr,&vlen)) != NULL) {
+                streamPush(p, valType, sdsnewlen(q, klen));
+                streamPush(p, valType, sdsnewlen(vstr, vlen));
+            }
+            break;
+        case REDIS_LIST_ZIPLIST:
+            e = ziplistIndex(blob,0);
+            while (ziplistGet(e,&vstr,&vlen,&vlong)) {
+                streamPush(p, valType, vstr ? sdsnewlen(vstr, vlen) : sdsfromlonglong(vlong));
+                e = ziplistNext(blob,e);
+            }
+            break;
+        case REDIS_SET_INTSET:
+            for (i = 0; intsetGet((intset*)blob,i,&intele); i++)
+                streamPush(p, valType, sdsfromlonglong(intele));
+            break;
+        case REDIS_ZSET_ZIPLIST:
+            e = ziplistIndex(blob,0);
+            q = e ? ziplistNext(blob,e) : NULL;
+            while (e != NULL) {
+                ziplistGet(e,&vstr,&vlen,&vlong);
+                streamPush(p, valType, vstr ? sdsnewlen(vstr, vlen) : sdsfromlonglong(vlong));
+                streamPushDouble(p, valType, zzlGetScore(q));
+                zzlNext(blob,&e,&q);
+            }
+            break;
+    }
+}
+
+static unsigned long streamBlobLen(int type, unsigned char *blob) {
+    switch(type) {
+        case REDIS_HASH_ZIPMAP: return zipmapLen(blob) * 2;
+        case REDIS_SET_INTSET: return ((intset*)blob)->length;
+        default: return ziplistLen(blob);
+    }
+}
+
+/* Load a value of the given type and stream it, valType is its plain type
+ * (what the handler sees). */
+static int rdbStreamValue(rdbParser *p, int type, int valType, sds key, time_t expiretime) {
+    rdbStreamHandler *h = p->stream;
+    rio *rdb = &p->rdb;
+    uint32_t len;
+    double score;
+    sds ele, aux;
+    int phase;
+
+    if(type == REDIS_HASH_ZIPMAP ||
+            type == REDIS_LIST_ZIPLIST ||
+            type == REDIS_SET_INTSET ||
+            type == REDIS_ZSET_ZIPLIST) {
+        if((aux = rdbLoadStringObject(rdb,p)) == NULL) return PARSE_ERR;
+        phase = rdbPhase(p, RDB_PHASE_HANDLER);
+        h->begin(valType, key, streamBlobLen(type, (unsigned char *)aux), expiretime, h->privdata);
+        rdbPhase(p, RDB_PHASE_EXPAND);
+        streamBlob(p, type, valType, (unsigned char *)aux);
+        rdbPhase(p, phase);
+        sdsfree(aux);
+    } else if(type == REDIS_STRING) {
+        if((ele = rdbLoadEncodedStringObject(rdb,p)) == NULL) return PARSE_ERR;
+        phase = rdbPhase(p, RDB_PHASE_HANDLER);
+        h->begin(valType, key, 1, expiretime, h->privdata);
+        rdbPhase(p, phase);
+        streamPush(p, valType, ele);
+    } else {
+        if((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return PARSE_ERR;
+        phase = rdbPhase(p, RDB_PHASE_HANDLER);
+        h->begin(valType, key, (type == REDIS_LIST || type == REDIS_SET) ? len : 2 * (unsigned long)len,
+                expiretime, h->privdata);
+        rdbPhase(p, phase);
+        while(len--) {
+            if((ele = rdbLoadEncodedStringObject(rdb,p)) == NULL) return PARSE_ERR;
+            streamPush(p, valType, ele);
+            if(type == REDIS_ZSET) {
+                if(rdbLoadDoubleValue(rdb,&score) == -1) return PARSE_ERR;
+                streamPushDouble(p, valType, score);
+            } else if(type == REDIS_HASH) {
+                if((ele = rdbLoadEncodedStringObject(rdb,p)) == NULL) return PARSE_ERR;
+                streamPush(p, valType, ele);
+            } else if(type != REDIS_LIST && type != REDIS_SET) {
+                parsePanic("Unknown object type");
             }
-            zfree(cval);
         }
     }
-    int i;
-    // save the data in buffer
-    for(i = 0; i < aof_number; i++){
-        // write aof files if dump_aof is 1
-        if(dump_aof == 1 && save_aof(aof_set + i) == PARSE_ERR)
-            fprintf(stderr, "save_aof error\n");
-        // clean ith aof object.
-        sdsfree((aof_set + i)->buffer);
-        free((aof_set + i)->filename);
-        fclose((aof_set + i)->fp);
-    }
-
-    /* checksum */
-    uint64_t checksum = 0;
-    int ret;
-    ret = fread(&checksum, sizeof(checksum), 1, fp);
-    if (ret == 1) {
-        if ((long long)checksum != digest) {
-            fprintf(stderr, "DB load failed, checksum does not match: %016llx != %016llx\n", (long long)checksum, digest);
-            exit(1);
+    streamFlush(p, valType);
+    phase = rdbPhase(p, RDB_PHASE_HANDLER);
+    h->end(valType, key, h->privdata);
+    rdbPhase(p, phase);
+    return PARSE_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * Key loop
+ *----------------------------------------------------------------------------*/
+
+static int rdbValueType(int type) {
+    switch(type) {
+        case REDIS_HASH_ZIPMAP: return REDIS_HASH;
+        case REDIS_LIST_ZIPLIST: return REDIS_LIST;
+        case REDIS_SET_INTSET: return REDIS_SET;
+        case REDIS_ZSET_ZIPLIST: return REDIS_ZSET;
+        default: return type;
+    }
+}
+
+static void rdbFreePair(rdbPair *pair) {
+    unsigned int k;
+    sds *cval;
+
+    sdsfree(pair->key);
+    if(pair->type == REDIS_STRING) {
+        sdsfree(pair->val);
+    } else {
+        cval = pair->val;
+        for(k = 0; k < pair->vlen; k++) {
+            sdsfree(cval[k]);
         }
-        fprintf(stderr, "DB loaded, checksum: %016llx\n", digest);
+        zfree(cval);
     }
-    parser_stats.stop_time = time(NULL);
-    fclose(fp);
+}
 
-    return PARSE_OK;
+/* The commands rebuilding pair, in p->aof_scratch. Keys are spread over the
+ * aof files by p->shard, the crc64 of their name by default. */
+static sds rdbFormatResp(rdbParser *p, rdbPair *pair, int *hashed_key) {
+    long long expire_ms = pair->expiretime;
+
+    /* expire times are in seconds before rdb version 5 */
+    if(expire_ms != -1 && p->rdb_version < 5) expire_ms *= 1000;
+    if(!p->aof_scratch) p->aof_scratch = sdsempty();
+    sdsclear(p->aof_scratch);
+    p->aof_scratch = respAppendPair(p->aof_scratch, pair->type, pair->key,
+            pair->val, pair->vlen, expire_ms, p->aof_batch);
+    *hashed_key = (p->shard ? p->shard : shardByCrc64)(pair->key, sdslen(pair->key), p->aof_number);
+    return p->aof_scratch;
 }
 
-void dumpParserInfo() {
-    long long total_nums = 0;
-    int i;
-    for(i = 0 ; i < TOTAL_DATA_TYPES; i++) {
-        total_nums += parser_stats.parse_num[i];
+/* RESP output goes to the db of the key, SELECT it if the file is in
+ * another one. Call with the aof lock held. */
+static void rdbSelectDb(Aof *aof, uint32_t dbid) {
+    sds select;
+
+    if(aof->db == (long)dbid) return;
+    select = respAppendSelect(sdsempty(), dbid);
+    /* a failed write is reported once by the aof */
+    add_aof_len(aof, select, sdslen(select));
+    sdsfree(select);
+    aof->db = dbid;
+}
+
+/* Hand a decoded key to the handler and the aof buffers, then free it. */
+static void rdbEmitPair(rdbParser *p, rdbPair *pair) {
+    sds kv_temp;
+    int kv_hashed_key;
+    int phase = rdbPhase(p, RDB_PHASE_HANDLER);
+
+    p->handler(pair->type, pair->key, pair->val, pair->vlen, pair->expiretime);
+    if(p->dump_aof == 1) {
+        rdbPhase(p, RDB_PHASE_FORMAT);
+        if(p->aof_format == RDB_AOF_RESP)
+            kv_temp = rdbFormatResp(p, pair, &kv_hashed_key);
+        else
+            kv_temp = p->format_handler(RDB_PARSER, pair->type, pair->key, sdslen(pair->key),
+                    pair->val, pair->vlen, &kv_hashed_key, p->aof_number);
+        rdbPhase(p, RDB_PHASE_FLUSH);
+        // add current kv pair to aof buffer.
+        if(kv_temp && (kv_hashed_key < 0 || kv_hashed_key >= p->aof_number)) {
+            fprintf(stderr, "no aof file %d for key %s\n", kv_hashed_key, pair->key);
+        } else {
+            if(p->aof_lock) pthread_mutex_lock(p->aof_lock);
+            if(p->aof_format == RDB_AOF_RESP)
+                rdbSelectDb(p->aof_set + kv_hashed_key, pair->dbid);
+            // a failed write is reported once by the aof.
+            if(!kv_temp)
+                fprintf(stderr, "add_aof error\n");
+            else if(add_aof_len(p->aof_set + kv_hashed_key, kv_temp, sdslen(kv_temp)) == AOF_OK)
+                p->aof_set[kv_hashed_key].shard.keys++;
+            if(p->aof_lock) pthread_mutex_unlock(p->aof_lock);
+        }
+        if(kv_temp && kv_temp != p->aof_scratch)
+            sdsfree(kv_temp);
     }
+    rdbPhase(p, phase);
+    rdbFreePair(pair);
+}
 
-    printf("--------------------------------------------DUMP INFO------------------------------------------\n");
-    printf("Parser parse %ld bytes  cost %ds.\n", (long) parser_stats.total_bytes, (int)((int)parser_stats.stop_time - (int)parser_stats.start_time));
-    printf("Total parse %lld keys\n", total_nums);
-    printf("\t%ld String keys\n", parser_stats.parse_num[STRING]);
-    printf("\t%ld List keys\n", parser_stats.parse_num[LIST]);
-    printf("\t%ld Set keys\n", parser_stats.parse_num[SET]);
-    printf("\t%ld Zset keys\n", parser_stats.parse_num[ZSET]);
-    printf("\t%ld Hash keys\n", parser_stats.parse_num[HASH]);
-    printf("--------------------------------------------DUMP INFO------------------------------------------\n");
+static void rdbQueuePair(rdbPairs *q, rdbPair *pair) {
+    if(q->count == q->cap) {
+        q->cap = q->cap ? q->cap * 2 : 64;
+        q->pairs = zrealloc(q->pairs, q->cap * sizeof(rdbPair));
+    }
+    q->pairs[q->count++] = *pair;
 }
 
+static void rdbFreePairs(rdbPairs *q) {
+    size_t i;
+    for(i = 0; i < q->count; i++) {
+        rdbFreePair(q->pairs + i);
+    }
+    zfree(q->pairs);
+    memset(q, 0, sizeof(*q));
+}
+
+/* Scan mode: report the key, or just its type, and step over the value
+ * using lengths only. key is the key's view if it was loaded already. */
+static int rdbScanPair(rdbParser *p, int type, int valType, rdbStr *key, time_t expiretime) {
+    int phase;
+
+    if(p->scan_flags & RDB_SCAN_TYPES) {
+        if(!key && rdbSkipStringObject(&p->rdb) == PARSE_ERR) return PARSE_ERR;
+        phase = rdbPhase(p, RDB_PHASE_HANDLER);
+        p->scan_handler(valType, NULL, expiretime);
+    } else {
+        if(!key) {
+            rioMark(&p->rdb);
+            viewsReset(p);
+            if(rdbLoadStringView(p) == PARSE_ERR) return PARSE_ERR;
+            viewsResolve(p);
+        }
+        phase = rdbPhase(p, RDB_PHASE_HANDLER);
+        p->scan_handler(valType, p->strs, expiretime);
+    }
+    rdbPhase(p, phase);
+    rioUnmark(&p->rdb);
+    return rdbSkipValueObject(&p->rdb, type);
+}
+
+/*-----------------------------------------------------------------------------
+ * Memory mode: values are walked for the lengths of their elements and
+ * priced with memory.h, strings are skipped rather than read. Only the key
+ * and ziplist, zipmap or intset blobs are looked at, as views.
+ *----------------------------------------------------------------------------*/
+
+/* Length of value as a decimal string. */
+static size_t rdbMemoryLongLong(long long value) {
+    return value < 0 ? digits10(-(uint64_t)value) + 1 : digits10(value);
+}
+
+/* Step over a string object, set len to its length and isint if it is
+ * stored as an integer, value to that integer. */
+static int rdbMemoryString(rio *rdb, size_t *len, int *isint, long long *value) {
+    int isencoded;
+    uint32_t l, clen;
+    unsigned char *enc;
+
+    *isint = 0;
+    l = rdbLoadLen(rdb,&isencoded);
+    if (isencoded) {
+        switch(l) {
+            case REDIS_RDB_ENC_INT8:
+                if ((enc = rioNext(rdb,1)) == NULL) return PARSE_ERR;
+                *value = (signed char)enc[0];
+                break;
+            case REDIS_RDB_ENC_INT16:
+                if ((enc = rioNext(rdb,2)) == NULL) return PARSE_ERR;
+                *value = (int16_t)(enc[0]|(enc[1]<<8));
+                break;
+            case REDIS_RDB_ENC_INT32:
+                if ((enc = rioNext(rdb,4)) == NULL) return PARSE_ERR;
+                *value = (int32_t)((uint32_t)enc[0]|((uint32_t)enc[1]<<8)|
+                        ((uint32_t)enc[2]<<16)|((uint32_t)enc[3]<<24));
+                break;
+            case REDIS_RDB_ENC_LZF:
+                if ((clen = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return PARSE_ERR;
+                if ((l = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return PARSE_ERR;
+                *len = l;
+                return rioSkip(rdb,clen) ? PARSE_OK : PARSE_ERR;
+            default:
+                parsePanic("Unknown RDB encoding type");
+        }
+        *isint = 1;
+        *len = rdbMemoryLongLong(*value);
+        return PARSE_OK;
+    }
+    if (l == REDIS_RDB_LENERR) return PARSE_ERR;
+    *len = l;
+    return rioSkip(rdb,l) ? PARSE_OK : PARSE_ERR;
+}
+
+/* Add the string object of one element to m. */
+static int rdbMemoryElement(rio *rdb, rdbKeyMemory *m) {
+    size_t len;
+    int isint;
+    long long value;
+
+    if (rdbMemoryString(rdb, &len, &isint, &value) == PARSE_ERR) return PARSE_ERR;
+    m->bytes += memStringObject(len, isint, value);
+    if (len > m->largest) m->largest = len;
+    return PARSE_OK;
+}
+
+/* Count the elements of a ziplist, zipmap or intset blob. */
+static void rdbMemoryBlob(rdbKeyMemory *m, int type, unsigned char *blob, size_t len) {
+    unsigned char *e, *q, *vstr;
+    unsigned int vlen, klen;
+    long long vlong;
+    int64_t intele;
+    size_t l;
+    int member = 1;
+
+    m->bytes += memBlobObject(len);
+    switch(type) {
+        case REDIS_HASH_ZIPMAP:
+            m->encoding = REDIS_ENCODING_ZIPMAP;
+            e = zipmapRewind(blob);
+            while((e = zipmapNext(e,&q,&klen,&vstr,&vlen)) != NULL) {
+                m->elements++;
+                if (klen > m->largest) m->largest = klen;
+                if (vlen > m->largest) m->largest = vlen;
+            }
+            break;
+        case REDIS_LIST_ZIPLIST:
+        case REDIS_ZSET_ZIPLIST:
+            /* a zset ziplist has member, score, member, score... */
+            m->encoding = REDIS_ENCODING_ZIPLIST;
+            e = ziplistIndex(blob,0);
+            while (ziplistGet(e,&vstr,&vlen,&vlong)) {
+                if (member) {
+                    m->elements++;
+                    l = vstr ? vlen : rdbMemoryLongLong(vlong);
+                    if (l > m->largest) m->largest = l;
+                }
+                if (type == REDIS_ZSET_ZIPLIST) member = !member;
+                e = ziplistNext(blob,e);
+            }
+            break;
+        case REDIS_SET_INTSET:
+            /* sorted, so the longest is at one end */
+            m->encoding = REDIS_ENCODING_INTSET;
+            m->elements = intsetLen((intset*)blob);
+            if (m->elements && intsetGet((intset*)blob,0,&intele))
+                m->largest = rdbMemoryLongLong(intele);
+            if (m->elements && intsetGet((intset*)blob,m->elements - 1,&intele) &&
+                    rdbMemoryLongLong(intele) > m->largest)
+                m->largest = rdbMemoryLongLong(intele);
+            break;
+    }
+}
+
+static int rdbMemoryValue(rdbParser *p, int type, rdbKeyMemory *m) {
+    rio *rdb = &p->rdb;
+    uint32_t len, i;
+    size_t l;
+    int isint;
+    long long value;
+
+    switch(type) {
+        case REDIS_STRING:
+            if (rdbMemoryString(rdb, &l, &isint, &value) == PARSE_ERR) return PARSE_ERR;
+            m->encoding = isint ? REDIS_ENCODING_INT : REDIS_ENCODING_RAW;
+            m->elements = 1;
+            m->largest = l;
+            m->bytes += memStringObject(l, isint, value);
+            return PARSE_OK;
+        case REDIS_LIST:
+        case REDIS_SET:
+        case REDIS_ZSET:
+        case REDIS_HASH:
+            if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return PARSE_ERR;
+            m->encoding = type == REDIS_LIST ? REDIS_ENCODING_LINKEDLIST :
+                type == REDIS_ZSET ? REDIS_ENCODING_SKIPLIST : REDIS_ENCODING_HT;
+            m->elements = len;
+            m->bytes += memContainer(m->encoding, len);
+            for (i = 0; i < len; i++) {
+                if (rdbMemoryElement(rdb, m) == PARSE_ERR) return PARSE_ERR;
+                if (type == REDIS_ZSET && rdbSkipDoubleValue(rdb) == PARSE_ERR) return PARSE_ERR;
+                if (type == REDIS_HASH && rdbMemoryElement(rdb, m) == PARSE_ERR) return PARSE_ERR;
+            }
+            return PARSE_OK;
+        case REDIS_HASH_ZIPMAP:
+        case REDIS_LIST_ZIPLIST:
+        case REDIS_SET_INTSET:
+        case REDIS_ZSET_ZIPLIST:
+            if (rdbLoadStringView(p) == PARSE_ERR) return PARSE_ERR;
+            return PARSE_OK;
+        default:
+            parsePanic("Unknown object type");
+    }
+}
+
+static int rdbMemoryPair(rdbParser *p, int type, int valType, rdbStr *key, time_t expiretime) {
+    rdbKeyMemory m;
+    off_t start;
+    int phase;
+
+    memset(&m, 0, sizeof(m));
+    m.type = valType;
+    m.dbid = p->dbid;
+    m.expiretime = expiretime;
+    /* expire times are in seconds before rdb version 5 */
+    if (expiretime != -1 && p->rdb_version < 5) m.expiretime *= 1000;
+    /* keep the key's bytes in the window until the handler returns. */
+    if (!key) {
+        rioMark(&p->rdb);
+        viewsReset(p);
+        if (rdbLoadStringView(p) == PARSE_ERR) return PARSE_ERR;
+    }
+    /* Only ziplist, zipmap and intset blobs are read back from the window,
+     * other values are stepped over: copy the key out and let go of the
+     * mark, or the buffered backend would keep every byte of a big list,
+     * set or zset just for the key. */
+    if (type != REDIS_HASH_ZIPMAP && type != REDIS_LIST_ZIPLIST &&
+            type != REDIS_SET_INTSET && type != REDIS_ZSET_ZIPLIST) {
+        viewDetach(p, p->views);
+        rioUnmark(&p->rdb);
+    }
+    start = rioTell(&p->rdb);
+    if (rdbMemoryValue(p, type, &m) == PARSE_ERR) return PARSE_ERR;
+    m.serialized = rioTell(&p->rdb) - start;
+    viewsResolve(p);
+    phase = rdbPhase(p, RDB_PHASE_EXPAND);
+    if (p->count > 1)
+        rdbMemoryBlob(&m, type, (unsigned char *)p->strs[1].ptr, p->strs[1].len);
+    m.bytes += memKey(p->strs[0].len, expiretime != -1);
+    p->stats.memory += m.bytes;
+    rdbPhase(p, RDB_PHASE_HANDLER);
+    p->memory_handler(p->strs, &m);
+    rdbPhase(p, phase);
+    rioUnmark(&p->rdb);
+    return PARSE_OK;
+}
+
+/* Load the key and value of an object of the given type. */
+static int rdbLoadPair(rdbParser *p, int type, time_t expiretime) {
+    rdbPair pair;
+    rdbStr *key = NULL; /* the key's view, if the filter had to look at it */
+    int vcount, phase;
+
+    pair.type = rdbValueType(type);
+    pair.expiretime = expiretime;
+    pair.dbid = p->dbid;
+
+    if(type == REDIS_LSET) {
+        /* nothing we know how to decode, step over it. */
+        if(rdbSkipStringObject(&p->rdb) == PARSE_ERR) return PARSE_ERR;
+        return rdbSkipValueObject(&p->rdb, type);
+    }
+
+    if(p->filter) {
+        /* expire times are in seconds before rdb version 5 */
+        if(!rdbFilterMatchMeta(p->filter, pair.type, p->dbid,
+                    expiretime != -1 && p->rdb_version < 5 ? expiretime * 1000 : expiretime)) {
+            p->stats.filtered++;
+            if(rdbSkipStringObject(&p->rdb) == PARSE_ERR) return PARSE_ERR;
+            return rdbSkipValueObject(&p->rdb, type);
+        }
+        if(p->filter->npatterns) {
+            rioMark(&p->rdb);
+            viewsReset(p);
+            if(rdbLoadStringView(p) == PARSE_ERR) return PARSE_ERR;
+            viewsResolve(p);
+            if(!rdbFilterMatchKey(p->filter, p->strs)) {
+                rioUnmark(&p->rdb);
+                p->stats.filtered++;
+                return rdbSkipValueObject(&p->rdb, type);
+            }
+            key = p->strs;
+        }
+    }
+    if(pair.type < TOTAL_DATA_TYPES)
+        p->stats.parse_num[pair.type] += 1;
+
+    if(p->scan_handler) return rdbScanPair(p, type, pair.type, key, expiretime);
+    if(p->memory_handler) return rdbMemoryPair(p, type, pair.type, key, expiretime);
+
+    if(p->view_handler) {
+        /* keep the key's bytes in the window until the handler returns. */
+        if(!key) {
+            rioMark(&p->rdb);
+            viewsReset(p);
+            if(rdbLoadStringView(p) == PARSE_ERR) return PARSE_ERR;
+        }
+        if((vcount = rdbLoadValueViews(p, type)) == -1) return PARSE_ERR;
+        viewsResolve(p);
+        phase = rdbPhase(p, RDB_PHASE_HANDLER);
+        p->view_handler(pair.type, p->strs, p->strs + 1, vcount, expiretime);
+        rdbPhase(p, phase);
+        rioUnmark(&p->rdb);
+        return PARSE_OK;
+    }
+
+    /* the other modes own a copy of the key. */
+    if(key) {
+        pair.key = sdsnewlen(key->ptr, key->len);
+        rioUnmark(&p->rdb);
+    } else if((pair.key = rdbLoadStringObject(&p->rdb,p)) == NULL) {
+        return PARSE_ERR;
+    }
+
+    if(p->stream) {
+        if(rdbStreamValue(p, type, pair.type, pair.key, expiretime) == PARSE_ERR) {
+            sdsfree(pair.key);
+            return PARSE_ERR;
+        }
+        sdsfree(pair.key);
+        return PARSE_OK;
+    }
+
+    if((pair.val = rdbLoadValueObject(&p->rdb, type, &pair.vlen, p)) == NULL) {
+        sdsfree(pair.key);
+        return PARSE_ERR;
+    }
+    if(p->pending)
+        rdbQueuePair(p->pending, &pair);
+    else
+        rdbEmitPair(p, &pair);
+    return PARSE_OK;
+}
+
+/* The name of the key stored at off, read again from the window if it is
+ * still there or else from the file. NULL if it can't be read. */
+static sds rdbKeyNameAt(rdbParser *p, off_t off) {
+    unsigned char head[16], *buf;
+    uint32_t len, clen = 0;
+    int isencoded;
+    ssize_t n;
+    size_t need;
+    sds key;
+    rio r;
+
+    if(off >= p->rdb.offset) {
+        buf = rioPtrAt(&p->rdb, off);
+        rioInitWithMemory(&r, buf, p->rdb.end - buf, off);
+        return rdbLoadStringObject(&r, NULL);
+    }
+    if(p->rdb.fd == -1 || (n = pread(p->rdb.fd, head, sizeof(head), off)) <= 0) return NULL;
+    rioInitWithMemory(&r, head, n, off);
+    len = rdbLoadLen(&r, &isencoded);
+    if(isencoded && len == REDIS_RDB_ENC_LZF) {
+        if((clen = rdbLoadLen(&r, NULL)) == REDIS_RDB_LENERR) return NULL;
+        if(rdbLoadLen(&r, NULL) == REDIS_RDB_LENERR) return NULL;
+        need = rioTell(&r) - off + clen;
+    } else if(isencoded) {
+        need = n; /* at most 4 bytes of integer */
+    } else {
+        if(len == REDIS_RDB_LENERR) return NULL;
+        need = rioTell(&r) - off + len;
+    }
+    buf = zmalloc(need);
+    if(pread(p->rdb.fd, buf, need, off) != (ssize_t)need) {
+        zfree(buf);
+        return NULL;
+    }
+    rioInitWithMemory(&r, buf, need, off);
+    key = rdbLoadStringObject(&r, NULL);
+    zfree(buf);
+    return key;
+}
+
+/* Count the entry that started at off, its key at key_off, in the bytes of
+ * its type, and keep its name if it is the largest so far. */
+static void rdbCountEntry(rdbParser *p, int type, off_t off, off_t key_off) {
+    long long bytes = rioTell(&p->rdb) - off;
+
+    type = rdbValueType(type);
+    if(type >= TOTAL_DATA_TYPES) return;
+    p->stats.type_bytes[type] += bytes;
+    if(bytes <= p->stats.largest_bytes) return;
+    p->stats.largest_bytes = bytes;
+    p->stats.largest_type = type;
+    p->stats.largest_db = p->dbid;
+    sdsfree(p->stats.largest_key);
+    p->stats.largest_key = rdbKeyNameAt(p, key_off);
+}
+
+/* Add the keys and bytes read since the last call to the progress meter. */
+static void rdbReportProgress(rdbParser *p) {
+    long long keys = p->stats.filtered;
+    off_t off = rioTell(&p->rdb);
+    int i;
+
+    if(!p->progress) return;
+    for(i = 0; i < TOTAL_DATA_TYPES; i++) keys += p->stats.parse_num[i];
+    progressAdd(p->progress, off - p->progress_off, keys - p->progress_keys);
+    p->progress_off = off;
+    p->progress_keys = keys;
+}
+
+/* Load keys until the EOF opcode, or until chunk_end if it is set. */
+static int rdbLoadEntries(rdbParser *p) {
+    rio *rdb = &p->rdb;
+    int type, loops = 0;
+    time_t expiretime;
+    off_t off, key_off;
+    long filtered;
+
+    while(1) {
+        off = rioTell(rdb);
+        if(p->chunk_end != -1 && off >= p->chunk_end) break;
+        if(!(loops++ % 1000) || (p->progress && off - p->progress_off >= RDB_PROGRESS_BYTES)) {
+            /* record parse progress every 1000 loops, or few big keys. */
+            p->stats.parsed_bytes = off;
+            rdbReportProgress(p);
+        }
+        /* checksum the previous keys while their bytes are still in cache. */
+        if(p->checksum) rioUpdateChecksumLazy(rdb);
+        if((type = rdbLoadType(rdb)) == -1) return PARSE_ERR;
+
+        expiretime = -1;
+        if(type == REDIS_EXPIRETIME) {
+            if((expiretime = rdbLoadTime(rdb, p->rdb_version)) == -1) return PARSE_ERR;
+            if((type = rdbLoadType(rdb)) == -1) return PARSE_ERR;
+        }
+        /* file end. */
+        if(type == REDIS_EOF) {
+            break;
+        }
+        /* select db */
+        if(type == REDIS_SELECTDB) {
+            if((p->dbid = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return PARSE_ERR;
+            continue;
+        }
+        key_off = rioTell(rdb);
+        filtered = p->stats.filtered;
+        if(rdbLoadPair(p, type, expiretime) == PARSE_ERR) return PARSE_ERR;
+        if(p->stats.filtered == filtered) rdbCountEntry(p, type, off, key_off);
+    }
+    rdbReportProgress(p);
+    return PARSE_OK;
+}
+
+/* Check the signature and version, and step over the aux field. */
+static int rdbLoadHeader(rdbParser *p) {
+    char buf[2048];
+    int len = 0;
+
+    if (rioRead(&p->rdb, buf, 9) == 0) {
+        fprintf(stderr, "read %s err :%s\n", p->filename, strerror(errno));
+        return PARSE_ERR;
+    }
+    if(buf[8] != 'c') return PARSE_ERR;
+    buf[9] = '\0';
+    if (memcmp(buf, "REDIS", 5) != 0) {
+        fprintf(stderr, "Wrong signature trying to load DB from file\n");
+        return PARSE_ERR;
+    }
+    p->rdb_version = atoi(buf+5);
+    if (p->rdb_version > 6) {
+        fprintf(stderr, "Can't handle RDB format version %d\n", p->rdb_version);
+        return PARSE_ERR;
+    }
+
+    if(rioRead(&p->rdb, &len, sizeof(len)) == 0) return PARSE_ERR;
+    if(len < 0 || len >= 2048) return PARSE_ERR;
+    if(rioRead(&p->rdb, buf, len) == 0) return PARSE_ERR;
+    return PARSE_OK;
+}
+
+/* Compare the trailing checksum, if there is one, with the crc64 of what
+ * was read. The cursor must be right after the EOF opcode. */
+static int rdbVerifyChecksum(rdbParser *p) {
+    uint64_t checksum = 0;
+    long long digest = rioChecksum(&p->rdb);
+
+    if (rioRead(&p->rdb, &checksum, sizeof(checksum)) == 1) {
+        if ((long long)checksum != digest) {
+            fprintf(stderr, "DB load failed, checksum does not match: %016llx != %016llx\n", (long long)checksum, digest);
+            return PARSE_ERR;
+        }
+        fprintf(stderr, "DB loaded, checksum: %016llx\n", digest);
+    }
+    return PARSE_OK;
+}
+
+static long rdbMajorFaults(void) {
+    struct rusage usage;
+
+    if(getrusage(RUSAGE_SELF, &usage) == -1) return 0;
+    return usage.ru_majflt;
+}
+
+static void startParse(rdbParser *p) {
+    memset(&p->stats, 0, sizeof(p->stats));
+    p->stats.start_time = time(NULL);
+    p->stats.total_bytes = p->rdb.size ? p->rdb.size : 1;
+    p->start_ns = rdbNs();
+    p->start_allocations = zmalloc_allocations();
+    p->start_faults = rdbMajorFaults();
+    if(p->progress) progressBegin(p->progress, p->rdb.size);
+    rdbClockStart(p);
+}
+
+static void stopParse(rdbParser *p) {
+    rdbClockStop(p);
+    p->stats.stop_time = time(NULL);
+    p->stats.elapsed_ns = rdbNs() - p->start_ns;
+    p->stats.allocations = zmalloc_allocations() - p->start_allocations;
+    p->stats.major_faults = rdbMajorFaults() - p->start_faults;
+    p->stats.parsed_bytes = rioTell(&p->rdb);
+}
+
+static void rdbOpenAofs(rdbParser *p, int aof_number, char *aof_filename, int dump_aof) {
+    p->aof_number = aof_number;
+    p->dump_aof = dump_aof;
+    if(dump_aof == 1) {
+        p->aof_set = set_aofs(aof_number, aof_filename, p->aof_buffer, p->aof_writers);
+        if(!p->aof_set){
+            fprintf(stderr, "aof_set failed\n");
+            p->dump_aof = -1;
+        }
+    }
+}
+
+static void rdbCloseAofs(rdbParser *p) {
+    int phase = rdbPhase(p, RDB_PHASE_FLUSH);
+
+    if(p->aof_set && p->dump_aof == 1) {
+        p->stats.shards = aofs_shards(p->aof_set, p->aof_number);
+        p->stats.nshards = p->stats.shards ? p->aof_number : 0;
+    }
+    // write the data left in the buffers if dump_aof is 1
+    if(close_aofs(p->aof_set, p->aof_number, p->dump_aof == 1, &p->stats.aof) == AOF_ERR)
+        fprintf(stderr, "save_aof error\n");
+    p->aof_set = NULL;
+    sdsfree(p->aof_scratch);
+    p->aof_scratch = NULL;
+    rdbPhase(p, phase);
+}
+
+/* Parse the file calling whichever handler is set in p for every key. Only
+ * the sds handler gets aof output. */
+static int rdbParseFile(rdbParser *p, int aof_number, char *aof_filename, int dump_aof) {
+    int ret = PARSE_ERR;
+
+    if(rioOpen(&p->rdb, p->filename, RIO_BACKEND_AUTO) == PARSE_ERR) {
+        fprintf(stderr, "open %s err :%s\n", p->filename, strerror(errno));
+        return PARSE_ERR;
+    }
+    if(rdbLoadHeader(p) == PARSE_ERR) goto err;
+
+    rdbOpenAofs(p, aof_number, aof_filename, dump_aof);
+    startParse(p);
+    if(rdbLoadEntries(p) == PARSE_ERR) {
+        rdbCloseAofs(p);
+        goto err;
+    }
+    rdbCloseAofs(p);
+    if(rdbVerifyChecksum(p) == PARSE_ERR) goto err;
+    stopParse(p);
+    ret = PARSE_OK;
+
+err:
+    if(p->progress) progressEnd(p->progress);
+    rioClose(&p->rdb);
+    viewsFree(p);
+    streamFree(p);
+    return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * Parallel mode. The file is mapped and skimmed once with rdbSkipValueObject
+ * to find the offset of every RDB_CHUNK_KEYS-th key (and to check the
+ * checksum), then a pool of workers decodes those chunks, each with its own
+ * parser over a slice of the mapping.
+ *
+ * In ordered mode a worker that finishes a chunk queues its pairs in a
+ * reorder window of 2*threads slots, and whichever worker finds the next
+ * chunk to emit ready drains the window in file order, one emitter at a
+ * time. Workers never get more than a window ahead of the emitter. In
+ * relaxed mode every worker calls the handler directly as it decodes, so
+ * the handler must be thread safe and keys arrive in no particular order.
+ *----------------------------------------------------------------------------*/
+
+typedef struct {
+    off_t start;   /* offset of the chunk's first key */
+    uint32_t dbid; /* db selected at that point */
+} rdbChunk;
+
+typedef struct {
+    rdbParser *main;   /* owns the mapping, the handlers and the aof files */
+    rdbChunk *chunks;
+    size_t nchunks;
+    off_t eof;         /* offset of the EOF opcode, the end of the last chunk */
+    int ordered;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t next;       /* next chunk to decode */
+    size_t emit;       /* ordered: next chunk to emit */
+    size_t window;     /* ordered: reorder window size */
+    rdbPairs *slots;   /* ordered: decoded chunks, by index % window */
+    int *ready;
+    int emitting;      /* ordered: a worker is draining the window */
+    int failed;
+    pthread_mutex_t aof_lock;
+} rdbParallel;
+
+typedef struct {
+    rdbParallel *par;
+    rdbParser p;
+    rdbPairs pending;
+    pthread_t thread;
+} rdbWorker;
+
+/* Record the offset of every chunk_keys-th key up to the EOF opcode. */
+static int rdbSkimChunks(rdbParser *p, rdbParallel *par, long chunk_keys) {
+    rio *rdb = &p->rdb;
+    size_t cap = 0;
+    long keys = 0;
+    uint32_t dbid = 0;
+    off_t pos;
+    int type;
+
+    while(1) {
+        rioUpdateChecksumLazy(rdb);
+        pos = rioTell(rdb);
+        if((type = rdbLoadType(rdb)) == -1) return PARSE_ERR;
+        if(type == REDIS_EXPIRETIME) {
+            if(rdbLoadTime(rdb, p->rdb_version) == -1) return PARSE_ERR;
+            if((type = rdbLoadType(rdb)) == -1) return PARSE_ERR;
+        }
+        if(type == REDIS_EOF) break;
+        if(type == REDIS_SELECTDB) {
+            if((dbid = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return PARSE_ERR;
+            continue;
+        }
+        if(keys++ % chunk_keys == 0) {
+            if(par->nchunks == cap) {
+                cap = cap ? cap * 2 : 64;
+                par->chunks = zrealloc(par->chunks, cap * sizeof(rdbChunk));
+            }
+            par->chunks[par->nchunks].start = pos;
+            par->chunks[par->nchunks].dbid = dbid;
+            par->nchunks++;
+        }
+        if(rdbSkipStringObject(rdb) == PARSE_ERR) return PARSE_ERR;
+        if(rdbSkipValueObject(rdb, type) == PARSE_ERR) return PARSE_ERR;
+    }
+    par->eof = pos;
+    return PARSE_OK;
+}
+
+static void rdbParallelFail(rdbParallel *par) {
+    pthread_mutex_lock(&par->lock);
+    par->failed = 1;
+    pthread_cond_broadcast(&par->cond);
+    pthread_mutex_unlock(&par->lock);
+}
+
+/* Ordered mode: put the pairs of chunk idx in the window, and if nobody is
+ * emitting, emit every chunk that is ready in file order. */
+static void rdbChunkDone(rdbParallel *par, rdbPairs *pending, size_t idx) {
+    rdbPairs *slot, spare;
+    size_t i;
+
+    pthread_mutex_lock(&par->lock);
+    /* swap, so the worker gets the slot's already allocated array back. */
+    slot = par->slots + idx % par->window;
+    spare = *slot;
+    *slot = *pending;
+    *pending = spare;
+    pending->count = 0;
+    par->ready[idx % par->window] = 1;
+
+    if(!par->emitting) {
+        par->emitting = 1;
+        while(!par->failed && par->ready[par->emit % par->window]) {
+            slot = par->slots + par->emit % par->window;
+            /* no worker can touch this slot until emit moves past it. */
+            pthread_mutex_unlock(&par->lock);
+            for(i = 0; i < slot->count; i++) {
+                rdbEmitPair(par->main, slot->pairs + i);
+            }
+            slot->count = 0;
+            pthread_mutex_lock(&par->lock);
+            par->ready[par->emit % par->window] = 0;
+            par->emit++;
+            pthread_cond_broadcast(&par->cond);
+        }
+        par->emitting = 0;
+    }
+    pthread_mutex_unlock(&par->lock);
+}
+
+static void *rdbWorkerMain(void *arg) {
+    rdbWorker *w = arg;
+    rdbParallel *par = w->par;
+    rdbParser *p = &w->p;
+    off_t start, end;
+    size_t idx;
+
+    while(1) {
+        pthread_mutex_lock(&par->lock);
+        while(par->ordered && !par->failed && par->next < par->nchunks &&
+                par->next >= par->emit + par->window) {
+            pthread_cond_wait(&par->cond, &par->lock);
+        }
+        if(par->failed || par->next == par->nchunks) {
+            pthread_mutex_unlock(&par->lock);
+            break;
+        }
+        idx = par->next++;
+        pthread_mutex_unlock(&par->lock);
+
+        start = par->chunks[idx].start;
+        end = idx + 1 < par->nchunks ? par->chunks[idx+1].start : par->eof;
+        rioInitWithMemory(&p->rdb, rioPtrAt(&par->main->rdb, start), end - start, start);
+        p->progress_off = start;
+        p->chunk_end = end;
+        p->dbid = par->chunks[idx].dbid;
+        /* timed while decoding a chunk, not while waiting or emitting */
+        rdbClockStart(p);
+        if(rdbLoadEntries(p) == PARSE_ERR) {
+            fprintf(stderr, "parse error in the chunk at offset %lld\n", (long long)start);
+            rdbParallelFail(par);
+            break;
+        }
+        rdbClockStop(p);
+        if(par->ordered) rdbChunkDone(par, &w->pending, idx);
+    }
+    return NULL;
+}
+
+static int rdbParseFileParallel(rdbParser *p, int threads, int ordered,
+        int aof_number, char *aof_filename, int dump_aof) {
+    rdbParallel par;
+    rdbWorker *workers = NULL;
+    int i, j, err, started = 0, ret = PARSE_ERR;
+
+    if(threads <= 1)
+        return rdbParseFile(p, aof_number, aof_filename, dump_aof);
+
+    if(rioOpen(&p->rdb, p->filename, RIO_BACKEND_MMAP) == PARSE_ERR) {
+        fprintf(stderr, "can't map %s, parsing it with a single thread\n", p->filename);
+        return rdbParseFile(p, aof_number, aof_filename, dump_aof);
+    }
+    memset(&par, 0, sizeof(par));
+    par.main = p;
+    par.ordered = ordered;
+    par.window = threads * 2;
+    pthread_mutex_init(&par.lock, NULL);
+    pthread_cond_init(&par.cond, NULL);
+    pthread_mutex_init(&par.aof_lock, NULL);
+
+    if(rdbLoadHeader(p) == PARSE_ERR) goto cleanup;
+    startParse(p);
+    if(rdbSkimChunks(p, &par, RDB_CHUNK_KEYS) == PARSE_ERR) goto cleanup;
+    if(rdbVerifyChecksum(p) == PARSE_ERR) goto cleanup;
+    /* the workers time themselves, ordered emits are not timed */
+    rdbClockStop(p);
+
+    rdbOpenAofs(p, aof_number, aof_filename, dump_aof);
+    par.slots = zcalloc(par.window * sizeof(rdbPairs));
+    par.ready = zcalloc(par.window * sizeof(int));
+    if((size_t)threads > par.nchunks) threads = par.nchunks;
+    workers = zcalloc(threads * sizeof(rdbWorker));
+    for(i = 0; i < threads; i++) {
+        rdbWorker *w = workers + i;
+        w->par = &par;
+        rdbParserReset(&w->p);
+        w->p.rdb_version = p->rdb_version;
+        w->p.timing = p->timing;
+        w->p.progress = p->progress;
+        w->p.filter = p->filter;
+        w->p.checksum = 0; /* the skim pass did it */
+        if(ordered) {
+            w->p.pending = &w->pending;
+        } else {
+            w->p.handler = p->handler;
+            w->p.format_handler = p->format_handler;
+            w->p.aof_set = p->aof_set;
+            w->p.aof_number = p->aof_number;
+            w->p.dump_aof = p->dump_aof;
+            w->p.aof_format = p->aof_format;
+            w->p.aof_batch = p->aof_batch;
+            w->p.shard = p->shard;
+            w->p.aof_lock = &par.aof_lock;
+        }
+        if((err = pthread_create(&w->thread, NULL, rdbWorkerMain, w)) != 0) {
+            fprintf(stderr, "pthread_create err :%s\n", strerror(err));
+            rdbParallelFail(&par);
+            break;
+        }
+        started++;
+    }
+    for(i = 0; i < started; i++) {
+        parserStats *ws = &workers[i].p.stats;
+        pthread_join(workers[i].thread, NULL);
+        for(j = 0; j < TOTAL_DATA_TYPES; j++) {
+            p->stats.parse_num[j] += ws->parse_num[j];
+            p->stats.type_bytes[j] += ws->type_bytes[j];
+        }
+        for(j = 0; j < RDB_PHASES; j++) {
+            p->stats.phase_ns[j] += ws->phase_ns[j];
+        }
+        p->stats.filtered += ws->filtered;
+        if(ws->largest_bytes > p->stats.largest_bytes) {
+            sdsfree(p->stats.largest_key);
+            p->stats.largest_key = ws->largest_key;
+            p->stats.largest_bytes = ws->largest_bytes;
+            p->stats.largest_type = ws->largest_type;
+            p->stats.largest_db = ws->largest_db;
+            ws->largest_key = NULL;
+        }
+    }
+    rdbClockStart(p);
+    rdbCloseAofs(p);
+    if(!par.failed) {
+        ret = PARSE_OK;
+        stopParse(p);
+    }
+
+cleanup:
+    for(i = 0; workers && i < threads; i++) {
+        rdbFreePairs(&workers[i].pending);
+        sdsfree(workers[i].p.aof_scratch);
+        sdsfree(workers[i].p.stats.largest_key);
+    }
+    for(i = 0; par.slots && (size_t)i < par.window; i++) {
+        rdbFreePairs(par.slots + i);
+    }
+    zfree(workers);
+    zfree(par.slots);
+    zfree(par.ready);
+    zfree(par.chunks);
+    pthread_mutex_destroy(&par.lock);
+    pthread_cond_destroy(&par.cond);
+    pthread_mutex_destroy(&par.aof_lock);
+    if(p->progress) progressEnd(p->progress);
+    rioClose(&p->rdb);
+    return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * Public API
+ *----------------------------------------------------------------------------*/
+
+rdbParser *rdbParserCreate(char *rdbFile) {
+    rdbParser *p = zcalloc(sizeof(*p));
+
+    p->filename = zstrdup(rdbFile);
+    rdbParserReset(p);
+    return p;
+}
+
+void rdbParserFree(rdbParser *p) {
+    if(!p) return;
+    free(p->stats.shards);
+    sdsfree(p->stats.largest_key);
+    rdbFilterFree(p->filter);
+    zfree(p->filename);
+    zfree(p);
+}
+
+/* Bytes buffered per aof file before a write, 0 for AOF_BUFFER_SIZE. */
+void rdbParserSetAofBuffer(rdbParser *p, size_t size) {
+    p->aof_buffer = size;
+}
+
+/* Text (format_handler) or RESP aof output, batch is the most items per
+ * RESP command, 0 for RESP_BATCH. */
+void rdbParserSetAofFormat(rdbParser *p, int format, unsigned int batch) {
+    p->aof_format = format;
+    p->aof_batch = batch;
+}
+
+void rdbParserSetTiming(rdbParser *p, int on) {
+    p->timing = on;
+}
+
+void rdbParserSetProgress(rdbParser *p, progressMeter *m) {
+    p->progress = m;
+}
+
+/* Threads writing the aof files, 0 for AOF_WRITERS. */
+void rdbParserSetAofWriters(rdbParser *p, int writers) {
+    p->aof_writers = writers;
+}
+
+/* Where RESP output of a key goes, NULL for shardByCrc64. Text output goes
+ * where format_handler says. */
+void rdbParserSetShard(rdbParser *p, shardFunc *shard) {
+    p->shard = shard;
+}
+
+/* View mode only: zset scores reach the handler as doubles in rdbStr.num,
+ * with a NULL ptr, instead of being formatted. */
+void rdbParserSetNativeScores(rdbParser *p, int on) {
+    p->native_scores = on;
+}
+
+static rdbFilter *rdbParserFilter(rdbParser *p) {
+    if(!p->filter) p->filter = rdbFilterCreate();
+    return p->filter;
+}
+
+void rdbParserFilterPattern(rdbParser *p, const char *pattern) {
+    rdbFilterAddPattern(rdbParserFilter(p), pattern, 0);
+}
+
+void rdbParserFilterPrefix(rdbParser *p, const char *prefix) {
+    rdbFilterAddPattern(rdbParserFilter(p), prefix, 1);
+}
+
+void rdbParserFilterType(rdbParser *p, int type) {
+    rdbParserFilter(p)->types |= 1 << type;
+}
+
+void rdbParserFilterDb(rdbParser *p, int dbid) {
+    rdbFilter *f = rdbParserFilter(p);
+
+    f->dbs = zrealloc(f->dbs, (f->ndbs + 1) * sizeof(uint32_t));
+    f->dbs[f->ndbs++] = dbid;
+}
+
+void rdbParserFilterExpire(rdbParser *p, time_t min, time_t max) {
+    rdbFilter *f = rdbParserFilter(p);
+
+    f->expire_range = 1;
+    f->expire_min = min;
+    f->expire_max = max;
+}
+
+int rdbParserParse(rdbParser *p, keyValueHandler handler, int aof_number, char *aof_filename, int dump_aof, format_kv_handler format_handler) {
+    rdbParserReset(p);
+    p->handler = handler;
+    p->format_handler = format_handler;
+    return rdbParseFile(p, aof_number, aof_filename, dump_aof);
+}
+
+int rdbParserParseView(rdbParser *p, keyValueViewHandler handler) {
+    rdbParserReset(p);
+    p->view_handler = handler;
+    return rdbParseFile(p, 0, NULL, -1);
+}
+
+int rdbParserParseScan(rdbParser *p, keyScanHandler handler, int flags) {
+    rdbParserReset(p);
+    p->scan_handler = handler;
+    p->scan_flags = flags;
+    return rdbParseFile(p, 0, NULL, -1);
+}
+
+int rdbParserParseMemory(rdbParser *p, keyMemoryHandler handler) {
+    rdbParserReset(p);
+    p->memory_handler = handler;
+    return rdbParseFile(p, 0, NULL, -1);
+}
+
+int rdbParserParseStream(rdbParser *p, rdbStreamHandler *handler) {
+    rdbParserReset(p);
+    p->stream = handler;
+    p->batch_size = handler->batch ? handler->batch : RDB_STREAM_BATCH;
+    /* keep zset and hash pairs in the same batch. */
+    p->batch_size += p->batch_size & 1;
+    return rdbParseFile(p, 0, NULL, -1);
+}
+
+int rdbParserParseParallel(rdbParser *p, keyValueHandler handler, int threads, int ordered,
+        int aof_number, char *aof_filename, int dump_aof, format_kv_handler format_handler) {
+    rdbParserReset(p);
+    p->handler = handler;
+    p->format_handler = format_handler;
+    return rdbParseFileParallel(p, threads, ordered, aof_number, aof_filename, dump_aof);
+}
+
+const parserStats *rdbParserGetStats(rdbParser *p) {
+    return &p->stats;
+}
+
+static const char *rdb_type_names[TOTAL_DATA_TYPES] = {"String", "List", "Set", "Zset", "Hash"};
+static const char *rdb_phase_names[RDB_PHASES] = {"io", "decode", "lzf", "expand", "handler", "format", "flush"};
+
+static long long rdbPhasesTotal(const parserStats *stats) {
+    long long total = 0;
+    int i;
+
+    for(i = 0; i < RDB_PHASES; i++) total += stats->phase_ns[i];
+    return total;
+}
+
+void rdbParserDumpInfo(rdbParser *p) {
+    const parserStats *stats = &p->stats;
+    long long total_nums = 0, phases = rdbPhasesTotal(stats);
+    double seconds = stats->elapsed_ns / 1e9;
+    sds name;
+    int i;
+    for(i = 0 ; i < TOTAL_DATA_TYPES; i++) {
+        total_nums += stats->parse_num[i];
+    }
+
+    printf("--------------------------------------------DUMP INFO------------------------------------------\n");
+    printf("Parser parse %ld bytes  cost %.3fs, %.2f MB/s.\n", (long) stats->total_bytes, seconds,
+            seconds > 0 ? stats->parsed_bytes / seconds / (1024 * 1024) : 0);
+    printf("Total parse %lld keys\n", total_nums);
+    for(i = 0; i < TOTAL_DATA_TYPES; i++)
+        printf("\t%ld %s keys, %lld bytes\n", stats->parse_num[i], rdb_type_names[i], stats->type_bytes[i]);
+    if(stats->largest_bytes) {
+        name = stats->largest_key ? sdscatrepr(sdsempty(), stats->largest_key, sdslen(stats->largest_key))
+            : sdsnew("(unreadable)");
+        printf("Largest key %s, %s in db %u, %lld bytes\n", name, rdb_type_names[stats->largest_type],
+                stats->largest_db, stats->largest_bytes);
+        sdsfree(name);
+    }
+    printf("%zu allocations, %ld major page faults\n", stats->allocations, stats->major_faults);
+    if(phases) {
+        printf("Time by phase:\n");
+        for(i = 0; i < RDB_PHASES; i++)
+            printf("\t%-8s %10.3fs %6.2f%%\n", rdb_phase_names[i], stats->phase_ns[i] / 1e9,
+                    100.0 * stats->phase_ns[i] / phases);
+    }
+    if(stats->filtered)
+        printf("Skipped %ld keys not matching the filter\n", stats->filtered);
+    if(stats->memory)
+        printf("Keys would take about %lld bytes of memory\n", stats->memory);
+    if(stats->aof.blocks)
+        printf("Aof wrote %lld bytes in %lld buffers, queue depth avg %.2f max %d, waited %lld times\n",
+                stats->aof.bytes, stats->aof.blocks,
+                (double)stats->aof.depth_sum / stats->aof.blocks,
+                stats->aof.max_depth, stats->aof.waits);
+    if(stats->nshards > 1) {
+        long long keys = 0, bytes = 0, max_keys = 0, max_bytes = 0;
+        for(i = 0; i < stats->nshards; i++) {
+            keys += stats->shards[i].keys;
+            bytes += stats->shards[i].bytes;
+            if(stats->shards[i].keys > max_keys) max_keys = stats->shards[i].keys;
+            if(stats->shards[i].bytes > max_bytes) max_bytes = stats->shards[i].bytes;
+        }
+        /* 1.00 is a perfect split */
+        printf("Aof files: %d, fullest has %.2fx the mean keys, %.2fx the mean bytes\n",
+                stats->nshards,
+                keys ? (double)max_keys * stats->nshards / keys : 0,
+                bytes ? (double)max_bytes * stats->nshards / bytes : 0);
+        for(i = 0; i < stats->nshards; i++)
+            printf("\t%d: %lld keys, %lld bytes\n", i, stats->shards[i].keys, stats->shards[i].bytes);
+    }
+    printf("--------------------------------------------DUMP INFO------------------------------------------\n");
+}
+
+static void rdbJsonString(FILE *fp, const char *s, size_t len) {
+    unsigned char c;
+    size_t i;
+
+    fputc('"', fp);
+    for(i = 0; i < len; i++) {
+        c = s[i];
+        if(c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+        else if(c < 0x20 || c >= 0x7f) fprintf(fp, "\\u%04x", c); /* a byte, not utf-8 */
+        else fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+int rdbParserDumpInfoJson(rdbParser *p, FILE *fp) {
+    const parserStats *stats = &p->stats;
+    int i;
+
+    fprintf(fp, "{\"file\":");
+    rdbJsonString(fp, p->filename, strlen(p->filename));
+    fprintf(fp, ",\"bytes\":%lld,\"parsed_bytes\":%lld,\"elapsed_ns\":%lld,\"keys\":{",
+            (long long)stats->total_bytes, (long long)stats->parsed_bytes, stats->elapsed_ns);
+    for(i = 0; i < TOTAL_DATA_TYPES; i++)
+        fprintf(fp, "%s\"%c%s\":{\"count\":%ld,\"bytes\":%lld}", i ? "," : "",
+                rdb_type_names[i][0] + 'a' - 'A', rdb_type_names[i] + 1,
+                stats->parse_num[i], stats->type_bytes[i]);
+    fprintf(fp, "},\"filtered\":%ld,\"largest_key\":", stats->filtered);
+    if(stats->largest_bytes) {
+        fprintf(fp, "{\"name\":");
+        if(stats->largest_key) rdbJsonString(fp, stats->largest_key, sdslen(stats->largest_key));
+        else fprintf(fp, "null");
+        fprintf(fp, ",\"type\":\"%c%s\",\"db\":%u,\"bytes\":%lld}",
+                rdb_type_names[stats->largest_type][0] + 'a' - 'A', rdb_type_names[stats->largest_type] + 1,
+                stats->largest_db, stats->largest_bytes);
+    } else {
+        fprintf(fp, "null");
+    }
+    fprintf(fp, ",\"allocations\":%zu,\"major_faults\":%ld,\"phases_ns\":",
+            stats->allocations, stats->major_faults);
+    if(rdbPhasesTotal(stats)) {
+        for(i = 0; i < RDB_PHASES; i++)
+            fprintf(fp, "%s\"%s\":%lld", i ? "," : "{", rdb_phase_names[i], stats->phase_ns[i]);
+        fprintf(fp, "}");
+    } else {
+        fprintf(fp, "null");
+    }
+    fprintf(fp, ",\"memory\":%lld,\"aof\":{\"bytes\":%lld,\"blocks\":%lld,\"waits\":%lld,\"max_depth\":%d}}\n",
+            stats->memory, stats->aof.bytes, stats->aof.blocks, stats->aof.waits, stats->aof.max_depth);
+    return ferror(fp) ? -1 : 0;
+}
+
+/* One shot helpers for callers that don't need the stats. */
+int rdbParse(char *rdbFile, keyValueHandler handler, int aof_number, char *aof_filename, int dump_aof, format_kv_handler format_handler) {
+    rdbParser *p = rdbParserCreate(rdbFile);
+    int ret = rdbParserParse(p, handler, aof_number, aof_filename, dump_aof, format_handler);
+    rdbParserFree(p);
+    return ret;
+}
+
+int rdbParseView(char *rdbFile, keyValueViewHandler handler) {
+    rdbParser *p = rdbParserCreate(rdbFile);
+    int ret = rdbParserParseView(p, handler);
+    rdbParserFree(p);
+    return ret;
+}
+
+int rdbParseParallel(char *rdbFile, keyValueHandler handler, int threads, int ordered,
+        int aof_number, char *aof_filename, int dump_aof, format_kv_handler format_handler) {
+    rdbParser *p = rdbParserCreate(rdbFile);
+    int ret = rdbParserParseParallel(p, handler, threads, ordered, aof_number, aof_filename, dump_aof, format_handler);
+    rdbParserFree(p);
+    return ret;
+}
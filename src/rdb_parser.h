@@ -15,6 +15,7 @@
 #define __RDB_PARSER_H_
 #include "main.h"
 #include "aof.h"
+#include "shard.h"
 
 #define STRING 0
 #define LIST 1
@@ -23,16 +24,194 @@
 #define HASH 4
 #define TOTAL_DATA_TYPES 5
 
+/* Phases the time of a parse is split into, with rdbParserSetTiming(). A
+ * phase nested in another (the handler called while a ziplist is streamed)
+ * is charged to the inner one only, so the phases add up to the parse. */
+#define RDB_PHASE_IO 0      /* waiting for input in read(2) */
+#define RDB_PHASE_DECODE 1  /* types, lengths, strings, and anything not below */
+#define RDB_PHASE_LZF 2     /* lzf_decompress */
+#define RDB_PHASE_EXPAND 3  /* ziplist, zipmap and intset blobs into elements */
+#define RDB_PHASE_HANDLER 4 /* the caller's handlers */
+#define RDB_PHASE_FORMAT 5  /* aof text or RESP of a key */
+#define RDB_PHASE_FLUSH 6   /* aof buffers handed to the writers, and drained */
+#define RDB_PHASES 7
+
 typedef struct {
     off_t total_bytes;
     off_t parsed_bytes;
     time_t start_time;
     time_t stop_time;
     long parse_num[TOTAL_DATA_TYPES];
+    long filtered; /* keys skipped by the filter */
+    AofStats aof;  /* aof writer queues, if -s */
+    AofShard *shards; /* keys and bytes per aof file, if -s */
+    int nshards;
+    long long memory; /* estimated bytes of the keys, in memory mode */
+    long long elapsed_ns; /* start to end, what start_time and stop_time round */
+    long long phase_ns[RDB_PHASES]; /* all 0 unless timed */
+    long long type_bytes[TOTAL_DATA_TYPES]; /* rdb bytes of the keys in parse_num */
+    sds largest_key;  /* key taking the most rdb bytes, NULL if none or unreadable */
+    long long largest_bytes;
+    int largest_type;
+    uint32_t largest_db;
+    size_t allocations; /* zmalloc calls during the parse, by any thread */
+    long major_faults;  /* page faults that read the disk, how mmap input waits */
 } parserStats;
 
 typedef void* keyValueHandler (int type, void *key, void *val,unsigned int vlen,time_t expiretime);
-void dumpParserInfo();
+
+/* A string handed to a keyValueViewHandler. It points into the input or into
+ * a parser scratch buffer and is only valid until the handler returns. With
+ * rdbParserSetNativeScores() zset scores have a NULL ptr and come in num. */
+typedef struct rdbStr {
+    const char *ptr;
+    size_t len;
+    double num;
+} rdbStr;
+
+/*
+ * Zero-copy variant of keyValueHandler, nothing is allocated per element.
+ * val is an array of vlen views laid out like the sds array passed to
+ * keyValueHandler, a STRING value is a single view (vlen == 1).
+ */
+typedef void* keyValueViewHandler (int type, rdbStr *key, rdbStr *val, unsigned int vlen, time_t expiretime);
+
+/*
+ * Scan mode handler, values are skipped without being decoded. key is only
+ * valid until the handler returns, and is NULL with RDB_SCAN_TYPES.
+ */
+typedef void* keyScanHandler (int type, rdbStr *key, time_t expiretime);
+
+/*
+ * Memory mode handler, see memory.h. Values are walked for their lengths
+ * only, nothing is copied. key is only valid until the handler returns.
+ */
+typedef struct rdbKeyMemory {
+    int type;              /* STRING, LIST, SET, ZSET or HASH */
+    int encoding;          /* REDIS_ENCODING_*, as redis would hold the value */
+    uint32_t dbid;
+    unsigned long elements; /* members or fields, 1 for a STRING */
+    size_t largest;        /* length of the longest element, or field or value */
+    size_t bytes;          /* estimated bytes, the key and its expire included */
+    size_t serialized;     /* bytes the value takes in the rdb file */
+    time_t expiretime;     /* unix time in milliseconds whatever the rdb version, or -1 */
+} rdbKeyMemory;
+
+typedef void* keyMemoryHandler (rdbStr *key, rdbKeyMemory *mem);
+
+#define RDB_SCAN_KEYS 0  /* key names, types and expire times */
+#define RDB_SCAN_TYPES 1 /* types and expire times only, keys are skipped too */
+
+/*
+ * Streaming handlers, for values too big to be handed over in one array.
+ * For every key begin() is called with the number of elements the value
+ * has (counted like vlen of keyValueHandler, a STRING has 1), then
+ * elements() with up to 'batch' of them at a time, then end(). ZSET and HASH
+ * pairs never straddle two batches. The elements are freed when elements()
+ * returns, the key when end() returns.
+ */
+typedef void* keyBeginHandler (int type, sds key, unsigned long len, time_t expiretime, void *privdata);
+typedef void* elementsHandler (int type, sds *elems, unsigned int count, void *privdata);
+typedef void* keyEndHandler (int type, sds key, void *privdata);
+
+/* default number of elements per elements() call */
+#define RDB_STREAM_BATCH 128
+
+typedef struct rdbStreamHandler {
+    keyBeginHandler *begin;
+    elementsHandler *elements;
+    keyEndHandler *end;
+    unsigned int batch; /* elements per elements() call, 0 for RDB_STREAM_BATCH */
+    void *privdata;
+} rdbStreamHandler;
+
+/* aof output formats: what format_handler returns, or the Redis protocol
+ * commands rebuilding each key (see resp.h) */
+#define RDB_AOF_TEXT 0
+#define RDB_AOF_RESP 1
+
+/* bytes of input between two additions to a progress meter, if the keys
+ * are too big for the 1000 keys between two to be often enough */
+#define RDB_PROGRESS_BYTES (16*1024*1024)
+
+/* keys per chunk handed to a worker by rdbParseParallel */
+#define RDB_CHUNK_KEYS 1024
+
+/*
+ * Parser context, one per rdb file. Nothing in the parser is global, so
+ * several files can be parsed at the same time from different threads, each
+ * with its own rdbParser.
+ */
+typedef struct rdbParser rdbParser;
+
+rdbParser *rdbParserCreate(char *rdbFile);
+void rdbParserFree(rdbParser *p);
+int rdbParserParse(rdbParser *p, keyValueHandler handler, int aof_number, char *aof_filename, int dump_aof, format_kv_handler format_handler);
+int rdbParserParseView(rdbParser *p, keyValueViewHandler handler);
+int rdbParserParseScan(rdbParser *p, keyScanHandler handler, int flags);
+int rdbParserParseStream(rdbParser *p, rdbStreamHandler *handler);
+int rdbParserParseMemory(rdbParser *p, keyMemoryHandler handler);
+void rdbParserSetAofBuffer(rdbParser *p, size_t size);
+void rdbParserSetAofWriters(rdbParser *p, int writers);
+void rdbParserSetAofFormat(rdbParser *p, int format, unsigned int batch);
+void rdbParserSetNativeScores(rdbParser *p, int on);
+void rdbParserSetShard(rdbParser *p, shardFunc *shard);
+
+/*
+ * Time the phases of the next parses into parserStats.phase_ns. Off by
+ * default, it costs two clock reads per handler call, LZF string and
+ * encoded value. With rdbParserParseParallel the phases of the workers are
+ * added up, and the handler, formatting and flush of ordered mode, done
+ * on behalf of the whole parse, are not timed.
+ */
+void rdbParserSetTiming(rdbParser *p, int on);
+
+/*
+ * Add the bytes and keys of the next parses to m as they go, for another
+ * thread to report (see progress.h). NULL to stop.
+ */
+struct progressMeter;
+void rdbParserSetProgress(rdbParser *p, struct progressMeter *m);
+
+/*
+ * Decode with 'threads' worker threads. If ordered is set the handler is
+ * called from one thread at a time in file order, like rdbParserParse does,
+ * otherwise it is called concurrently from every worker in no particular
+ * order. Falls back to rdbParserParse if the file can't be mapped.
+ */
+int rdbParserParseParallel(rdbParser *p, keyValueHandler handler, int threads, int ordered,
+        int aof_number, char *aof_filename, int dump_aof, format_kv_handler format_handler);
+
+/*
+ * Key filter, kept across parses. Keys that don't match are skipped without
+ * decoding their value. Calls of the same kind add alternatives (a key has
+ * to match one of the patterns or prefixes, one of the types, one of the
+ * dbs), different kinds must all match. The expire range is of unix times
+ * in milliseconds, whatever the rdb version. A key without an expire time
+ * has expiretime -1, so an expire range starting at -1 keeps those.
+ */
+typedef struct rdbFilter rdbFilter;
+void rdbParserFilterPattern(rdbParser *p, const char *pattern);
+void rdbParserFilterPrefix(rdbParser *p, const char *prefix);
+void rdbParserFilterType(rdbParser *p, int type);
+void rdbParserFilterDb(rdbParser *p, int dbid);
+void rdbParserFilterExpire(rdbParser *p, time_t min, time_t max);
+
+/* The length prefix at the cursor of rdb, with *isencoded set if it is an
+ * encoding type rather than a length. Exported for the microbenchmarks. */
+struct _rio;
+uint32_t rdbLoadLen(struct _rio *rdb, int *isencoded);
+
+/* stats of the last parse */
+const parserStats *rdbParserGetStats(rdbParser *p);
+void rdbParserDumpInfo(rdbParser *p);
+/* The same as a JSON object, -1 on write error. */
+int rdbParserDumpInfoJson(rdbParser *p, FILE *fp);
+
+/* One shot helpers: create a parser, parse, free it. */
 int rdbParse(char *rdbFile, keyValueHandler handler, int aof_number, char *aof_filename, int dump_aof, format_kv_handler format_handler);
+int rdbParseView(char *rdbFile, keyValueViewHandler handler);
+int rdbParseParallel(char *rdbFile, keyValueHandler handler, int threads, int ordered,
+        int aof_number, char *aof_filename, int dump_aof, format_kv_handler format_handler);
 
 #endif
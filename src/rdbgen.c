@@ -0,0 +1,545 @@
+/*
+ * rdbgen, writes a synthetic rdb file for benchmarks (make bench).
+ *
+ * The same options give the same file byte for byte: everything is drawn
+ * from a splitmix64 generator seeded with -s, and expire times are counted
+ * from -b rather than the clock. Values are encoded the way redis 2.4 saves
+ * them, with the ziplist, zipmap, intset and lzf code of this tree:
+ * collections within the default *-max-ziplist/zipmap/intset limits get the
+ * compact encoding, strings that look like integers are saved as integers
+ * and strings over 20 bytes are lzf compressed when that saves 4 bytes or
+ * more. -e picks which of these encodings may be used.
+ *
+ * Sizes are drawn from a distribution given as fixed:N, uniform:MIN:MAX or
+ * exp:MEAN (exponential, at least 1).
+ */
+#include "main.h"
+#include "rdb_parser.h"
+#include "crc64.h"
+#include "endian.h"
+#include "util.h"
+
+/* redis 2.4 defaults */
+#define GEN_ZIPMAP_ENTRIES 512
+#define GEN_ZIPMAP_VALUE 64
+#define GEN_ZIPLIST_ENTRIES 512
+#define GEN_ZIPLIST_VALUE 64
+#define GEN_INTSET_ENTRIES 512
+#define GEN_ZSET_ZIPLIST_ENTRIES 128
+#define GEN_ZSET_ZIPLIST_VALUE 64
+
+#define GEN_ENC_ZIPMAP (1 << 0)
+#define GEN_ENC_ZIPLIST (1 << 1)
+#define GEN_ENC_INTSET (1 << 2)
+#define GEN_ENC_LZF (1 << 3)
+#define GEN_ENC_INT (1 << 4)
+#define GEN_ENC_ALL 0x1f
+
+#define GEN_FIXED 0
+#define GEN_UNIFORM 1
+#define GEN_EXP 2
+
+typedef struct {
+    int kind;
+    unsigned long a, b;
+} genDist;
+
+typedef struct {
+    FILE *fp;
+    uint64_t crc;
+    unsigned long long bytes;
+    int version;
+    int encodings;
+    int intset_percent;     /* sets of integers */
+    int int_percent;        /* string values that are integers */
+    int compress_percent;   /* values made of a repeated pattern */
+    genDist values;
+    genDist elements;
+} genWriter;
+
+static uint64_t gen_state;
+static char *gen_progname = "rdb-gen";
+
+void _parsePanic(char *msg, char *file, int line) {
+    fprintf(stderr, "%s: %s #%s:%d\n", gen_progname, msg, file, line);
+}
+
+/* splitmix64 */
+static uint64_t genNext(void) {
+    uint64_t z = (gen_state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t genRange(uint64_t n) {
+    return n ? genNext() % n : 0;
+}
+
+static int genPercent(int percent) {
+    return (int)genRange(100) < percent;
+}
+
+static unsigned long genDraw(genDist *d) {
+    double u;
+
+    switch (d->kind) {
+        case GEN_UNIFORM:
+            return d->a + genRange(d->b - d->a + 1);
+        case GEN_EXP:
+            /* 53 random bits, u in (0, 1] */
+            u = ((genNext() >> 11) + 1) * (1.0 / 9007199254740992.0);
+            return 1 + (unsigned long)(-(double)(d->a > 1 ? d->a - 1 : 0) * log(u));
+        default:
+            return d->a;
+    }
+}
+
+static int genParseDist(const char *s, genDist *d) {
+    memset(d, 0, sizeof(*d));
+    if (sscanf(s, "fixed:%lu", &d->a) == 1) {
+        d->kind = GEN_FIXED;
+    } else if (sscanf(s, "uniform:%lu:%lu", &d->a, &d->b) == 2 && d->a <= d->b) {
+        d->kind = GEN_UNIFORM;
+    } else if (sscanf(s, "exp:%lu", &d->a) == 1) {
+        d->kind = GEN_EXP;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void genWrite(genWriter *w, const void *buf, size_t len) {
+    if (fwrite(buf, 1, len, w->fp) != len) {
+        fprintf(stderr, "write err :%s\n", strerror(errno));
+        exit(1);
+    }
+    w->crc = crc64(w->crc, buf, len);
+    w->bytes += len;
+}
+
+static void genWriteByte(genWriter *w, unsigned char c) {
+    genWrite(w, &c, 1);
+}
+
+static void genWriteLen(genWriter *w, uint32_t len) {
+    unsigned char buf[5];
+
+    if (len < (1 << 6)) {
+        buf[0] = (len & 0xff) | (REDIS_RDB_6BITLEN << 6);
+        genWrite(w, buf, 1);
+    } else if (len < (1 << 14)) {
+        buf[0] = ((len >> 8) & 0xff) | (REDIS_RDB_14BITLEN << 6);
+        buf[1] = len & 0xff;
+        genWrite(w, buf, 2);
+    } else {
+        buf[0] = REDIS_RDB_32BITLEN << 6;
+        len = htonl(len);
+        memcpy(buf + 1, &len, 4);
+        genWrite(w, buf, 5);
+    }
+}
+
+/* rdbSaveRawString(): integers, then lzf, then as is. */
+static void genWriteString(genWriter *w, const char *s, size_t len) {
+    unsigned char buf[5];
+    long long value;
+    size_t comprlen;
+    void *out;
+
+    if ((w->encodings & GEN_ENC_INT) && len <= 11 && string2ll((char *)s, len, &value)) {
+        if (value >= -(1 << 7) && value <= (1 << 7) - 1) {
+            buf[0] = (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_INT8;
+            buf[1] = value & 0xff;
+            genWrite(w, buf, 2);
+            return;
+        } else if (value >= -(1 << 15) && value <= (1 << 15) - 1) {
+            buf[0] = (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_INT16;
+            buf[1] = value & 0xff;
+            buf[2] = (value >> 8) & 0xff;
+            genWrite(w, buf, 3);
+            return;
+        } else if (value >= -((long long)1 << 31) && value <= ((long long)1 << 31) - 1) {
+            buf[0] = (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_INT32;
+            buf[1] = value & 0xff;
+            buf[2] = (value >> 8) & 0xff;
+            buf[3] = (value >> 16) & 0xff;
+            buf[4] = (value >> 24) & 0xff;
+            genWrite(w, buf, 5);
+            return;
+        }
+    }
+    if ((w->encodings & GEN_ENC_LZF) && len > 20) {
+        out = zmalloc(len);
+        comprlen = lzf_compress(s, len, out, len - 4);
+        if (comprlen > 0) {
+            genWriteByte(w, (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_LZF);
+            genWriteLen(w, comprlen);
+            genWriteLen(w, len);
+            genWrite(w, out, comprlen);
+            zfree(out);
+            return;
+        }
+        zfree(out);
+    }
+    genWriteLen(w, len);
+    genWrite(w, s, len);
+}
+
+/* rdbSaveDoubleValue() */
+static void genWriteDouble(genWriter *w, double value) {
+    char buf[128];
+    int len = snprintf(buf + 1, sizeof(buf) - 1, "%.17g", value);
+
+    buf[0] = len;
+    genWrite(w, buf, len + 1);
+}
+
+static void genWriteExpire(genWriter *w, long long seconds) {
+    int32_t t32;
+    int64_t t64;
+
+    genWriteByte(w, REDIS_EXPIRETIME);
+    if (w->version < 5) {
+        t32 = (int32_t)seconds;
+        memrev32ifbe(&t32);
+        genWrite(w, &t32, 4);
+    } else {
+        /* milliseconds from version 5 on */
+        t64 = seconds * 1000 + (long long)genRange(1000);
+        memrev64ifbe(&t64);
+        genWrite(w, &t64, 8);
+    }
+}
+
+/* A value of about len bytes after tag, which keeps elements apart. */
+static sds genValue(genWriter *w, const char *tag, size_t len) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    char pattern[16];
+    size_t i, plen;
+    sds s;
+
+    if (!tag && genPercent(w->int_percent))
+        return sdsfromlonglong((long long)genRange(2000000000) - 1000000000);
+    s = tag ? sdsnew(tag) : sdsempty();
+    if (sdslen(s) >= len) return s;
+    len -= sdslen(s);
+    s = sdsMakeRoomFor(s, len);
+    if (genPercent(w->compress_percent)) {
+        plen = 4 + genRange(sizeof(pattern) - 4);
+        for (i = 0; i < plen; i++) pattern[i] = alphabet[genRange(sizeof(alphabet) - 1)];
+        for (i = 0; i < len; i++) s[sdslen(s) + i] = pattern[i % plen];
+    } else {
+        for (i = 0; i < len; i++) s[sdslen(s) + i] = alphabet[genRange(sizeof(alphabet) - 1)];
+    }
+    sdsIncrLen(s, len);
+    return s;
+}
+
+static size_t genLongest(sds *elems, unsigned long count) {
+    size_t longest = 0;
+    unsigned long i;
+
+    for (i = 0; i < count; i++)
+        if (sdslen(elems[i]) > longest) longest = sdslen(elems[i]);
+    return longest;
+}
+
+static void genWriteBlob(genWriter *w, unsigned char *blob, size_t len) {
+    genWriteString(w, (char *)blob, len);
+    zfree(blob);
+}
+
+/* The type, then the key, then the value. */
+static void genWriteHeader(genWriter *w, int type, sds key) {
+    genWriteByte(w, type);
+    genWriteString(w, key, sdslen(key));
+}
+
+static void genWriteList(genWriter *w, sds key, sds *elems, unsigned long count) {
+    unsigned char *zl;
+    unsigned long i;
+
+    if ((w->encodings & GEN_ENC_ZIPLIST) && count <= GEN_ZIPLIST_ENTRIES &&
+            genLongest(elems, count) <= GEN_ZIPLIST_VALUE) {
+        genWriteHeader(w, REDIS_LIST_ZIPLIST, key);
+        zl = ziplistNew();
+        for (i = 0; i < count; i++)
+            zl = ziplistPush(zl, (unsigned char *)elems[i], sdslen(elems[i]), REDIS_TAIL);
+        genWriteBlob(w, zl, ziplistBlobLen(zl));
+        return;
+    }
+    genWriteHeader(w, REDIS_LIST, key);
+    genWriteLen(w, count);
+    for (i = 0; i < count; i++) genWriteString(w, elems[i], sdslen(elems[i]));
+}
+
+static void genWriteSet(genWriter *w, sds key, sds *elems, unsigned long count, int integers) {
+    unsigned long i;
+    long long value;
+    intset *is;
+
+    if (integers && (w->encodings & GEN_ENC_INTSET) && count <= GEN_INTSET_ENTRIES) {
+        genWriteHeader(w, REDIS_SET_INTSET, key);
+        is = intsetNew();
+        for (i = 0; i < count; i++) {
+            string2ll(elems[i], sdslen(elems[i]), &value);
+            is = intsetAdd(is, value, NULL);
+        }
+        genWriteBlob(w, (unsigned char *)is, intsetBlobLen(is));
+        return;
+    }
+    genWriteHeader(w, REDIS_SET, key);
+    genWriteLen(w, count);
+    for (i = 0; i < count; i++) genWriteString(w, elems[i], sdslen(elems[i]));
+}
+
+static void genWriteZset(genWriter *w, sds key, sds *elems, double *scores, unsigned long count) {
+    unsigned char *zl;
+    unsigned long i;
+    char buf[128];
+    int len;
+
+    if ((w->encodings & GEN_ENC_ZIPLIST) && count <= GEN_ZSET_ZIPLIST_ENTRIES &&
+            genLongest(elems, count) <= GEN_ZSET_ZIPLIST_VALUE) {
+        genWriteHeader(w, REDIS_ZSET_ZIPLIST, key);
+        zl = ziplistNew();
+        for (i = 0; i < count; i++) {
+            zl = ziplistPush(zl, (unsigned char *)elems[i], sdslen(elems[i]), REDIS_TAIL);
+            len = snprintf(buf, sizeof(buf), "%.17g", scores[i]);
+            zl = ziplistPush(zl, (unsigned char *)buf, len, REDIS_TAIL);
+        }
+        genWriteBlob(w, zl, ziplistBlobLen(zl));
+        return;
+    }
+    genWriteHeader(w, REDIS_ZSET, key);
+    genWriteLen(w, count);
+    for (i = 0; i < count; i++) {
+        genWriteString(w, elems[i], sdslen(elems[i]));
+        genWriteDouble(w, scores[i]);
+    }
+}
+
+/* elems holds field, value, field, value... */
+static void genWriteHash(genWriter *w, sds key, sds *elems, unsigned long count) {
+    unsigned char *zm;
+    unsigned long i;
+
+    if ((w->encodings & GEN_ENC_ZIPMAP) && count / 2 <= GEN_ZIPMAP_ENTRIES &&
+            genLongest(elems, count) <= GEN_ZIPMAP_VALUE) {
+        genWriteHeader(w, REDIS_HASH_ZIPMAP, key);
+        zm = zipmapNew();
+        for (i = 0; i < count; i += 2)
+            zm = zipmapSet(zm, (unsigned char *)elems[i], sdslen(elems[i]),
+                    (unsigned char *)elems[i + 1], sdslen(elems[i + 1]), NULL);
+        genWriteBlob(w, zm, zipmapBlobLen(zm));
+        return;
+    }
+    genWriteHeader(w, REDIS_HASH, key);
+    genWriteLen(w, count / 2);
+    for (i = 0; i < count; i++) genWriteString(w, elems[i], sdslen(elems[i]));
+}
+
+static void genWriteKey(genWriter *w, int type, sds key) {
+    unsigned long count = 1, n, i;
+    long long base, step;
+    double *scores = NULL;
+    sds *elems;
+    char tag[32];
+    int integers = 0;
+
+    if (type != REDIS_STRING && (count = genDraw(&w->elements)) == 0) count = 1;
+    n = type == REDIS_HASH ? count * 2 : count;
+    elems = zmalloc(n * sizeof(sds));
+    if (type == REDIS_SET && genPercent(w->intset_percent)) {
+        /* distinct integers, some fitting in 16 bits, some in 32, some not */
+        integers = 1;
+        step = 1 + genRange(1000);
+        switch (genRange(3)) {
+            case 0: base = genRange(10000); break;
+            case 1: base = genRange(1000000000); break;
+            default: base = (long long)genRange(1000000000) * 1000000000LL; break;
+        }
+        for (i = 0; i < count; i++) elems[i] = sdsfromlonglong(base + (long long)i * step);
+    } else {
+        for (i = 0; i < n; i++) {
+            /* members and fields are kept distinct by their index */
+            if (type == REDIS_SET || type == REDIS_ZSET || (type == REDIS_HASH && i % 2 == 0)) {
+                snprintf(tag, sizeof(tag), "%lu:", type == REDIS_HASH ? i / 2 : i);
+                elems[i] = genValue(w, tag, genDraw(&w->values));
+            } else {
+                elems[i] = genValue(w, NULL, genDraw(&w->values));
+            }
+        }
+    }
+    switch (type) {
+        case REDIS_STRING:
+            genWriteHeader(w, REDIS_STRING, key);
+            genWriteString(w, elems[0], sdslen(elems[0]));
+            break;
+        case REDIS_LIST:
+            genWriteList(w, key, elems, count);
+            break;
+        case REDIS_SET:
+            genWriteSet(w, key, elems, count, integers);
+            break;
+        case REDIS_ZSET:
+            /* integer scores half the time, they end up as ziplist integers */
+            scores = zmalloc(count * sizeof(double));
+            for (i = 0; i < count; i++)
+                scores[i] = genRange(2) ? (double)genRange(1000000) : genRange(100000000) / 1000.0;
+            genWriteZset(w, key, elems, scores, count);
+            zfree(scores);
+            break;
+        case REDIS_HASH:
+            genWriteHash(w, key, elems, n);
+            break;
+    }
+    for (i = 0; i < n; i++) sdsfree(elems[i]);
+    zfree(elems);
+}
+
+static int genParseMix(char *s, int *weights) {
+    static const char *names[TOTAL_DATA_TYPES] = {"string", "list", "set", "zset", "hash"};
+    char *tok, *colon;
+    int t, total = 0;
+
+    memset(weights, 0, TOTAL_DATA_TYPES * sizeof(int));
+    for (tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        if ((colon = strchr(tok, ':')) == NULL) return -1;
+        *colon = '\0';
+        for (t = 0; t < TOTAL_DATA_TYPES && strcmp(names[t], tok) != 0; t++);
+        if (t == TOTAL_DATA_TYPES || atoi(colon + 1) < 0) return -1;
+        weights[t] = atoi(colon + 1);
+        total += weights[t];
+    }
+    return total > 0 ? 0 : -1;
+}
+
+static int genParseEncodings(char *s) {
+    char *tok;
+    int encodings = 0;
+
+    if (strcmp(s, "none") == 0) return 0;
+    for (tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        if (strcmp(tok, "zipmap") == 0) encodings |= GEN_ENC_ZIPMAP;
+        else if (strcmp(tok, "ziplist") == 0) encodings |= GEN_ENC_ZIPLIST;
+        else if (strcmp(tok, "intset") == 0) encodings |= GEN_ENC_INTSET;
+        else if (strcmp(tok, "lzf") == 0) encodings |= GEN_ENC_LZF;
+        else if (strcmp(tok, "int") == 0) encodings |= GEN_ENC_INT;
+        else return -1;
+    }
+    return encodings;
+}
+
+static void genUsage(void) {
+    fprintf(stderr, "Usage: %s -o file [-n keys] [-s seed] [-V version] [-t mix] [-v sizes] [-l sizes]\n"
+            "\t[-e encodings] [-x percent] [-b time] [-d dbs] [-I percent] [-i percent] [-c percent]\n"
+            "\t-n keys.\n\t\t\tDefault: 100000\n"
+            "\t-s seed, the same seed and options give the same file.\n\t\t\tDefault: 1\n"
+            "\t-V rdb version, expire times are in seconds before 5, a checksum is added from 5 on.\n\t\t\tDefault: 6\n"
+            "\t-t type mix, as type:weight.\n\t\t\tDefault: string:40,list:15,set:15,zset:15,hash:15\n"
+            "\t-v value and member sizes, fixed:N, uniform:MIN:MAX or exp:MEAN.\n\t\t\tDefault: exp:24\n"
+            "\t-l elements per list, set, zset or hash, same forms.\n\t\t\tDefault: exp:16\n"
+            "\t-e encodings that may be used, some of zipmap,ziplist,intset,lzf,int, or none.\n\t\t\tDefault: all\n"
+            "\t-x percent of keys with an expire time.\n\t\t\tDefault: 10\n"
+            "\t-b unix time expire times are spread around (a day before to 30 days after).\n\t\t\tDefault: 1700000000\n"
+            "\t-d dbs the keys are spread over.\n\t\t\tDefault: 1\n"
+            "\t-I percent of sets made of integers.\n\t\t\tDefault: 30\n"
+            "\t-i percent of values (not members or fields) that are integers, saved as such with -e int.\n\t\t\tDefault: 10\n"
+            "\t-c percent of values made of a repeated pattern, which lzf compresses.\n\t\t\tDefault: 50\n",
+            gen_progname);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    static const char *names[TOTAL_DATA_TYPES] = {"string", "list", "set", "zset", "hash"};
+    char mix[] = "string:40,list:15,set:15,zset:15,hash:15";
+    char header[16], *filename = NULL;
+    unsigned long long keys = 100000, i, written[TOTAL_DATA_TYPES] = {0};
+    long long base = 1700000000;
+    int weights[TOTAL_DATA_TYPES], total, type, ch, expire_percent = 10, dbs = 1, db = -1;
+    int32_t auxlen = 0;
+    uint64_t checksum;
+    genWriter w;
+    sds key;
+
+    memset(&w, 0, sizeof(w));
+    w.version = 6;
+    w.encodings = GEN_ENC_ALL;
+    w.intset_percent = 30;
+    w.int_percent = 10;
+    w.compress_percent = 50;
+    genParseDist("exp:24", &w.values);
+    genParseDist("exp:16", &w.elements);
+    genParseMix(mix, weights);
+    gen_state = 1;
+    while ((ch = getopt(argc, argv, "o:n:s:V:t:v:l:e:x:b:d:I:i:c:")) != -1) {
+        switch (ch) {
+            case 'o': filename = optarg; break;
+            case 'n': keys = strtoull(optarg, NULL, 10); break;
+            case 's': gen_state = strtoull(optarg, NULL, 10); break;
+            case 'V':
+                w.version = atoi(optarg);
+                if (w.version < 1 || w.version > 6) genUsage();
+                break;
+            case 't': if (genParseMix(optarg, weights) == -1) genUsage(); break;
+            case 'v': if (genParseDist(optarg, &w.values) == -1) genUsage(); break;
+            case 'l': if (genParseDist(optarg, &w.elements) == -1) genUsage(); break;
+            case 'e': if ((w.encodings = genParseEncodings(optarg)) == -1) genUsage(); break;
+            case 'x': expire_percent = atoi(optarg); break;
+            case 'b': base = atoll(optarg); break;
+            case 'd': if ((dbs = atoi(optarg)) < 1) genUsage(); break;
+            case 'I': w.intset_percent = atoi(optarg); break;
+            case 'i': w.int_percent = atoi(optarg); break;
+            case 'c': w.compress_percent = atoi(optarg); break;
+            default: genUsage();
+        }
+    }
+    if (!filename) genUsage();
+    if ((w.fp = fopen(filename, "w")) == NULL) {
+        fprintf(stderr, "open %s err :%s\n", filename, strerror(errno));
+        exit(1);
+    }
+    setvbuf(w.fp, NULL, _IOFBF, 1 << 20);
+    for (type = 0, total = 0; type < TOTAL_DATA_TYPES; type++) total += weights[type];
+
+    /* the signature this parser reads, then an empty aux field */
+    snprintf(header, sizeof(header), "REDIS%03dc", w.version);
+    genWrite(&w, header, 9);
+    memrev32ifbe(&auxlen);
+    genWrite(&w, &auxlen, 4);
+    key = sdsempty();
+    for (i = 0; i < keys; i++) {
+        long long pick = genRange(total);
+        if ((int)(i * dbs / keys) != db) {
+            db = i * dbs / keys;
+            genWriteByte(&w, REDIS_SELECTDB);
+            genWriteLen(&w, db);
+        }
+        for (type = 0; pick >= weights[type]; type++) pick -= weights[type];
+        sdsclear(key);
+        key = sdscatprintf(key, "%s:%llu:%llu", names[type], i / 100, i);
+        if (genPercent(expire_percent))
+            genWriteExpire(&w, base - 86400 + (long long)genRange(31 * 86400));
+        genWriteKey(&w, type, key);
+        written[type]++;
+    }
+    sdsfree(key);
+    genWriteByte(&w, REDIS_EOF);
+    if (w.version >= 5) {
+        checksum = w.crc;
+        memrev64ifbe(&checksum);
+        genWrite(&w, &checksum, 8);
+    }
+    if (fclose(w.fp) != 0) {
+        fprintf(stderr, "write %s err :%s\n", filename, strerror(errno));
+        exit(1);
+    }
+    printf("%s: %llu keys, %llu bytes, version %d (", filename, keys, w.bytes, w.version);
+    for (type = 0; type < TOTAL_DATA_TYPES; type++)
+        printf("%s%llu %s", type ? ", " : "", written[type], names[type]);
+    printf(")\n");
+    return 0;
+}
@@ -8,21 +8,20 @@
 ***/
 
 #include "rediscounter.h"
-
-long long REDISCOUNTER_RDB_BLOCK = 10240;
-long _time_begin, _time_counter;
-unsigned int print_count = 0;
+#include "slotscan.h"
+#include <pthread.h>
 
 /**
  * @brief show_state
  * Show time used and msg.
+ * @param state
  * @param msg
  */
-void show_state(char * msg){
+void show_state(rdb_state * state, char * msg){
     long now = clock();
     fprintf(stdout, "now=%ld, time_total=%lfs, msg=%s",
             now,
-            (double)(now - _time_begin) / CLOCKS_PER_SEC,
+            (double)(now - state->time_begin) / CLOCKS_PER_SEC,
             msg);
 }
 unsigned char read_byte(FILE * fp){
@@ -202,10 +201,127 @@ eoferr:
 }
 
 /*-------block : read buffer size-------*/
-void adjust_block_size(long long entry_size){
-    fprintf(stdout, "REDISCOUNTER_RDB_BLOCK=%lld\n", REDISCOUNTER_RDB_BLOCK);
-    REDISCOUNTER_RDB_BLOCK = entry_size * ((REDISCOUNTER_RDB_BLOCK + entry_size - 1) / entry_size);
-    fprintf(stdout, "REDISCOUNTER_RDB_BLOCK=%lld\n", REDISCOUNTER_RDB_BLOCK);
+void adjust_block_size(rdb_state * state){
+    fprintf(stdout, "REDISCOUNTER_RDB_BLOCK=%lld\n", state->block_size);
+    state->block_size = state->entry_size * ((state->block_size + state->entry_size - 1) / state->entry_size);
+    fprintf(stdout, "REDISCOUNTER_RDB_BLOCK=%lld\n", state->block_size);
+}
+
+// what the entries of a range turned out to be.
+typedef struct dict_counts{
+    long long empty;
+    long long deleted;
+    long long other;
+    long long saved;
+}dict_counts;
+
+// where the saved keys of a range go. Without a lock they are added to the
+// aof files straight away, with one they are collected per file in pending
+// and added under the lock DICT_FLUSH bytes at a time.
+typedef struct dict_output{
+    Aof *aof_set;
+    int aof_number;
+    int dump_aof;
+    format_kv_handler *format_handler;
+    pthread_mutex_t *lock;
+    sds *pending;
+    long long *pending_keys;
+}dict_output;
+
+// pending bytes of an aof file a scan thread adds at once.
+#define DICT_FLUSH 65536
+
+static void dict_flush(dict_output *out, int i){
+    if(sdslen(out->pending[i]) == 0)
+        return;
+    pthread_mutex_lock(out->lock);
+    // a failed write is reported once by the aof.
+    if(add_aof_len(out->aof_set + i, out->pending[i], sdslen(out->pending[i])) == AOF_OK)
+        (out->aof_set + i)->shard.keys += out->pending_keys[i];
+    pthread_mutex_unlock(out->lock);
+    sdsclear(out->pending[i]);
+    out->pending_keys[i] = 0;
+}
+
+static void dict_emit(dict_output *out, char *key, int key_len, long value){
+    int hashed_key = 0;
+    char *tmp = out->format_handler(REDIS_COUNTER, 0, key, key_len, (void *)value, sizeof(value), &hashed_key, out->aof_number);
+
+    if(!tmp)
+        return;
+    if(hashed_key < 0 || hashed_key >= out->aof_number)
+        fprintf(stderr, "no aof file %d for key %s\n", hashed_key, key);
+    else if(out->lock){
+        out->pending[hashed_key] = sdscat(out->pending[hashed_key], tmp);
+        out->pending_keys[hashed_key]++;
+        if(sdslen(out->pending[hashed_key]) >= DICT_FLUSH)
+            dict_flush(out, hashed_key);
+    }
+    else if(add_aof(out->aof_set + hashed_key, tmp) == AOF_OK)
+        (out->aof_set + hashed_key)->shard.keys++;
+    free(tmp);
+}
+
+/**
+ * @brief dict_scan
+ * Classify 'entries' entries of buf and hand the saved ones to out. An
+ * entry is a 4 byte value followed by the key, NUL padded to key_size.
+ * Runs of all zero entries are skipped with one slotscan_zero call, and
+ * deleted keys are tested with slotscan_all, see slotscan.h.
+ * @param key
+ * key_size + 1 bytes of scratch space.
+ */
+static void dict_scan(rdb_state *state, const char *buf, long long entries, char *key,
+        dict_counts *counts, dict_output *out){
+    const char *entry = buf;
+    long long i, run;
+    int32_t value;
+    int key_len;
+
+    for(i = 0; i < entries; i++, entry += state->entry_size){
+        // an empty slot has no key, the ones after it are likely empty too.
+        if(entry[4] == '\0'){
+            run = slotscan_zero(entry, (entries - i) * state->entry_size) / state->entry_size;
+            if(run == 0)
+                run = 1;
+            counts->empty += run;
+            i += run - 1;
+            entry += (run - 1) * state->entry_size;
+            continue;
+        }
+        // a deleted one is all 'F'.
+        if(entry[4] == 'F' && slotscan_all(entry + 4, state->key_size, 'F')){
+            counts->deleted++;
+            continue;
+        }
+        memcpy(&value, entry, 4);
+        if(value < 1 || value > 100000000){
+            counts->other++;
+            continue;
+        }
+        counts->saved++;
+        if(out->dump_aof != 1)
+            continue;
+        key_len = strnlen(entry + 4, state->key_size);
+        memcpy(key, entry + 4, key_len);
+        key[key_len] = '\0';
+        dict_emit(out, key, key_len, value);
+    }
+}
+
+// the keys in the table should add up to state.used.
+static int dict_check(rdb_state *state, dict_counts *counts){
+    char buf[1024];
+
+    if(state->used != counts->deleted + counts->other + counts->saved){
+        fprintf(stderr, "parsed error, didn't read all the keys, still got:%lld\n",
+                state->used - (counts->deleted + counts->other + counts->saved));
+        return COUNTER_ERR;
+    }
+    sprintf(buf, "all done: saved_key=%lld deleted_key=%lld other_key=%lld\n",
+            counts->saved, counts->deleted, counts->other);
+    show_state(state, buf);
+    return COUNTER_OK;
 }
 
 /**
@@ -223,152 +339,224 @@ void adjust_block_size(long long entry_size){
  * @return
  */
 int rdb_load_dict(FILE *fp, rdb_state state, Aof * aof_set, format_kv_handler format_handler, int dump_aof, int aof_number) {
-    adjust_block_size(state.entry_size);
+    adjust_block_size(&state);
     long long total = state.size * state.entry_size,
-            count = total / REDISCOUNTER_RDB_BLOCK,
-            rest = total % REDISCOUNTER_RDB_BLOCK,
-            key_count,
-            read_offset = 0,
-            ndeleted_key = 0,
-            nother_key = 0,
-            boundary = REDISCOUNTER_RDB_BLOCK,
-            saved_key = 0;
-    sds empty_key = sdsnewlen(NULL, state.key_size),
-            deleted_key = sdsnewlen(NULL, state.key_size),
-            buf = sdsnewlen(NULL, REDISCOUNTER_RDB_BLOCK);//,
-    char *tmp = NULL;
-    int i, j, value;
-    char *key = (char *)malloc(sizeof(char) * state.key_size),
-            value_buf[4],
+            count = total / state.block_size,
+            rest = total % state.block_size,
+            key_count;
+    sds buf = sdsnewlen(NULL, state.block_size);
+    int i;
+    char *key = (char *)malloc(sizeof(char) * (state.key_size + 1)),
             state_buf[1024];
-    for(i = 0; i < state.key_size; i++){
-        empty_key[i] = '\0';
-        deleted_key[i] = 'F';
-    }
+    dict_counts counts;
+    dict_output out = {aof_set, aof_number, dump_aof, format_handler, NULL, NULL, NULL};
+
+    memset(&counts, 0, sizeof(counts));
     fprintf(stdout, "total=%lld, count=%lld, rest=%lld", total, count, rest);
     for(i = 0; i <= count; i++){
         if(i < count){
-            key_count = REDISCOUNTER_RDB_BLOCK / state.entry_size;
-            if (fread(buf,REDISCOUNTER_RDB_BLOCK,1,fp) == 0) {
-                sdsfree(buf);
+            key_count = state.block_size / state.entry_size;
+            if (fread(buf,state.block_size,1,fp) == 0) {
                 fprintf(stderr, "rdbLoadDict error: %s\n",strerror(errno));
-                return COUNTER_ERR;
+                goto err;
             }
         }
         else{
-            boundary = rest;
             key_count = rest / state.entry_size;
-            if (fread(buf,rest,1,fp) == 0) {
-                sdsfree(buf);
+            if (rest && fread(buf,rest,1,fp) == 0) {
                 fprintf(stderr, "rdbLoadDict error: %s\n",strerror(errno));
-                return COUNTER_ERR;
+                goto err;
             }
         }
         // show state
-        if(print_count > PRINT_BLOCK){
-            print_count = 0;
+        if(state.print_count > PRINT_BLOCK){
+            state.print_count = 0;
             sprintf(state_buf, "get dict, block_id=%d block_size=%lfM\n"
-                    "key_count=%lld\n", i, REDISCOUNTER_RDB_BLOCK / 1024.0 / 1024.0, key_count);
-            show_state(state_buf);
+                    "key_count=%lld\n", i, state.block_size / 1024.0 / 1024.0, key_count);
+            show_state(&state, state_buf);
         }
 
-        // time used...
-        read_offset = 0;
-        for(j = 0; j < key_count && read_offset < boundary; j++){
-            // get a value
-            if(strncpy(value_buf, buf + read_offset, 4) == NULL){
-                fprintf(stderr, "rdbLoadDict reading value_buf error: %s\n",strerror(errno));
-                goto err;
-            }
-            read_offset += 4;
-
-            // convert octonary number to long long
-            value = *(long long *)value_buf;
-            // get a key
-            if(strncpy(key, buf + read_offset, state.key_size) == NULL){
-                fprintf(stderr, "rdbLoadDict reading buf error: %s\n",strerror(errno));
-                goto err;
-            }
-            read_offset += state.key_size;
+        dict_scan(&state, buf, key_count, key, &counts, &out);
+        state.print_count += key_count;
+        if(state.progress)
+            progressAdd(state.progress, key_count * state.entry_size, key_count);
 
-            // check key
-            if(memcmp(key, empty_key, state.key_size) == 0){
-                continue;
-            }
-            if(memcmp(key, deleted_key, state.key_size) == 0){
-                ndeleted_key++;
-                continue;
-            }
-            if(value < 1 || value > 100000000){
-                nother_key++;
-                continue;
-            }
-            int hashed_key = 0;
-            if(dump_aof == 1)
-                tmp = format_handler(REDIS_COUNTER, 0, key, strlen(key), (void *)value, sizeof(value), &hashed_key, aof_number);
-            // write aof files if dump_aof is 1
-            if(dump_aof == 1 && add_aof(aof_set + hashed_key, tmp) == COUNTER_ERR)
-                fprintf(stderr, "add_aof error\n");
-            saved_key++;
-            //sdsfree(tmp);
-            if(tmp)
-                free(tmp);
-            print_count += key_count;
-        }
         // show parse
-        if(print_count > PRINT_BLOCK){
-            print_count = 0;
-            sprintf(buf, "\nblock_id=%d block_size=%lfM\n"
+        if(state.print_count > PRINT_BLOCK){
+            state.print_count = 0;
+            sprintf(state_buf, "\nblock_id=%d block_size=%lfM\n"
                     "key_count=%lld saved_key=%lld\n"
                     "deleted_key=%lld other_key=%lld\n"
                     "%lf%% finished\n\n",
-                    i, REDISCOUNTER_RDB_BLOCK / 1024.0 / 1024.0,
-                    key_count, saved_key,
-                    ndeleted_key, nother_key,
+                    i, state.block_size / 1024.0 / 1024.0,
+                    key_count, counts.saved,
+                    counts.deleted, counts.other,
                     count > i ? i * 100 / (double)count : 100);
-            show_state(buf);
+            show_state(&state, state_buf);
         }
     }
 
     // save the data in buffer
     for(i = 0; i < aof_number; i++){
-        // write aof files if dump_aof is 1        
-        if(print_count > PRINT_BLOCK){
-            print_count = 0;
-            sprintf(buf, "save buffer, filename=%s, len=%ld\n", (aof_set + i)->filename, (long unsigned int)strlen((aof_set + i)->buffer));
-            show_state(buf);
+        // write aof files if dump_aof is 1
+        if(state.print_count > PRINT_BLOCK){
+            state.print_count = 0;
+            sprintf(state_buf, "save buffer, filename=%s, len=%ld\n", (aof_set + i)->filename, (long unsigned int)(aof_set + i)->len);
+            show_state(&state, state_buf);
         }
-        if(dump_aof == 1 && save_aof(aof_set + i) == COUNTER_ERR)
+        if(dump_aof == 1 && save_aof(aof_set + i) == AOF_ERR)
             fprintf(stderr, "save_aof error\n");
-        sdsfree((aof_set + i)->buffer);
-        free((aof_set + i)->filename);
-        fclose((aof_set + i)->fp);
     }
 
     //check if all the keys parsed
-    if(state.used != ndeleted_key + nother_key + saved_key){
-        fprintf(stderr, "parsed error, didn't read all the keys, still got:%lld\n",state.used - (ndeleted_key + nother_key + saved_key));
+    if(dict_check(&state, &counts) == COUNTER_ERR)
         goto err;
-    }
-
-    // show all done info
-    sprintf(buf, "all done: saved_key=%lld deleted_key=%lld other_key=%lld\n", saved_key, ndeleted_key, nother_key);
-    show_state(buf);
 
     free(key);
-    sdsfree(empty_key);
-    sdsfree(deleted_key);
     sdsfree(buf);
     return COUNTER_OK;
 
 err:
     free(key);
-    sdsfree(empty_key);
-    sdsfree(deleted_key);
     sdsfree(buf);
     return COUNTER_ERR;
 }
 
+// a scan thread of rdb_load_dict_parallel and its share of the table.
+typedef struct dict_worker{
+    pthread_t thread;
+    int fd;
+    rdb_state *state;
+    off_t offset; // file offset of the first entry.
+    long long entries;
+    dict_counts counts;
+    dict_output out;
+    int err; // errno of a failed read, -1 for a short one.
+}dict_worker;
+
+static void *dict_worker_main(void *arg){
+    dict_worker *w = (dict_worker *)arg;
+    rdb_state *state = w->state;
+    long long block_entries = REDISCOUNTER_PARALLEL_BLOCK / state->entry_size, n;
+    size_t len, done;
+    ssize_t nread;
+    char *buf, *key;
+    off_t offset = w->offset;
+    int i;
+
+    if(block_entries < 1)
+        block_entries = 1;
+    buf = zmalloc(block_entries * state->entry_size);
+    key = zmalloc(state->key_size + 1);
+    while(w->entries){
+        n = w->entries < block_entries ? w->entries : block_entries;
+        len = n * state->entry_size;
+        for(done = 0; done < len; done += nread){
+            nread = pread(w->fd, buf + done, len - done, offset + done);
+            if(nread <= 0){
+                w->err = nread < 0 ? errno : -1;
+                goto out;
+            }
+        }
+        dict_scan(state, buf, n, key, &w->counts, &w->out);
+        if(state->progress)
+            progressAdd(state->progress, len, n);
+        offset += len;
+        w->entries -= n;
+    }
+out:
+    if(w->out.dump_aof == 1){
+        for(i = 0; i < w->out.aof_number; i++)
+            dict_flush(&w->out, i);
+    }
+    zfree(buf);
+    zfree(key);
+    return NULL;
+}
+
+/**
+ * @brief rdb_load_dict_parallel
+ * rdb_load_dict with 'threads' threads, each reading a contiguous range of
+ * the table with pread. Keys reach the aof files in no particular order.
+ * @param offset
+ * file offset of the table.
+ */
+int rdb_load_dict_parallel(int fd, off_t offset, rdb_state state, Aof * aof_set, format_kv_handler format_handler, int dump_aof, int aof_number, int threads) {
+    dict_worker *workers;
+    dict_counts counts;
+    pthread_mutex_t lock;
+    long long per, first = 0;
+    int i, j, err, ret = COUNTER_OK;
+    char buf[1024];
+
+    if(threads > state.size)
+        threads = state.size > 0 ? state.size : 1;
+    workers = zcalloc(sizeof(dict_worker) * threads);
+    pthread_mutex_init(&lock, NULL);
+    memset(&counts, 0, sizeof(counts));
+    sprintf(buf, "scanning %lld entries with %d threads\n", state.size, threads);
+    show_state(&state, buf);
+    per = state.size / threads;
+    for(i = 0; i < threads; i++){
+        dict_worker *w = workers + i;
+        w->fd = fd;
+        w->state = &state;
+        w->offset = offset + (off_t)first * state.entry_size;
+        w->entries = per + (i < state.size % threads);
+        first += w->entries;
+        w->out.aof_set = aof_set;
+        w->out.aof_number = aof_number;
+        w->out.dump_aof = dump_aof;
+        w->out.format_handler = format_handler;
+        w->out.lock = &lock;
+        if(dump_aof == 1){
+            w->out.pending = zmalloc(sizeof(sds) * aof_number);
+            w->out.pending_keys = zcalloc(sizeof(long long) * aof_number);
+            for(j = 0; j < aof_number; j++)
+                w->out.pending[j] = sdsempty();
+        }
+    }
+    for(i = 0; i < threads; i++){
+        if((err = pthread_create(&workers[i].thread, NULL, dict_worker_main, workers + i)) != 0){
+            fprintf(stderr, "rdbLoadDict can't create a thread: %s\n", strerror(err));
+            // the rest of the table is scanned on this thread.
+            for(j = i; j < threads; j++)
+                dict_worker_main(workers + j);
+            break;
+        }
+    }
+    for(j = 0; j < i; j++)
+        pthread_join(workers[j].thread, NULL);
+
+    for(i = 0; i < threads; i++){
+        dict_worker *w = workers + i;
+        if(w->err){
+            fprintf(stderr, "rdbLoadDict error: %s\n",
+                    w->err == -1 ? "unexpected end of file" : strerror(w->err));
+            ret = COUNTER_ERR;
+        }
+        counts.empty += w->counts.empty;
+        counts.deleted += w->counts.deleted;
+        counts.other += w->counts.other;
+        counts.saved += w->counts.saved;
+        if(w->out.pending){
+            for(j = 0; j < aof_number; j++)
+                sdsfree(w->out.pending[j]);
+            zfree(w->out.pending);
+            zfree(w->out.pending_keys);
+        }
+    }
+    zfree(workers);
+    pthread_mutex_destroy(&lock);
+    for(i = 0; i < aof_number; i++){
+        if(dump_aof == 1 && save_aof(aof_set + i) == AOF_ERR)
+            fprintf(stderr, "save_aof error\n");
+    }
+    if(ret == COUNTER_OK)
+        ret = dict_check(&state, &counts);
+    return ret;
+}
+
 /**
  * @brief rdb_load
  * Main function of this file
@@ -380,12 +568,24 @@ err:
  * aof file name
  * @param dump_aof
  * aof file numbers.
+ * @param aof_buffer
+ * bytes buffered per aof file, 0 for AOF_BUFFER_SIZE.
+ * @param aof_writers
+ * threads writing the aof files, 0 for AOF_WRITERS.
+ * @param threads
+ * threads scanning the table, see rdb_load_dict_parallel.
+ * @param progress
+ * meter of the table entries and bytes scanned, NULL for none.
  * @return
  */
-int rdb_load(char *filename, format_kv_handler format_handler, int aof_number, char *aof_filename, int dump_aof){
+int rdb_load(char *filename, format_kv_handler format_handler, int aof_number, char *aof_filename, int dump_aof, size_t aof_buffer, int aof_writers, int threads, progressMeter *progress){
+    rdb_state state;
+
     // init time recoders
-    _time_begin = clock();
-    show_state("parse begin...\n");
+    memset(&state, 0, sizeof(state));
+    state.time_begin = clock();
+    state.block_size = REDISCOUNTER_RDB_BLOCK;
+    show_state(&state, "parse begin...\n");
 
     if(!filename){
         fprintf(stderr, "Invalid filename\n");
@@ -393,6 +593,8 @@ int rdb_load(char *filename, format_kv_handler format_handler, int aof_number, c
     }
     FILE * fp;
     Aof * aof_set  = NULL;
+    AofStats aof_stats;
+    char buf[1024];
 
     fp = fopen(filename,"r");
     if (!fp) {
@@ -401,32 +603,64 @@ int rdb_load(char *filename, format_kv_handler format_handler, int aof_number, c
         goto err;
     }
 
-    rdb_state state;
     /*------ parse header section of rdb file ------*/
     if(init_rdb_state(&state, fp) == COUNTER_ERR){
         fprintf(stderr, "init_rdb_state failed\n");
         goto err;
     }
-    aof_set = set_aofs(aof_number, aof_filename);
+    state.progress = progress;
+    if(progress){
+        struct stat sb;
+        progressBegin(progress, fstat(fileno(fp), &sb) == 0 ? sb.st_size : 0);
+        // the header is behind us
+        progressAdd(progress, ftello(fp), 0);
+    }
+    aof_set = set_aofs(aof_number, aof_filename, aof_buffer, aof_writers);
     if(!aof_set){
         fprintf(stderr, "aof_set failed\n");
         goto err;
     }
 
     /*------ parse data section of rdb file ------*/
-    if(rdb_load_dict(fp, state, aof_set, format_handler, dump_aof, aof_number) == COUNTER_ERR){
+    if(threads > 1){
+        if(rdb_load_dict_parallel(fileno(fp), ftello(fp), state, aof_set, format_handler, dump_aof, aof_number, threads) == COUNTER_ERR){
+            fprintf(stderr, "rdbLoadDict failed\n");
+            goto err;
+        }
+    }
+    else if(rdb_load_dict(fp, state, aof_set, format_handler, dump_aof, aof_number) == COUNTER_ERR){
         fprintf(stderr, "rdbLoadDict failed\n");
         goto err;
     }
     // end of function
     fclose(fp);
     fp = NULL;
-    free(aof_set);
+    if(progress)
+        progressEnd(progress);
+    if(dump_aof == 1 && aof_number > 1){
+        int i;
+        for(i = 0; i < aof_number; i++){
+            sprintf(buf, "aof %d: keys=%lld bytes=%lld\n", i,
+                    (aof_set + i)->shard.keys, (aof_set + i)->shard.bytes);
+            show_state(&state, buf);
+        }
+    }
+    close_aofs(aof_set, aof_number, 0, &aof_stats);
+    if(dump_aof == 1 && aof_stats.blocks){
+        sprintf(buf, "aof: bytes=%lld buffers=%lld queue_depth_avg=%.2f queue_depth_max=%d waits=%lld\n",
+                aof_stats.bytes, aof_stats.blocks,
+                (double)aof_stats.depth_sum / aof_stats.blocks,
+                aof_stats.max_depth, aof_stats.waits);
+        show_state(&state, buf);
+    }
     return COUNTER_OK;
 
 err:
-    fclose(fp);
-    free(aof_set);
+    if(fp)
+        fclose(fp);
+    if(progress)
+        progressEnd(progress);
+    close_aofs(aof_set, aof_number, 0, NULL);
     return COUNTER_ERR;
 }
 
@@ -11,6 +11,7 @@
 #define REDISCOUNTER_H
 #include "main.h"
 #include "aof.h"
+#include "progress.h"
 
 
 
@@ -28,6 +29,10 @@ typedef struct rdb_state{
     long long entry_size;
     long long value_size;
     sds rdb_filename;
+    long long block_size; // read buffer size, a multiple of entry_size
+    long time_begin; // clock() when rdb_load started
+    unsigned int print_count; // keys since state was last shown
+    progressMeter *progress; // entries and bytes scanned go here, NULL for none
 }rdb_state;
 
 /**
@@ -41,9 +46,21 @@ typedef struct rdb_state{
  * aof file name
  * @param dump_aof
  * aof file numbers.
+ * @param aof_buffer
+ * bytes buffered per aof file, 0 for AOF_BUFFER_SIZE.
+ * @param aof_writers
+ * threads writing the aof files, 0 for AOF_WRITERS.
+ * @param threads
+ * threads scanning the table, each one reads its own range of entries.
+ * @param progress
+ * meter of the table entries and bytes scanned, NULL for none.
  * @return
  */
-int rdb_load(char *filename, format_kv_handler handler, int aof_number, char *aof_filename, int dump_aof);
+int rdb_load(char *filename, format_kv_handler handler, int aof_number, char *aof_filename, int dump_aof, size_t aof_buffer, int aof_writers, int threads, progressMeter *progress);
+// default read buffer size
+#define REDISCOUNTER_RDB_BLOCK 10240
+// bytes a scan thread reads at once, rounded down to whole entries
+#define REDISCOUNTER_PARALLEL_BLOCK (1024*1024)
 // print state every PRINT_BLOCK keys
 #define PRINT_BLOCK 50000000
 #define RDB_INVALID_LEN 252
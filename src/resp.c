@@ -0,0 +1,161 @@
+/*
+ * resp, a writer for the Redis protocol. See resp.h.
+ */
+#include "resp.h"
+#include "util.h"
+
+#define RESP_SELECT "$6\r\nSELECT\r\n"
+#define RESP_PEXPIREAT "$9\r\nPEXPIREAT\r\n"
+
+/* The command rebuilding each type, indexed by REDIS_STRING... REDIS_HASH. */
+static const struct {
+    const char *name; /* as a bulk string */
+    size_t len;
+    unsigned int width; /* sds per item */
+} respCommands[] = {
+    {"$3\r\nSET\r\n", 9, 1},
+    {"$5\r\nRPUSH\r\n", 11, 1},
+    {"$4\r\nSADD\r\n", 10, 1},
+    {"$4\r\nZADD\r\n", 10, 2},
+    {"$5\r\nHMSET\r\n", 11, 2}
+};
+
+/* "*<n>\r\n" and "$<len>\r\n<len bytes>\r\n". */
+static inline size_t respHeaderLen(uint64_t n) {
+    return digits10(n) + 3;
+}
+
+static inline size_t respBulkLen(size_t len) {
+    return respHeaderLen(len) + len + 2;
+}
+
+static inline char *respWriteHeader(char *p, char prefix, uint64_t n) {
+    uint32_t digits = digits10(n);
+
+    *p++ = prefix;
+    ull2digits(p, n, digits);
+    p += digits;
+    *p++ = '\r';
+    *p++ = '\n';
+    return p;
+}
+
+static inline char *respWriteBulk(char *p, const char *s, size_t len) {
+    p = respWriteHeader(p, '$', len);
+    memcpy(p, s, len);
+    p += len;
+    *p++ = '\r';
+    *p++ = '\n';
+    return p;
+}
+
+static inline char *respWriteRaw(char *p, const char *s, size_t len) {
+    memcpy(p, s, len);
+    return p + len;
+}
+
+size_t respPairLen(int type, sds key, void *val, unsigned int vlen,
+        long long expire_ms, unsigned int batch) {
+    sds *elems = val;
+    size_t keylen = respBulkLen(sdslen(key)), len = 0, items, n, i;
+    unsigned int width;
+
+    if (type < REDIS_STRING || type > REDIS_HASH) return 0;
+    width = respCommands[type].width;
+    if (type == REDIS_STRING) {
+        len = respHeaderLen(3) + respCommands[type].len + keylen +
+            respBulkLen(sdslen((sds)val));
+    } else {
+        if (batch == 0) batch = RESP_BATCH;
+        /* redis has no empty collections, nothing to write. */
+        if ((items = vlen / width) == 0) return 0;
+        for (i = 0; i < items; i += n) {
+            n = items - i < batch ? items - i : batch;
+            len += respHeaderLen(2 + n * width) + respCommands[type].len + keylen;
+        }
+        for (i = 0; i < items * width; i++) len += respBulkLen(sdslen(elems[i]));
+    }
+    if (expire_ms >= 0) {
+        len += respHeaderLen(3) + sizeof(RESP_PEXPIREAT) - 1 + keylen +
+            respBulkLen(digits10(expire_ms));
+    }
+    return len;
+}
+
+sds respAppendPair(sds s, int type, sds key, void *val, unsigned int vlen,
+        long long expire_ms, unsigned int batch) {
+    sds *elems = val;
+    size_t len = respPairLen(type, key, val, vlen, expire_ms, batch);
+    size_t items, n, i, j, incr;
+    unsigned int width;
+    char *p;
+
+    if (len == 0) return s;
+    s = sdsMakeRoomFor(s, len);
+    p = s + sdslen(s);
+    width = respCommands[type].width;
+    if (type == REDIS_STRING) {
+        p = respWriteHeader(p, '*', 3);
+        p = respWriteRaw(p, respCommands[type].name, respCommands[type].len);
+        p = respWriteBulk(p, key, sdslen(key));
+        p = respWriteBulk(p, (sds)val, sdslen((sds)val));
+    } else {
+        if (batch == 0) batch = RESP_BATCH;
+        items = vlen / width;
+        for (i = 0; i < items; i += n) {
+            n = items - i < batch ? items - i : batch;
+            p = respWriteHeader(p, '*', 2 + n * width);
+            p = respWriteRaw(p, respCommands[type].name, respCommands[type].len);
+            p = respWriteBulk(p, key, sdslen(key));
+            for (j = i * width; j < (i + n) * width; j += width) {
+                if (type == REDIS_ZSET) {
+                    /* the parser gives member then score, ZADD wants it the
+                     * other way around. */
+                    p = respWriteBulk(p, elems[j+1], sdslen(elems[j+1]));
+                    p = respWriteBulk(p, elems[j], sdslen(elems[j]));
+                } else if (width == 2) {
+                    p = respWriteBulk(p, elems[j], sdslen(elems[j]));
+                    p = respWriteBulk(p, elems[j+1], sdslen(elems[j+1]));
+                } else {
+                    p = respWriteBulk(p, elems[j], sdslen(elems[j]));
+                }
+            }
+        }
+    }
+    if (expire_ms >= 0) {
+        p = respWriteHeader(p, '*', 3);
+        p = respWriteRaw(p, RESP_PEXPIREAT, sizeof(RESP_PEXPIREAT) - 1);
+        p = respWriteBulk(p, key, sdslen(key));
+        p = respWriteHeader(p, '$', digits10(expire_ms));
+        ull2digits(p, expire_ms, digits10(expire_ms));
+        p += digits10(expire_ms);
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+    if ((size_t)(p - (s + sdslen(s))) != len) parsePanic("resp length mismatch");
+    /* sdsIncrLen takes an int. */
+    while (len) {
+        incr = len > INT_MAX ? INT_MAX : len;
+        sdsIncrLen(s, incr);
+        len -= incr;
+    }
+    return s;
+}
+
+sds respAppendSelect(sds s, unsigned int dbid) {
+    size_t len = respHeaderLen(2) + sizeof(RESP_SELECT) - 1 +
+        respBulkLen(digits10(dbid));
+    char *p;
+
+    s = sdsMakeRoomFor(s, len);
+    p = s + sdslen(s);
+    p = respWriteHeader(p, '*', 2);
+    p = respWriteRaw(p, RESP_SELECT, sizeof(RESP_SELECT) - 1);
+    p = respWriteHeader(p, '$', digits10(dbid));
+    ull2digits(p, dbid, digits10(dbid));
+    p += digits10(dbid);
+    *p++ = '\r';
+    *p++ = '\n';
+    sdsIncrLen(s, len);
+    return s;
+}
@@ -0,0 +1,44 @@
+/*
+ * resp, a writer for the Redis protocol: keys decoded by the rdb parser are
+ * turned into the commands that rebuild them, in the form redis-cli --pipe
+ * (or a replayed aof file) takes.
+ *
+ *   STRING  SET key value
+ *   LIST    RPUSH key elem [elem ...]
+ *   SET     SADD key member [member ...]
+ *   ZSET    ZADD key score member [score member ...]
+ *   HASH    HMSET key field value [field value ...]
+ *
+ * followed by PEXPIREAT key ms when the key has an expire time. Collections
+ * are split into several variadic commands of at most 'batch' items each (an
+ * item being an element, a member with its score or a field with its value),
+ * so a huge key never turns into one huge command. HMSET rather than the
+ * variadic HSET of redis 4.0, so the output replays into 2.x servers too.
+ *
+ * The size of the output is computed first and every command written with
+ * memcpy and a table driven integer encoder, no printf.
+ */
+#ifndef __RESP_H_
+#define __RESP_H_
+#include "main.h"
+
+/* default items per variadic command */
+#define RESP_BATCH 64
+
+/* Bytes respAppendPair() adds for this key. */
+size_t respPairLen(int type, sds key, void *val, unsigned int vlen,
+        long long expire_ms, unsigned int batch);
+
+/*
+ * Append the commands for one key, as the parser hands it to keyValueHandler
+ * (val is an sds for STRING, an array of vlen sds otherwise, members and
+ * scores / fields and values alternating). expire_ms is -1 for no expire
+ * time, batch 0 for RESP_BATCH.
+ */
+sds respAppendPair(sds s, int type, sds key, void *val, unsigned int vlen,
+        long long expire_ms, unsigned int batch);
+
+/* Append SELECT dbid. */
+sds respAppendSelect(sds s, unsigned int dbid);
+
+#endif
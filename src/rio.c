@@ -0,0 +1,176 @@
+/*
+ * rio, the input layer used by the rdb parser. See rio.h.
+ */
+#include "rio.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+/* ----------------------------- mmap backend ----------------------------- */
+
+static int rioMmapFill(rio *r, size_t need) {
+    /* The window already is the whole file. */
+    (void) r;
+    (void) need;
+    return 0;
+}
+
+static void rioMmapClose(rio *r) {
+    if (r->io.mmap.map) munmap(r->io.mmap.map, r->io.mmap.len);
+    r->io.mmap.map = NULL;
+}
+
+int rioInitWithMmap(rio *r, int fd) {
+    struct stat sb;
+    void *map;
+
+    if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_size == 0)
+        return PARSE_ERR;
+    if ((off_t)(size_t)sb.st_size != sb.st_size) return PARSE_ERR;
+    /* Private writable mapping: a few decoders (zipmapLen) cache things
+     * inside the blob they read, that must never reach the file. Only the
+     * few pages written get a private copy, so don't have the whole file
+     * counted against the commit limit, a big dump would fail to map under
+     * strict or heuristic overcommit. */
+    map = mmap(NULL, sb.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_NORESERVE, fd, 0);
+    if (map == MAP_FAILED) return PARSE_ERR;
+    madvise(map, sb.st_size, MADV_SEQUENTIAL);
+
+    memset(r, 0, sizeof(*r));
+    r->fill = rioMmapFill;
+    r->close = rioMmapClose;
+    r->fd = fd;
+    r->io.mmap.map = map;
+    r->io.mmap.len = sb.st_size;
+    r->mark = -1;
+    r->buf = r->pos = r->cksum_pos = map;
+    r->end = r->buf + sb.st_size;
+    r->size = sb.st_size;
+    return PARSE_OK;
+}
+
+/* --------------------------- buffered backend --------------------------- */
+
+static int rioBufferFill(rio *r, size_t need) {
+    unsigned char *from = r->pos;
+    size_t shift, used, cap;
+    ssize_t nread;
+
+    /* Slide the bytes still needed (the unread tail, or everything after
+     * the mark) to the front of the buffer. Whatever is before the cursor
+     * is consumed, so fold it into the checksum first. */
+    rioUpdateChecksum(r);
+    if (r->mark != -1) from = rioPtrAt(r, r->mark);
+    if ((shift = from - r->buf) != 0) {
+        memmove(r->buf, from, r->end - from);
+        r->offset += shift;
+        r->pos -= shift;
+        r->end -= shift;
+    }
+    used = r->pos - r->buf;
+    if (used + need > r->io.buffered.cap) {
+        cap = r->io.buffered.cap * 2;
+        if (cap < used + need) cap = used + need;
+        shift = r->end - r->buf;
+        r->buf = zrealloc(r->buf, cap);
+        r->io.buffered.cap = cap;
+        r->pos = r->buf + used;
+        r->end = r->buf + shift;
+    }
+    r->cksum_pos = r->pos;
+    while ((size_t)(r->end - r->pos) < need) {
+        nread = read(r->fd, r->end, r->io.buffered.cap - (r->end - r->buf));
+        if (nread == -1 && errno == EINTR) continue;
+        if (nread <= 0) return 0;
+        r->end += nread;
+    }
+    return 1;
+}
+
+static void rioBufferClose(rio *r) {
+    zfree(r->buf);
+    r->buf = NULL;
+}
+
+int rioInitWithBuffer(rio *r, int fd) {
+    struct stat sb;
+
+    memset(r, 0, sizeof(*r));
+    r->fill = rioBufferFill;
+    r->close = rioBufferClose;
+    r->fd = fd;
+    r->mark = -1;
+    r->io.buffered.cap = RIO_BUFFER_SIZE;
+    r->buf = r->pos = r->end = r->cksum_pos = zmalloc(RIO_BUFFER_SIZE);
+    if (fstat(fd, &sb) != -1 && S_ISREG(sb.st_mode)) r->size = sb.st_size;
+    return PARSE_OK;
+}
+
+/* ---------------------------- memory backend ---------------------------- */
+
+static int rioMemoryFill(rio *r, size_t need) {
+    (void) r;
+    (void) need;
+    return 0;
+}
+
+static void rioMemoryClose(rio *r) {
+    (void) r;
+}
+
+/* 'buf' holds the 'len' input bytes starting at file offset 'offset'. */
+void rioInitWithMemory(rio *r, void *buf, size_t len, off_t offset) {
+    memset(r, 0, sizeof(*r));
+    r->fill = rioMemoryFill;
+    r->close = rioMemoryClose;
+    r->fd = -1;
+    r->mark = -1;
+    r->buf = r->pos = r->cksum_pos = buf;
+    r->end = r->buf + len;
+    r->offset = offset;
+    r->size = offset + len;
+}
+
+/* ------------------------------------------------------------------------ */
+
+int rioSkipSlow(rio *r, size_t len) {
+    size_t avail;
+
+    while ((avail = r->end - r->pos) < len) {
+        r->pos = r->end;
+        len -= avail;
+        /* Don't let the window grow to the size of what we skip. */
+        if (!r->fill(r, len < RIO_BUFFER_SIZE ? len : RIO_BUFFER_SIZE)) return 0;
+    }
+    r->pos += len;
+    return 1;
+}
+
+int rioOpen(rio *r, const char *filename, int backend) {
+    struct stat sb;
+    int fd, err;
+
+    if ((fd = open(filename, O_RDONLY)) == -1) return PARSE_ERR;
+    if (backend != RIO_BACKEND_BUFFERED) {
+        if (rioInitWithMmap(r, fd) == PARSE_OK) return PARSE_OK;
+        err = errno;
+        if (backend == RIO_BACKEND_MMAP) {
+            close(fd);
+            return PARSE_ERR;
+        }
+        /* pipes and empty files are read, say so only of a file that
+         * should have been mapped */
+        if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size != 0)
+            fprintf(stderr, "mmap %s err :%s, reading it instead\n", filename, strerror(err));
+    }
+    return rioInitWithBuffer(r, fd);
+}
+
+void rioClose(rio *r) {
+    r->close(r);
+    if (r->fd != -1) close(r->fd);
+    r->fd = -1;
+}
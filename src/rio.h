@@ -0,0 +1,135 @@
+/*
+ * rio, the input layer used by the rdb parser.
+ *
+ * A rio is a read cursor over a window of bytes. Decoders ask for the next
+ * n bytes with rioNext() and get a pointer straight into the window, so the
+ * common case (the bytes are already there) is a compare and an add. When
+ * the window runs dry the backend's fill() is called to make more bytes
+ * available. Two backends are provided:
+ *
+ * 1. mmap: the whole file is mapped once (with MADV_SEQUENTIAL) and the
+ *    window is the mapping, fill() never has anything more to give.
+ * 2. buffered: a large buffer refilled with read(2), for inputs that can't
+ *    be mapped (pipes, or when mmap fails).
+ * 3. memory: a range of bytes somebody else owns, used to give each worker
+ *    of a parallel parse its own cursor over a slice of one mapping.
+ *
+ * The crc64 of everything consumed is kept in cksum. It is folded lazily,
+ * call rioUpdateChecksum() / rioChecksum() to bring it up to date.
+ *
+ * rioMark() pins the input from the current offset on: until rioUnmark()
+ * the buffered backend keeps those bytes in the window (growing it if it
+ * must), so they can still be addressed with rioPtrAt(). The window may
+ * move while marked, so only offsets are stable, never pointers.
+ */
+#ifndef __RIO_H_
+#define __RIO_H_
+#include "main.h"
+#include "crc64.h"
+
+#define RIO_BACKEND_AUTO 0     /* try mmap, fall back to buffered */
+#define RIO_BACKEND_MMAP 1
+#define RIO_BACKEND_BUFFERED 2
+
+#ifndef RIO_BUFFER_SIZE
+#define RIO_BUFFER_SIZE (1024*1024)
+#endif
+
+typedef struct _rio {
+    /* Make at least 'need' unread bytes available after pos, return 0 if
+     * the input is exhausted before that. */
+    int (*fill)(struct _rio *r, size_t need);
+    void (*close)(struct _rio *r);
+    unsigned char *buf; /* start of the window */
+    unsigned char *pos; /* read cursor */
+    unsigned char *end; /* end of the valid bytes in the window */
+    unsigned char *cksum_pos; /* [cksum_pos,pos) is not in cksum yet */
+    uint64_t cksum;
+    off_t offset; /* file offset of buf[0] */
+    off_t mark;   /* bytes from this offset on are kept, -1 if unmarked */
+    off_t size;   /* input size in bytes, 0 if unknown */
+    int fd;
+    union {
+        struct {
+            size_t cap;
+        } buffered;
+        struct {
+            void *map;
+            size_t len;
+        } mmap;
+    } io;
+} rio;
+
+int rioOpen(rio *r, const char *filename, int backend);
+int rioInitWithMmap(rio *r, int fd);
+int rioInitWithBuffer(rio *r, int fd);
+void rioInitWithMemory(rio *r, void *buf, size_t len, off_t offset);
+int rioSkipSlow(rio *r, size_t len);
+void rioClose(rio *r);
+
+/* Fold the bytes consumed since the last call into the checksum. */
+static inline void rioUpdateChecksum(rio *r) {
+    if (r->pos != r->cksum_pos) {
+        r->cksum = crc64(r->cksum, r->cksum_pos, r->pos - r->cksum_pos);
+        r->cksum_pos = r->pos;
+    }
+}
+
+/* Same, but only once enough bytes are pending for the wide crc64 engines
+ * to pay off while the bytes are still in cache. */
+#define RIO_CKSUM_CHUNK (16*1024)
+static inline void rioUpdateChecksumLazy(rio *r) {
+    if (r->pos - r->cksum_pos >= RIO_CKSUM_CHUNK) rioUpdateChecksum(r);
+}
+
+static inline uint64_t rioChecksum(rio *r) {
+    rioUpdateChecksum(r);
+    return r->cksum;
+}
+
+/* Return a pointer to the next 'len' bytes and move the cursor past them,
+ * or NULL on a short read. The pointer is valid until the next call. */
+static inline unsigned char *rioNext(rio *r, size_t len) {
+    unsigned char *p;
+
+    if ((size_t)(r->end - r->pos) < len && !r->fill(r, len)) return NULL;
+    p = r->pos;
+    r->pos += len;
+    return p;
+}
+
+/* Move the cursor 'len' bytes forward, return 0 on a short read. Unlike
+ * rioNext() this never needs 'len' bytes in the window at once. */
+static inline int rioSkip(rio *r, size_t len) {
+    if ((size_t)(r->end - r->pos) < len) return rioSkipSlow(r, len);
+    r->pos += len;
+    return 1;
+}
+
+/* fread() like helper, return 1 if 'len' bytes are copied to 'buf'. */
+static inline int rioRead(rio *r, void *buf, size_t len) {
+    unsigned char *p;
+
+    if ((p = rioNext(r, len)) == NULL) return 0;
+    memcpy(buf, p, len);
+    return 1;
+}
+
+static inline off_t rioTell(rio *r) {
+    return r->offset + (r->pos - r->buf);
+}
+
+static inline void rioMark(rio *r) {
+    r->mark = rioTell(r);
+}
+
+static inline void rioUnmark(rio *r) {
+    r->mark = -1;
+}
+
+/* Pointer to the byte at file offset 'off', which must be marked. */
+static inline unsigned char *rioPtrAt(rio *r, off_t off) {
+    return r->buf + (off - r->offset);
+}
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * shard, which aof file a key goes to. See shard.h.
+ */
+#include "shard.h"
+#include "crc64.h"
+#include <string.h>
+#include <math.h>
+
+/* CRC16 XMODEM (polynomial 0x1021), the one Redis Cluster uses. */
+static const uint16_t shardCrc16Tab[256] = {
+    0x0000,0x1021,0x2042,0x3063,0x4084,0x50a5,0x60c6,0x70e7,
+    0x8108,0x9129,0xa14a,0xb16b,0xc18c,0xd1ad,0xe1ce,0xf1ef,
+    0x1231,0x0210,0x3273,0x2252,0x52b5,0x4294,0x72f7,0x62d6,
+    0x9339,0x8318,0xb37b,0xa35a,0xd3bd,0xc39c,0xf3ff,0xe3de,
+    0x2462,0x3443,0x0420,0x1401,0x64e6,0x74c7,0x44a4,0x5485,
+    0xa56a,0xb54b,0x8528,0x9509,0xe5ee,0xf5cf,0xc5ac,0xd58d,
+    0x3653,0x2672,0x1611,0x0630,0x76d7,0x66f6,0x5695,0x46b4,
+    0xb75b,0xa77a,0x9719,0x8738,0xf7df,0xe7fe,0xd79d,0xc7bc,
+    0x48c4,0x58e5,0x6886,0x78a7,0x0840,0x1861,0x2802,0x3823,
+    0xc9cc,0xd9ed,0xe98e,0xf9af,0x8948,0x9969,0xa90a,0xb92b,
+    0x5af5,0x4ad4,0x7ab7,0x6a96,0x1a71,0x0a50,0x3a33,0x2a12,
+    0xdbfd,0xcbdc,0xfbbf,0xeb9e,0x9b79,0x8b58,0xbb3b,0xab1a,
+    0x6ca6,0x7c87,0x4ce4,0x5cc5,0x2c22,0x3c03,0x0c60,0x1c41,
+    0xedae,0xfd8f,0xcdec,0xddcd,0xad2a,0xbd0b,0x8d68,0x9d49,
+    0x7e97,0x6eb6,0x5ed5,0x4ef4,0x3e13,0x2e32,0x1e51,0x0e70,
+    0xff9f,0xefbe,0xdfdd,0xcffc,0xbf1b,0xaf3a,0x9f59,0x8f78,
+    0x9188,0x81a9,0xb1ca,0xa1eb,0xd10c,0xc12d,0xf14e,0xe16f,
+    0x1080,0x00a1,0x30c2,0x20e3,0x5004,0x4025,0x7046,0x6067,
+    0x83b9,0x9398,0xa3fb,0xb3da,0xc33d,0xd31c,0xe37f,0xf35e,
+    0x02b1,0x1290,0x22f3,0x32d2,0x4235,0x5214,0x6277,0x7256,
+    0xb5ea,0xa5cb,0x95a8,0x8589,0xf56e,0xe54f,0xd52c,0xc50d,
+    0x34e2,0x24c3,0x14a0,0x0481,0x7466,0x6447,0x5424,0x4405,
+    0xa7db,0xb7fa,0x8799,0x97b8,0xe75f,0xf77e,0xc71d,0xd73c,
+    0x26d3,0x36f2,0x0691,0x16b0,0x6657,0x7676,0x4615,0x5634,
+    0xd94c,0xc96d,0xf90e,0xe92f,0x99c8,0x89e9,0xb98a,0xa9ab,
+    0x5844,0x4865,0x7806,0x6827,0x18c0,0x08e1,0x3882,0x28a3,
+    0xcb7d,0xdb5c,0xeb3f,0xfb1e,0x8bf9,0x9bd8,0xabbb,0xbb9a,
+    0x4a75,0x5a54,0x6a37,0x7a16,0x0af1,0x1ad0,0x2ab3,0x3a92,
+    0xfd2e,0xed0f,0xdd6c,0xcd4d,0xbdaa,0xad8b,0x9de8,0x8dc9,
+    0x7c26,0x6c07,0x5c64,0x4c45,0x3ca2,0x2c83,0x1ce0,0x0cc1,
+    0xef1f,0xff3e,0xcf5d,0xdf7c,0xaf9b,0xbfba,0x8fd9,0x9ff8,
+    0x6e17,0x7e36,0x4e55,0x5e74,0x2e93,0x3eb2,0x0ed1,0x1ef0
+};
+
+static uint16_t shardCrc16(const char *buf, size_t len) {
+    uint16_t crc = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        crc = (crc << 8) ^ shardCrc16Tab[((crc >> 8) ^ (unsigned char)buf[i]) & 0xff];
+    return crc;
+}
+
+unsigned int shardKeySlot(const char *key, size_t len) {
+    size_t s, e;
+
+    /* Only the part between the first '{' and the next '}' is hashed, if it
+     * is not empty, so keys sharing a tag share a slot. */
+    for (s = 0; s < len; s++)
+        if (key[s] == '{') break;
+    if (s == len) return shardCrc16(key, len) & (SHARD_CLUSTER_SLOTS - 1);
+    for (e = s + 1; e < len; e++)
+        if (key[e] == '}') break;
+    if (e == len || e == s + 1) return shardCrc16(key, len) & (SHARD_CLUSTER_SLOTS - 1);
+    return shardCrc16(key + s + 1, e - s - 1) & (SHARD_CLUSTER_SLOTS - 1);
+}
+
+/* ------------------------------- 64 bit hash ------------------------------ */
+
+#define SHARD_PRIME1 0x9E3779B185EBCA87ULL
+#define SHARD_PRIME2 0xC2B2AE3D27D4EB4FULL
+/* the first bytes of the XXH3 default secret */
+#define SHARD_SECRET0 0xbe4ba423396cfeb8ULL
+#define SHARD_SECRET1 0x1cad21f72c81017cULL
+#define SHARD_SECRET2 0xdb979083e96dd4deULL
+#define SHARD_SECRET3 0x1f67b3b7a4a44072ULL
+
+static inline uint64_t shardRead64(const unsigned char *p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+        (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+        (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static inline uint64_t shardRead32(const unsigned char *p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+        (uint64_t)p[3] << 24;
+}
+
+/* The high and low halves of a * b xored together. */
+static inline uint64_t shardFold(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __extension__ unsigned __int128 r = (unsigned __int128)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t b00 = a_lo * b_lo, b01 = a_lo * b_hi;
+    uint64_t b10 = a_hi * b_lo, b11 = a_hi * b_hi;
+    uint64_t mid1 = b10 + (b00 >> 32);
+    uint64_t mid2 = b01 + (uint32_t)mid1;
+    uint64_t hi = b11 + (mid1 >> 32) + (mid2 >> 32);
+
+    return ((mid2 << 32) | (uint32_t)b00) ^ hi;
+#endif
+}
+
+static inline uint64_t shardAvalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    return h ^ (h >> 32);
+}
+
+uint64_t shardHash64(const char *key, size_t len, uint64_t seed) {
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t acc = len * SHARD_PRIME1 + seed, a, b;
+    size_t left = len;
+
+    for (; left > 16; p += 16, left -= 16) {
+        acc += shardFold(shardRead64(p) ^ (SHARD_SECRET0 + seed),
+                shardRead64(p + 8) ^ (SHARD_SECRET1 - seed));
+        acc = (acc << 31 | acc >> 33) * SHARD_PRIME2;
+    }
+    /* the last 1 to 16 bytes, overlapping the last stripe if there was one */
+    if (len > 16) {
+        a = shardRead64(p + left - 16);
+        b = shardRead64(p + left - 8);
+    } else if (left >= 8) {
+        a = shardRead64(p);
+        b = shardRead64(p + left - 8);
+    } else if (left >= 4) {
+        a = shardRead32(p);
+        b = shardRead32(p + left - 4);
+    } else if (left > 0) {
+        a = (uint64_t)p[0] << 16 | (uint64_t)p[left >> 1] << 8 | p[left - 1];
+        b = 0;
+    } else {
+        a = b = 0;
+    }
+    acc += shardFold(a ^ (SHARD_SECRET2 + seed), b ^ (SHARD_SECRET3 - seed));
+    return shardAvalanche(acc);
+}
+
+int32_t shardJump(uint64_t key, int32_t n) {
+    int64_t b = -1, j = 0;
+
+    while (j < n) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t)((b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+    }
+    return (int32_t)b;
+}
+
+/* ----------------------------- shard functions ---------------------------- */
+
+/* The last slot of output i, the ranges redis-cli --cluster create gives n
+ * masters, computed in double precision. */
+static unsigned int shardLastSlot(unsigned int i, unsigned int n) {
+    double per = (double)SHARD_CLUSTER_SLOTS / n, last;
+
+    if (i == n - 1) return SHARD_CLUSTER_SLOTS - 1;
+    last = floor(per * (i + 1) - 1 + 0.5);
+    return last < 0 ? 0 : (unsigned int)last;
+}
+
+unsigned int shardBySlot(const char *key, size_t len, unsigned int n) {
+    unsigned int slot = shardKeySlot(key, len);
+    unsigned int i = (unsigned int)((uint64_t)slot * n / SHARD_CLUSTER_SLOTS);
+
+    /* rounding moves the boundaries by less than a slot */
+    while (i < n - 1 && shardLastSlot(i, n) < slot) i++;
+    while (i > 0 && shardLastSlot(i - 1, n) >= slot) i--;
+    return i;
+}
+
+unsigned int shardByHash(const char *key, size_t len, unsigned int n) {
+    return shardHash64(key, len, 0) % n;
+}
+
+unsigned int shardByJump(const char *key, size_t len, unsigned int n) {
+    return shardJump(shardHash64(key, len, 0), n);
+}
+
+unsigned int shardByCrc64(const char *key, size_t len, unsigned int n) {
+    return crc64(0, (const unsigned char *)key, len) % n;
+}
+
+static const struct {
+    const char *name;
+    shardFunc *func;
+} shardFuncs[] = {
+    {"slot", shardBySlot},
+    {"hash", shardByHash},
+    {"jump", shardByJump},
+    {"crc64", shardByCrc64},
+    {NULL, NULL}
+};
+
+shardFunc *shardByName(const char *name) {
+    int i;
+
+    for (i = 0; shardFuncs[i].name; i++) {
+        if (strcmp(shardFuncs[i].name, name) == 0) return shardFuncs[i].func;
+    }
+    return NULL;
+}
@@ -0,0 +1,51 @@
+/*
+ * shard, which aof file a key goes to when output is split over several.
+ *
+ * A shard function maps a key name to one of n outputs. Four are provided,
+ * picked by name with shardByName() (-H on the command line):
+ *
+ * 1. "slot": the Redis Cluster hash slot of the key (CRC16 of the key, or of
+ *    its {hash tag}, modulo 16384), the outputs getting consecutive slot
+ *    ranges the way redis-cli --cluster create hands them to n masters
+ *    (0-5460, 5461-10922, 10923-16383 for 3; past 77 masters its single
+ *    precision rounding may move a boundary by a slot). With -n 16384 every
+ *    slot has a file of its own.
+ * 2. "hash": a 64 bit hash of the key modulo n.
+ * 3. "jump": jump consistent hashing of the same 64 bit hash (Lamping and
+ *    Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm"): going from
+ *    n to n+1 outputs only moves 1/(n+1) of the keys.
+ * 4. "crc64": the crc64 of the key modulo n.
+ */
+#ifndef __SHARD_H_
+#define __SHARD_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHARD_CLUSTER_SLOTS 16384
+
+/* The output of key, in [0, n). n is never 0. */
+typedef unsigned int shardFunc(const char *key, size_t len, unsigned int n);
+
+unsigned int shardBySlot(const char *key, size_t len, unsigned int n);
+unsigned int shardByHash(const char *key, size_t len, unsigned int n);
+unsigned int shardByJump(const char *key, size_t len, unsigned int n);
+unsigned int shardByCrc64(const char *key, size_t len, unsigned int n);
+
+/* The shard function called name, NULL if there is none. */
+shardFunc *shardByName(const char *name);
+
+/* The Redis Cluster hash slot of a key, hash tags included. */
+unsigned int shardKeySlot(const char *key, size_t len);
+
+/*
+ * A fast 64 bit hash, built like XXH3: 16 byte stripes are folded into the
+ * accumulator with a 64x64->128 bit multiplication, then the result is
+ * avalanched. It is not bit compatible with XXH3, and the same on every
+ * platform.
+ */
+uint64_t shardHash64(const char *key, size_t len, uint64_t seed);
+
+/* Bucket of key among n, see "jump" above. */
+int32_t shardJump(uint64_t key, int32_t n);
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * sketch, a fixed size summary of an rdb file that sketches of other files
+ * can be merged into. See sketch.h.
+ */
+#include "sketch.h"
+#include "shard.h"
+#include "endian.h"
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[SKETCH_BUCKETS];
+} sketchHist;
+
+struct sketch {
+    char delimiter;
+    long long now;                  /* reference time of the ttls */
+    uint64_t keys;
+    uint64_t expired;               /* expire time before now */
+    uint64_t persistent;            /* no expire time */
+    uint64_t bands[SKETCH_BANDS];
+    unsigned char keyRegisters[SKETCH_REGISTERS];
+    unsigned char prefixRegisters[SKETCH_REGISTERS];
+    sketchHist hists[TOTAL_DATA_TYPES][SKETCH_METRICS];
+    sketchHist ttl;                 /* seconds left, expire time after now */
+};
+
+/* ranks of a register, trailing zeros of the 50 bits left of a hash plus 1 */
+#define SKETCH_HLL_Q (64 - SKETCH_HLL_BITS)
+
+static const long long sketchBandLimits[SKETCH_BANDS - 1] = {60, 3600, 86400, 7 * 86400, 30 * 86400};
+static const char *sketchBandNames[SKETCH_BANDS] = {"<1m", "<1h", "<1d", "<7d", "<30d", ">=30d"};
+static const char *sketchTypeNames[TOTAL_DATA_TYPES] = {"string", "list", "set", "zset", "hash"};
+static const char *sketchMetricNames[SKETCH_METRICS] = {"rdb bytes", "elements", "memory bytes"};
+
+sketch *sketchCreate(char delimiter, long long now) {
+    sketch *s = zcalloc(sizeof(*s));
+
+    s->delimiter = delimiter;
+    s->now = now ? now : (long long)time(NULL);
+    return s;
+}
+
+void sketchFree(sketch *s) {
+    zfree(s);
+}
+
+static void sketchHllAdd(unsigned char *registers, uint64_t hash) {
+    unsigned int index = hash & (SKETCH_REGISTERS - 1);
+    /* the bit past the 50 caps the rank at SKETCH_HLL_Q + 1 */
+    unsigned char rank = __builtin_ctzll((hash >> SKETCH_HLL_BITS) | (1ULL << SKETCH_HLL_Q)) + 1;
+
+    if (registers[index] < rank) registers[index] = rank;
+}
+
+static double sketchHllSigma(double x) {
+    double y = 1, z = x, prev;
+
+    if (x == 1) return INFINITY;
+    do {
+        x *= x;
+        prev = z;
+        z += x * y;
+        y += y;
+    } while (z != prev);
+    return z;
+}
+
+static double sketchHllTau(double x) {
+    double y = 1, z = 1 - x, prev;
+
+    if (x == 0 || x == 1) return 0;
+    do {
+        x = sqrt(x);
+        prev = z;
+        y *= 0.5;
+        z -= (1 - x) * (1 - x) * y;
+    } while (z != prev);
+    return z / 3;
+}
+
+/* Ertl, "New cardinality estimation algorithms for HyperLogLog sketches",
+ * the improved raw estimator. */
+static uint64_t sketchHllCount(const unsigned char *registers) {
+    unsigned int histogram[SKETCH_HLL_Q + 2] = {0};
+    double m = SKETCH_REGISTERS, z;
+    int i;
+
+    for (i = 0; i < SKETCH_REGISTERS; i++) histogram[registers[i]]++;
+    z = m * sketchHllTau(1 - histogram[SKETCH_HLL_Q + 1] / m);
+    for (i = SKETCH_HLL_Q; i >= 1; i--) {
+        z += histogram[i];
+        z *= 0.5;
+    }
+    z += m * sketchHllSigma(histogram[0] / m);
+    return (uint64_t)llround(0.5 / log(2) * m * m / z);
+}
+
+static unsigned int sketchBucket(uint64_t value) {
+    int e;
+
+    if (value < 2 * SKETCH_SUB) return value;
+    e = 63 - __builtin_clzll(value);
+    return 2 * SKETCH_SUB + (e - SKETCH_SUB_BITS - 1) * SKETCH_SUB +
+        (unsigned int)(value >> (e - SKETCH_SUB_BITS)) - SKETCH_SUB;
+}
+
+/* The largest value that falls in bucket. */
+static uint64_t sketchBucketMax(unsigned int bucket) {
+    unsigned int e, sub;
+
+    if (bucket < 2 * SKETCH_SUB) return bucket;
+    e = (bucket - 2 * SKETCH_SUB) / SKETCH_SUB + SKETCH_SUB_BITS + 1;
+    sub = (bucket - 2 * SKETCH_SUB) % SKETCH_SUB;
+    return ((uint64_t)(SKETCH_SUB + sub) << (e - SKETCH_SUB_BITS)) +
+        ((uint64_t)1 << (e - SKETCH_SUB_BITS)) - 1;
+}
+
+static void sketchHistAdd(sketchHist *h, uint64_t value) {
+    if (h->count == 0 || value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+    h->count++;
+    h->sum += value;
+    h->buckets[sketchBucket(value)]++;
+}
+
+static void sketchHistMerge(sketchHist *dst, sketchHist *src) {
+    int i;
+
+    if (src->count == 0) return;
+    if (dst->count == 0 || src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (i = 0; i < SKETCH_BUCKETS; i++) dst->buckets[i] += src->buckets[i];
+}
+
+/* The value at quantile q, to 1/16 of it, within min and max. */
+static uint64_t sketchHistQuantile(sketchHist *h, double q) {
+    uint64_t rank = (uint64_t)ceil(q * h->count), seen = 0, value;
+    int i;
+
+    if (rank == 0) rank = 1;
+    for (i = 0; i < SKETCH_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) break;
+    }
+    value = sketchBucketMax(i < SKETCH_BUCKETS ? i : SKETCH_BUCKETS - 1);
+    if (value < h->min) return h->min;
+    if (value > h->max) return h->max;
+    return value;
+}
+
+void sketchAdd(sketch *s, rdbStr *key, rdbKeyMemory *mem) {
+    const char *p = key->ptr, *end = key->ptr + key->len, *d;
+    uint64_t hash = 0;
+    long long left;
+    int band;
+
+    s->keys++;
+    sketchHllAdd(s->keyRegisters, shardHash64(key->ptr, key->len, 0));
+    /* a prefix hashes its last segment seeded with the hash of its parent */
+    while ((d = memchr(p, s->delimiter, end - p)) != NULL) {
+        hash = shardHash64(p, d - p + 1, hash);
+        sketchHllAdd(s->prefixRegisters, hash);
+        p = d + 1;
+    }
+    if (mem->type >= 0 && mem->type < TOTAL_DATA_TYPES) {
+        sketchHist *h = s->hists[mem->type];
+        sketchHistAdd(&h[SKETCH_SERIALIZED], mem->serialized);
+        sketchHistAdd(&h[SKETCH_ELEMENTS], mem->elements);
+        sketchHistAdd(&h[SKETCH_MEMORY], mem->bytes);
+    }
+    if (mem->expiretime == -1) {
+        s->persistent++;
+        return;
+    }
+    left = (long long)mem->expiretime / 1000 - s->now;
+    if (left <= 0) {
+        s->expired++;
+        return;
+    }
+    for (band = 0; band < SKETCH_BANDS - 1 && left >= sketchBandLimits[band]; band++);
+    s->bands[band]++;
+    sketchHistAdd(&s->ttl, left);
+}
+
+static void sketchPrintHist(FILE *fp, const char *name, sketchHist *h) {
+    fprintf(fp, "    %-13s min %llu, p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, max %llu, mean %.1f\n",
+            name, (unsigned long long)h->min,
+            (unsigned long long)sketchHistQuantile(h, 0.5),
+            (unsigned long long)sketchHistQuantile(h, 0.9),
+            (unsigned long long)sketchHistQuantile(h, 0.99),
+            (unsigned long long)sketchHistQuantile(h, 0.999),
+            (unsigned long long)h->max, (double)h->sum / h->count);
+}
+
+void sketchPrint(sketch *s, FILE *fp) {
+    int t, m, band;
+
+    fprintf(fp, "keys: %llu, about %llu distinct\n", (unsigned long long)s->keys,
+            (unsigned long long)sketchHllCount(s->keyRegisters));
+    fprintf(fp, "prefixes: about %llu distinct, split at '%c'\n",
+            (unsigned long long)sketchHllCount(s->prefixRegisters), s->delimiter);
+    for (t = 0; t < TOTAL_DATA_TYPES; t++) {
+        sketchHist *h = s->hists[t];
+        if (h[0].count == 0) continue;
+        fprintf(fp, "%s: %llu keys\n", sketchTypeNames[t], (unsigned long long)h[0].count);
+        for (m = 0; m < SKETCH_METRICS; m++) sketchPrintHist(fp, sketchMetricNames[m], &h[m]);
+    }
+    fprintf(fp, "ttl at %lld: %llu keys without, %llu expired, %llu expiring\n", s->now,
+            (unsigned long long)s->persistent, (unsigned long long)s->expired,
+            (unsigned long long)s->ttl.count);
+    if (s->ttl.count == 0) return;
+    fprintf(fp, "   ");
+    for (band = 0; band < SKETCH_BANDS; band++)
+        fprintf(fp, " %s %llu", sketchBandNames[band], (unsigned long long)s->bands[band]);
+    fprintf(fp, "\n");
+    sketchPrintHist(fp, "seconds", &s->ttl);
+}
+
+static int sketchWrite64(FILE *fp, uint64_t value) {
+    memrev64ifbe(&value);
+    return fwrite(&value, 8, 1, fp) == 1 ? 0 : -1;
+}
+
+/* sparse, as (bucket, count) pairs */
+static int sketchWriteHist(FILE *fp, sketchHist *h) {
+    uint64_t used = 0;
+    int i, ret = 0;
+
+    for (i = 0; i < SKETCH_BUCKETS; i++) used += h->buckets[i] != 0;
+    ret |= sketchWrite64(fp, h->count);
+    ret |= sketchWrite64(fp, h->sum);
+    ret |= sketchWrite64(fp, h->min);
+    ret |= sketchWrite64(fp, h->max);
+    ret |= sketchWrite64(fp, used);
+    for (i = 0; i < SKETCH_BUCKETS; i++) {
+        if (h->buckets[i] == 0) continue;
+        ret |= sketchWrite64(fp, i);
+        ret |= sketchWrite64(fp, h->buckets[i]);
+    }
+    return ret;
+}
+
+int sketchSave(sketch *s, FILE *fp) {
+    int t, m, band, ret = 0;
+
+    if (fwrite(SKETCH_MAGIC, 8, 1, fp) != 1) return -1;
+    ret |= sketchWrite64(fp, SKETCH_HLL_BITS);
+    ret |= sketchWrite64(fp, SKETCH_BUCKETS);
+    ret |= sketchWrite64(fp, (unsigned char)s->delimiter);
+    ret |= sketchWrite64(fp, (uint64_t)s->now);
+    ret |= sketchWrite64(fp, s->keys);
+    ret |= sketchWrite64(fp, s->expired);
+    ret |= sketchWrite64(fp, s->persistent);
+    for (band = 0; band < SKETCH_BANDS; band++) ret |= sketchWrite64(fp, s->bands[band]);
+    if (fwrite(s->keyRegisters, SKETCH_REGISTERS, 1, fp) != 1) return -1;
+    if (fwrite(s->prefixRegisters, SKETCH_REGISTERS, 1, fp) != 1) return -1;
+    for (t = 0; t < TOTAL_DATA_TYPES; t++)
+        for (m = 0; m < SKETCH_METRICS; m++) ret |= sketchWriteHist(fp, &s->hists[t][m]);
+    ret |= sketchWriteHist(fp, &s->ttl);
+    return ret;
+}
+
+int sketchIsFile(const char *filename) {
+    char magic[8];
+    FILE *fp = fopen(filename, "r");
+    int ret;
+
+    if (fp == NULL) return 0;
+    ret = fread(magic, 8, 1, fp) == 1 && memcmp(magic, SKETCH_MAGIC, 8) == 0;
+    fclose(fp);
+    return ret;
+}
+
+static int sketchRead64(FILE *fp, uint64_t *value) {
+    if (fread(value, 8, 1, fp) != 1) return -1;
+    memrev64ifbe(value);
+    return 0;
+}
+
+static int sketchReadHist(FILE *fp, sketchHist *h) {
+    uint64_t used, bucket, count, sum = 0;
+
+    memset(h, 0, sizeof(*h));
+    if (sketchRead64(fp, &h->count) == -1 || sketchRead64(fp, &h->sum) == -1 ||
+            sketchRead64(fp, &h->min) == -1 || sketchRead64(fp, &h->max) == -1 ||
+            sketchRead64(fp, &used) == -1 || used > SKETCH_BUCKETS)
+        return -1;
+    while (used--) {
+        if (sketchRead64(fp, &bucket) == -1 || sketchRead64(fp, &count) == -1 ||
+                bucket >= SKETCH_BUCKETS)
+            return -1;
+        h->buckets[bucket] = count;
+        sum += count;
+    }
+    return sum == h->count ? 0 : -1;
+}
+
+/* Read a saved sketch into s, -1 if it isn't one or is cut short. */
+static int sketchRead(sketch *s, FILE *fp) {
+    uint64_t bits, buckets, delimiter, now;
+    char magic[8];
+    int t, m, band, i;
+
+    if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, SKETCH_MAGIC, 8) != 0) return -1;
+    if (sketchRead64(fp, &bits) == -1 || bits != SKETCH_HLL_BITS ||
+            sketchRead64(fp, &buckets) == -1 || buckets != SKETCH_BUCKETS ||
+            sketchRead64(fp, &delimiter) == -1 || sketchRead64(fp, &now) == -1 ||
+            sketchRead64(fp, &s->keys) == -1 || sketchRead64(fp, &s->expired) == -1 ||
+            sketchRead64(fp, &s->persistent) == -1)
+        return -1;
+    s->delimiter = (char)delimiter;
+    s->now = (long long)now;
+    for (band = 0; band < SKETCH_BANDS; band++)
+        if (sketchRead64(fp, &s->bands[band]) == -1) return -1;
+    if (fread(s->keyRegisters, SKETCH_REGISTERS, 1, fp) != 1 ||
+            fread(s->prefixRegisters, SKETCH_REGISTERS, 1, fp) != 1)
+        return -1;
+    for (i = 0; i < SKETCH_REGISTERS; i++)
+        if (s->keyRegisters[i] > SKETCH_HLL_Q + 1 || s->prefixRegisters[i] > SKETCH_HLL_Q + 1)
+            return -1;
+    for (t = 0; t < TOTAL_DATA_TYPES; t++)
+        for (m = 0; m < SKETCH_METRICS; m++)
+            if (sketchReadHist(fp, &s->hists[t][m]) == -1) return -1;
+    return sketchReadHist(fp, &s->ttl);
+}
+
+int sketchMergeFile(sketch *s, const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    sketch *src;
+    int t, m, band, i;
+
+    if (fp == NULL) {
+        fprintf(stderr, "open %s err :%s\n", filename, strerror(errno));
+        return -1;
+    }
+    src = zcalloc(sizeof(*src));
+    if (sketchRead(src, fp) == -1) {
+        fprintf(stderr, "%s is not a sketch, or is cut short\n", filename);
+        goto err;
+    }
+    if (s->keys == 0) {
+        s->delimiter = src->delimiter;
+        s->now = src->now;
+    } else if (src->delimiter != s->delimiter) {
+        fprintf(stderr, "%s splits prefixes at '%c', not '%c'\n", filename, src->delimiter, s->delimiter);
+        goto err;
+    } else if (src->now != s->now) {
+        fprintf(stderr, "%s has ttls at %lld, merged with ttls at %lld\n", filename, src->now, s->now);
+    }
+    s->keys += src->keys;
+    s->expired += src->expired;
+    s->persistent += src->persistent;
+    for (band = 0; band < SKETCH_BANDS; band++) s->bands[band] += src->bands[band];
+    for (i = 0; i < SKETCH_REGISTERS; i++) {
+        if (s->keyRegisters[i] < src->keyRegisters[i]) s->keyRegisters[i] = src->keyRegisters[i];
+        if (s->prefixRegisters[i] < src->prefixRegisters[i]) s->prefixRegisters[i] = src->prefixRegisters[i];
+    }
+    for (t = 0; t < TOTAL_DATA_TYPES; t++)
+        for (m = 0; m < SKETCH_METRICS; m++) sketchHistMerge(&s->hists[t][m], &src->hists[t][m]);
+    sketchHistMerge(&s->ttl, &src->ttl);
+    zfree(src);
+    fclose(fp);
+    return 0;
+
+err:
+    zfree(src);
+    fclose(fp);
+    return -1;
+}
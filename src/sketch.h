@@ -0,0 +1,78 @@
+/*
+ * sketch, a fixed size summary of an rdb file that sketches of other files
+ * can be merged into.
+ *
+ * Filled in one pass, it takes the same ~160KB for a thousand keys or a
+ * billion:
+ *
+ * 1. Two HyperLogLogs of 2^14 registers (0.81% standard error), one for
+ *    the distinct keys and one for the distinct prefixes, a key adding every
+ *    prefix it has at the delimiter ("user:", "user:123:"), which is what
+ *    -t prefix would make rows of. Estimated with Ertl's improved raw
+ *    estimator, so there is no bias correction table.
+ * 2. Log-linear histograms, like HdrHistogram with one significant digit
+ *    in base 16: values below 32 are exact, others fall in one of 16
+ *    buckets per power of two, so a quantile is off by 1/16 at most. One
+ *    per type for the rdb bytes, estimated memory and elements of a key,
+ *    and one for the seconds left to live of the keys with an expire time.
+ * 3. The keys with an expire time by time left (a minute, an hour, a day,
+ *    a week, 30 days, more), those already expired and those without one.
+ *
+ * Time left is counted from a reference time, the time the sketch was made
+ * unless given. Sketches are saved in a little endian binary format and
+ * merge by adding histograms and taking the max of HyperLogLog registers,
+ * so shards of one dataset can be sketched apart and merged after.
+ */
+#ifndef __SKETCH_H_
+#define __SKETCH_H_
+#include "rdb_parser.h"
+
+#define SKETCH_MAGIC "RDBSKET1"
+
+/* HyperLogLog registers, 2^SKETCH_HLL_BITS of them */
+#define SKETCH_HLL_BITS 14
+#define SKETCH_REGISTERS (1 << SKETCH_HLL_BITS)
+
+/* histogram buckets, SKETCH_SUB per power of two */
+#define SKETCH_SUB_BITS 4
+#define SKETCH_SUB (1 << SKETCH_SUB_BITS)
+#define SKETCH_BUCKETS (2 * SKETCH_SUB + (64 - SKETCH_SUB_BITS - 1) * SKETCH_SUB)
+
+#define SKETCH_SERIALIZED 0 /* bytes in the rdb file */
+#define SKETCH_ELEMENTS 1   /* members or fields */
+#define SKETCH_MEMORY 2     /* estimated bytes in redis */
+#define SKETCH_METRICS 3
+
+/* keys with an expire time by time left: under a minute, an hour, a day,
+ * a week, 30 days, and the rest */
+#define SKETCH_BANDS 6
+
+typedef struct sketch sketch;
+
+/* now is the reference time of ttls in unix seconds, 0 for the current time. */
+sketch *sketchCreate(char delimiter, long long now);
+void sketchFree(sketch *s);
+
+/* Add one key, as handed to a keyMemoryHandler. */
+void sketchAdd(sketch *s, rdbStr *key, rdbKeyMemory *mem);
+
+/* Print counts, estimates and quantiles. */
+void sketchPrint(sketch *s, FILE *fp);
+
+/* Save a sketch to fp, -1 on write error. */
+int sketchSave(sketch *s, FILE *fp);
+
+/*
+ * 1 if filename starts like a saved sketch, 0 otherwise (an rdb file).
+ */
+int sketchIsFile(const char *filename);
+
+/*
+ * Merge the sketch saved in filename into s, -1 with a message on stderr if
+ * it can't be read or was made with another delimiter. An empty s takes the
+ * delimiter and reference time of the file; if s already has keys and the
+ * reference times differ, the merge goes on with a warning.
+ */
+int sketchMergeFile(sketch *s, const char *filename);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * slotscan, byte scans for the rediscounter table. See slotscan.h.
+ */
+#include "slotscan.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SLOTSCAN_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct slotscanEngine {
+    const char *name;
+    size_t (*zero)(const char *p, size_t len);
+    int (*all)(const char *p, size_t len, char c);
+} slotscanEngine;
+
+static pthread_once_t slotscan_once = PTHREAD_ONCE_INIT;
+static const slotscanEngine *slotscan_impl;
+
+/* --------------------------------- scalar --------------------------------- */
+
+static size_t slotscan_zero_scalar(const char *p, size_t len) {
+    uint64_t w;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, p + i, 8);
+        if (w) break;
+    }
+    for (; i < len; i++)
+        if (p[i]) break;
+    return i;
+}
+
+static int slotscan_all_scalar(const char *p, size_t len, char c) {
+    uint64_t w, pattern = 0x0101010101010101ULL * (unsigned char)c;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, p + i, 8);
+        if (w != pattern) return 0;
+    }
+    for (; i < len; i++)
+        if (p[i] != c) return 0;
+    return 1;
+}
+
+static const slotscanEngine slotscan_scalar = {
+    "scalar", slotscan_zero_scalar, slotscan_all_scalar
+};
+
+#ifdef SLOTSCAN_HAVE_X86
+/* ---------------------------------- sse2 ---------------------------------- */
+
+__attribute__((target("sse2")))
+static size_t slotscan_zero_sse2(const char *p, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a, b, c, d;
+    unsigned int mask;
+    size_t i = 0;
+
+    /* 64 bytes per round while everything is zero */
+    for (; i + 64 <= len; i += 64) {
+        a = _mm_loadu_si128((const __m128i *)(p + i));
+        b = _mm_loadu_si128((const __m128i *)(p + i + 16));
+        c = _mm_loadu_si128((const __m128i *)(p + i + 32));
+        d = _mm_loadu_si128((const __m128i *)(p + i + 48));
+        a = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) != 0xffff) break;
+    }
+    for (; i + 16 <= len; i += 16) {
+        a = _mm_loadu_si128((const __m128i *)(p + i));
+        mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) & 0xffff;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + slotscan_zero_scalar(p + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static int slotscan_all_sse2(const char *p, size_t len, char c) {
+    const __m128i pattern = _mm_set1_epi8(c);
+    __m128i a;
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        a = _mm_loadu_si128((const __m128i *)(p + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, pattern)) != 0xffff) return 0;
+    }
+    return slotscan_all_scalar(p + i, len - i, c);
+}
+
+static const slotscanEngine slotscan_sse2 = {
+    "sse2", slotscan_zero_sse2, slotscan_all_sse2
+};
+
+/* ---------------------------------- avx2 ---------------------------------- */
+
+__attribute__((target("avx2")))
+static size_t slotscan_zero_avx2(const char *p, size_t len) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i a, b, c, d;
+    unsigned int mask;
+    size_t i = 0;
+
+    /* 128 bytes per round while everything is zero */
+    for (; i + 128 <= len; i += 128) {
+        a = _mm256_loadu_si256((const __m256i *)(p + i));
+        b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        c = _mm256_loadu_si256((const __m256i *)(p + i + 64));
+        d = _mm256_loadu_si256((const __m256i *)(p + i + 96));
+        a = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+        if (!_mm256_testz_si256(a, a)) break;
+    }
+    for (; i + 32 <= len; i += 32) {
+        a = _mm256_loadu_si256((const __m256i *)(p + i));
+        mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, zero));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + slotscan_zero_sse2(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int slotscan_all_avx2(const char *p, size_t len, char c) {
+    const __m256i pattern = _mm256_set1_epi8(c);
+    __m256i a;
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        a = _mm256_loadu_si256((const __m256i *)(p + i));
+        if ((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, pattern)) != 0xffffffffu)
+            return 0;
+    }
+    return slotscan_all_sse2(p + i, len - i, c);
+}
+
+static const slotscanEngine slotscan_avx2 = {
+    "avx2", slotscan_zero_avx2, slotscan_all_avx2
+};
+#endif
+
+static void slotscan_init(void) {
+    slotscan_impl = &slotscan_scalar;
+#ifdef SLOTSCAN_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) slotscan_impl = &slotscan_avx2;
+    else if (__builtin_cpu_supports("sse2")) slotscan_impl = &slotscan_sse2;
+#endif
+}
+
+size_t slotscan_zero(const char *p, size_t len) {
+    pthread_once(&slotscan_once, slotscan_init);
+    return slotscan_impl->zero(p, len);
+}
+
+int slotscan_all(const char *p, size_t len, char c) {
+    pthread_once(&slotscan_once, slotscan_init);
+    return slotscan_impl->all(p, len, c);
+}
+
+const char *slotscan_engine(void) {
+    pthread_once(&slotscan_once, slotscan_init);
+    return slotscan_impl->name;
+}
+
+/* Test main */
+#ifdef TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static size_t slotscan_zero_ref(const char *p, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len && !p[i]; i++);
+    return i;
+}
+
+static int slotscan_all_ref(const char *p, size_t len, char c) {
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        if (p[i] != c) return 0;
+    return 1;
+}
+
+static const slotscanEngine *slotscan_engines[] = {
+    &slotscan_scalar,
+#ifdef SLOTSCAN_HAVE_X86
+    &slotscan_sse2,
+    &slotscan_avx2,
+#endif
+    NULL
+};
+
+static int slotscan_usable(const slotscanEngine *e) {
+#ifdef SLOTSCAN_HAVE_X86
+    __builtin_cpu_init();
+    if (e == &slotscan_avx2) return __builtin_cpu_supports("avx2");
+    if (e == &slotscan_sse2) return __builtin_cpu_supports("sse2");
+#endif
+    return e != NULL;
+}
+
+/* Every engine against the byte loops, over all lengths up to 512 at every
+ * alignment, with the first odd byte at every position. */
+static int slotscan_selftest(void) {
+    static char buf[512 + 32];
+    size_t len, off, pos;
+    int i, errors = 0;
+
+    for (i = 0; slotscan_engines[i]; i++) {
+        const slotscanEngine *e = slotscan_engines[i];
+        if (!slotscan_usable(e)) continue;
+        for (len = 0; len <= 512; len++) {
+            for (off = 0; off < 32; off += 7) {
+                for (pos = 0; pos <= len; pos += 1 + pos / 8) {
+                    memset(buf, 0, sizeof(buf));
+                    memset(buf + off, 'F', len);
+                    if (pos < len) buf[off + pos] = 'x';
+                    if (e->all(buf + off, len, 'F') != slotscan_all_ref(buf + off, len, 'F'))
+                        errors++;
+                    memset(buf, 0, sizeof(buf));
+                    if (pos < len) buf[off + pos] = (char)(1 + rand() % 255);
+                    if (e->zero(buf + off, len) != slotscan_zero_ref(buf + off, len)) {
+                        if (errors++ < 10)
+                            printf("%s zero mismatch: len=%zu off=%zu pos=%zu\n", e->name, len, off, pos);
+                    }
+                }
+            }
+        }
+    }
+    return errors;
+}
+
+static long long slotscan_ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+#define SLOTSCAN_BENCH_BYTES (64 * 1024 * 1024)
+
+int main(void) {
+    char *buf = calloc(SLOTSCAN_BENCH_BYTES, 1);
+    volatile size_t sink = 0;
+    long long start, us;
+    int i, round, errors = slotscan_selftest();
+
+    for (i = 0; slotscan_engines[i]; i++) {
+        const slotscanEngine *e = slotscan_engines[i];
+        if (!slotscan_usable(e)) continue;
+        start = slotscan_ustime();
+        for (round = 0; round < 10; round++) sink += e->zero(buf, SLOTSCAN_BENCH_BYTES);
+        us = slotscan_ustime() - start;
+        printf("%-6s zero scan: %.2f GB/s\n", e->name,
+            us ? 10.0 * SLOTSCAN_BENCH_BYTES / us / 1000 : 0);
+    }
+    (void)sink;
+    free(buf);
+    printf("slotscan self-test (%s): %s\n", slotscan_engine(), errors ? "FAILED" : "ok");
+    return errors ? 1 : 0;
+}
+#endif
@@ -0,0 +1,24 @@
+/*
+ * slotscan, byte scans for the rediscounter table.
+ *
+ * Most slots of a sparse table are empty, all zero bytes, so the scan
+ * spends its time looking for the next non zero byte; deleted slots are a
+ * key of 'F' bytes. Both are done 16 or 32 bytes at a time with SSE2 or
+ * AVX2, picked once at runtime like the crc64 engines, with a portable
+ * word-at-a-time fallback. `make slotscan-test` checks every engine
+ * against a byte loop and times them.
+ */
+#ifndef __SLOTSCAN_H_
+#define __SLOTSCAN_H_
+#include <stddef.h>
+
+/* Offset of the first non zero byte of p, len if there is none. */
+size_t slotscan_zero(const char *p, size_t len);
+
+/* 1 if the len bytes of p are all c. */
+int slotscan_all(const char *p, size_t len, char c);
+
+/* Name of the engine in use: "avx2", "sse2" or "scalar". */
+const char *slotscan_engine(void);
+
+#endif
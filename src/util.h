@@ -2,6 +2,10 @@
 #define __REDIS_UTIL_H
 #include "main.h"
 
+int stringmatchlen(const char *pattern, int patternLen,
+        const char *string, int stringLen, int nocase);
+uint32_t digits10(uint64_t v);
+void ull2digits(char *dst, uint64_t v, uint32_t len);
 int ll2string(char *s, size_t len, long long value);
 int string2ll(char *s, size_t slen, long long *value);
 
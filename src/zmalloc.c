@@ -58,33 +58,88 @@
 #define free(ptr) je_free(ptr)
 #endif
 
+/* The used memory and the allocations are counted per thread, in a slot of
+ * its own on a cache line of its own, and only summed when asked for: no
+ * thread ever waits on another one or pulls its cache line. A thread takes a
+ * free slot at its first allocation and gives it back when it exits, the
+ * counts staying in it for the next owner to add to. Only the owner writes a
+ * slot; past ZMALLOC_SLOTS live threads the others share one more slot,
+ * updated with atomic adds. A block freed by another thread than the one
+ * that allocated it is taken off the slot of the freeing thread, only the
+ * sum of the slots means something. */
+#define ZMALLOC_SLOTS 64
+#define ZMALLOC_CACHE_LINE 64
+
+typedef struct {
+    size_t used_memory;
+    size_t allocations;
+    char pad[ZMALLOC_CACHE_LINE - 2 * sizeof(size_t)];
+} zmallocSlot;
+
+#define update_zmalloc_stat_add(__slot,__field,__n) do { \
+    if ((__slot) == &zmalloc_slots[ZMALLOC_SLOTS]) \
+        __atomic_add_fetch(&(__slot)->__field, (__n), __ATOMIC_RELAXED); \
+    else \
+        __atomic_store_n(&(__slot)->__field, (__slot)->__field + (__n), __ATOMIC_RELAXED); \
+} while(0)
+
 #define update_zmalloc_stat_alloc(__n,__size) do { \
     size_t _n = (__n); \
+    zmallocSlot *_slot = zmalloc_slot ? zmalloc_slot : zmalloc_thread_slot(); \
     if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
-    if (zmalloc_thread_safe) { \
-        pthread_mutex_lock(&used_memory_mutex);  \
-        used_memory += _n; \
-        pthread_mutex_unlock(&used_memory_mutex); \
-    } else { \
-        used_memory += _n; \
-    } \
+    update_zmalloc_stat_add(_slot, used_memory, _n); \
+    update_zmalloc_stat_add(_slot, allocations, 1); \
 } while(0)
 
 #define update_zmalloc_stat_free(__n) do { \
     size_t _n = (__n); \
+    zmallocSlot *_slot = zmalloc_slot ? zmalloc_slot : zmalloc_thread_slot(); \
     if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
-    if (zmalloc_thread_safe) { \
-        pthread_mutex_lock(&used_memory_mutex);  \
-        used_memory -= _n; \
-        pthread_mutex_unlock(&used_memory_mutex); \
-    } else { \
-        used_memory -= _n; \
-    } \
+    update_zmalloc_stat_add(_slot, used_memory, -_n); \
 } while(0)
 
-static size_t used_memory = 0;
-static int zmalloc_thread_safe = 0;
-pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* one per thread, then the shared one */
+static zmallocSlot zmalloc_slots[ZMALLOC_SLOTS + 1] __attribute__((aligned(ZMALLOC_CACHE_LINE)));
+static __thread zmallocSlot *zmalloc_slot;
+
+/* slots no live thread owns, taken and given back under the mutex */
+static zmallocSlot *zmalloc_free_slots[ZMALLOC_SLOTS];
+static int zmalloc_free_count;
+static pthread_mutex_t zmalloc_slots_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t zmalloc_slots_once = PTHREAD_ONCE_INIT;
+static pthread_key_t zmalloc_slot_key;
+
+/* Called at the exit of a thread owning a slot. */
+static void zmalloc_release_slot(void *slot) {
+    pthread_mutex_lock(&zmalloc_slots_mutex);
+    zmalloc_free_slots[zmalloc_free_count++] = slot;
+    pthread_mutex_unlock(&zmalloc_slots_mutex);
+    /* a later destructor freeing something takes a slot again */
+    zmalloc_slot = NULL;
+}
+
+static void zmalloc_init_slots(void) {
+    int i;
+
+    /* slot 0 first, the main thread allocates before any other */
+    for (i = 0; i < ZMALLOC_SLOTS; i++)
+        zmalloc_free_slots[i] = &zmalloc_slots[ZMALLOC_SLOTS - 1 - i];
+    zmalloc_free_count = ZMALLOC_SLOTS;
+    pthread_key_create(&zmalloc_slot_key, zmalloc_release_slot);
+}
+
+/* The slot of the calling thread, taken at its first allocation. */
+static zmallocSlot *zmalloc_thread_slot(void) {
+    zmallocSlot *slot = &zmalloc_slots[ZMALLOC_SLOTS];
+
+    pthread_once(&zmalloc_slots_once, zmalloc_init_slots);
+    pthread_mutex_lock(&zmalloc_slots_mutex);
+    if (zmalloc_free_count) slot = zmalloc_free_slots[--zmalloc_free_count];
+    pthread_mutex_unlock(&zmalloc_slots_mutex);
+    if (slot != &zmalloc_slots[ZMALLOC_SLOTS]) pthread_setspecific(zmalloc_slot_key, slot);
+    zmalloc_slot = slot;
+    return slot;
+}
 
 static void zmalloc_oom(size_t size) {
     fprintf(stderr, "zmalloc: Out of memory trying to allocate %zu bytes\n",
@@ -177,16 +232,22 @@ char *zstrdup(const char *s) {
 }
 
 size_t zmalloc_used_memory(void) {
-    size_t um;
+    size_t um = 0;
+    int i;
 
-    if (zmalloc_thread_safe) pthread_mutex_lock(&used_memory_mutex);
-    um = used_memory;
-    if (zmalloc_thread_safe) pthread_mutex_unlock(&used_memory_mutex);
+    for (i = 0; i <= ZMALLOC_SLOTS; i++)
+        um += __atomic_load_n(&zmalloc_slots[i].used_memory, __ATOMIC_RELAXED);
     return um;
 }
 
-void zmalloc_enable_thread_safeness(void) {
-    zmalloc_thread_safe = 1;
+/* Calls to zmalloc, zcalloc and zrealloc so far. */
+size_t zmalloc_allocations(void) {
+    size_t n = 0;
+    int i;
+
+    for (i = 0; i <= ZMALLOC_SLOTS; i++)
+        n += __atomic_load_n(&zmalloc_slots[i].allocations, __ATOMIC_RELAXED);
+    return n;
 }
 
 /* Get the RSS information in an OS-specific way.
@@ -272,12 +333,12 @@ float zmalloc_get_fragmentation_ratio(void) {
     return (float)zmalloc_get_rss()/zmalloc_used_memory();
 }
 
+/* Only while no other thread allocates. */
 void zmalloc_set_used_memory(size_t um) {
-    if (zmalloc_thread_safe) pthread_mutex_lock(&used_memory_mutex);
-    used_memory = um;
-    if (zmalloc_thread_safe) pthread_mutex_unlock(&used_memory_mutex);
-}
+    int i;
 
-int zmalloc_get_thread_safty(void) {
-    return zmalloc_thread_safe;
+    for (i = 1; i <= ZMALLOC_SLOTS; i++)
+        __atomic_store_n(&zmalloc_slots[i].used_memory, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&zmalloc_slots[0].used_memory, um, __ATOMIC_RELAXED);
 }
+
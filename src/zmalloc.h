@@ -59,6 +59,13 @@
 #include <malloc/malloc.h>
 #define HAVE_MALLOC_SIZE 1
 #define zmalloc_size(p) malloc_size(p)
+
+/* glibc and musl tell the size of a block too, which saves the size_t
+ * header before each one. -DNO_MALLOC_USABLE_SIZE keeps the header. */
+#elif defined(__linux__) && !defined(NO_MALLOC_USABLE_SIZE)
+#include <malloc.h>
+#define HAVE_MALLOC_SIZE 1
+#define zmalloc_size(p) malloc_usable_size(p)
 #endif
 
 #ifndef ZMALLOC_LIB
@@ -71,10 +78,9 @@ void *zrealloc(void *ptr, size_t size);
 void zfree(void *ptr);
 char *zstrdup(const char *s);
 size_t zmalloc_used_memory(void);
-void zmalloc_enable_thread_safeness(void);
+size_t zmalloc_allocations(void);
 float zmalloc_get_fragmentation_ratio(void);
 size_t zmalloc_get_rss(void);
 void zmalloc_set_used_memory(size_t size);
-int zmalloc_get_thread_safty(void);
 
 #endif /* __ZMALLOC_H */